@@ -0,0 +1,826 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <stddef.h> // offsetof
+#include <cstring>
+
+#include "../utils/misc.h"
+#include "../utils/log.h"
+#include "../utils/Random.h"
+#include "../logic/message.h"
+#include "../containers/slidingWindow.h"
+#include "../containers/concurrentSlidingWindow.h"
+#include "../containers/hashTable.h"
+#include "../containers/mpscRing.h"
+#include "../containers/spscRing.h"
+#include "../containers/pagedTable.h"
+#include "../utils/clock.h"
+#include "../utils/histogram.h"
+#include "../utils/timerWheel.h"
+#include "../utils/spinlock.h"
+
+// stream based codec which the server used before wire:: helpers, kept as a baseline
+namespace legacy {
+	void SerialiseMessage(char* outBuf, data::message* inMsg)
+	{
+		std::ostringstream stream{ std::string{outBuf, sizeof(data::message)} };
+		char* base = reinterpret_cast<char*>(inMsg);
+		char* src = base;
+		stream.write(src, sizeof(inMsg->MessageSize));
+		src = base + offsetof(data::message, MessageType);
+		stream.write(src, sizeof(inMsg->MessageType));
+		src = base + offsetof(data::message, MessageId);
+		stream.write(src, sizeof(inMsg->MessageId));
+		src = base + offsetof(data::message, MessageData);
+		stream.write(src, sizeof(inMsg->MessageData));
+		memcpy(outBuf, stream.str().c_str(), stream.str().length());
+	}
+
+	void DeserialiseMessage(char* inBuf, data::message* outMsg)
+	{
+		std::istringstream stream{ std::string{inBuf, sizeof(data::message)} };
+		char* base = reinterpret_cast<char*>(outMsg);
+		char* dst = base;
+		stream.read(dst, sizeof(outMsg->MessageSize));
+		dst = base + offsetof(data::message, MessageType);
+		stream.read(dst, sizeof(outMsg->MessageType));
+		dst = base + offsetof(data::message, MessageId);
+		stream.read(dst, sizeof(outMsg->MessageId));
+		dst = base + offsetof(data::message, MessageData);
+		stream.read(dst, sizeof(outMsg->MessageData));
+	}
+
+	// linked list queue under a spinlock, which receivers used to hand messages to forwarder
+	template <typename T>
+	class LockedQueue
+	{
+		struct node {
+			T data;
+			node* next;
+		};
+		node* m_head;
+		node* m_tail;
+		int m_size;
+		sync::spinlock m_lock;
+
+	public:
+		LockedQueue() : m_head{ new node{} }, m_tail{ m_head }, m_size{ 0 } {}
+		~LockedQueue()
+		{
+			while (node* old = m_head) {
+				m_head = old->next;
+				delete old;
+			}
+		}
+
+		void push(const T* vals, int count)
+		{
+			sync::lock_guard lock{ m_lock };
+			for (int i = 0; i < count; ++i) {
+				node* p = new node{};
+				m_tail->data = vals[i];
+				m_tail->next = p;
+				m_tail = p;
+				m_size++;
+			}
+		}
+
+		bool pop(T* out)
+		{
+			sync::lock_guard lock{ m_lock };
+			if (m_size == 0) {
+				return false;
+			}
+			node* old = m_head;
+			m_head = old->next;
+			*out = old->data;
+			delete old;
+			m_size--;
+			return true;
+		}
+	};
+}
+
+namespace bench {
+	using Clock = std::chrono::steady_clock;
+
+	// keeps results alive, so compiler can't drop measured code
+	volatile uint64_t g_sink = 0;
+
+	template <typename Func>
+	double nsPerOp(int iterations, Func&& f)
+	{
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			f(i);
+		}
+		auto end = Clock::now();
+		return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	}
+
+	void codec(int iterations)
+	{
+		static const int s_poolSize = 1024; // power of two
+		std::vector<data::message> msgs(s_poolSize);
+		for (auto& m : msgs) {
+			m = {
+				static_cast<uint16_t>(math::Random(10, 100)),
+				static_cast<uint8_t>(math::Random(10, 100)),
+				math::Random(0, 1u << 30),
+				math::Random(0, 100)
+			};
+		}
+		// legacy codec writes sizeof(message) bytes, so slots are sized for it
+		std::vector<char> bufs(s_poolSize * sizeof(data::message));
+		auto slot = [&bufs](int i) { return bufs.data() + (i & (s_poolSize - 1)) * sizeof(data::message); };
+
+		LOG_INFO("codec, %d iterations", iterations);
+
+		double ns = nsPerOp(iterations, [&](int i) {
+			legacy::SerialiseMessage(slot(i), &msgs[i & (s_poolSize - 1)]);
+		});
+		LOG_INFO("  legacy serialise:    %8.2f ns/msg", ns);
+
+		ns = nsPerOp(iterations, [&](int i) {
+			data::message m;
+			legacy::DeserialiseMessage(slot(i), &m);
+			g_sink += m.MessageId;
+		});
+		LOG_INFO("  legacy deserialise:  %8.2f ns/msg", ns);
+
+		ns = nsPerOp(iterations, [&](int i) {
+			data::SerialiseMessage(slot(i), &msgs[i & (s_poolSize - 1)]);
+		});
+		LOG_INFO("  wire serialise:      %8.2f ns/msg", ns);
+
+		ns = nsPerOp(iterations, [&](int i) {
+			data::message m;
+			data::DeserialiseMessage(slot(i), &m);
+			g_sink += m.MessageId;
+		});
+		LOG_INFO("  wire deserialise:    %8.2f ns/msg", ns);
+
+		ns = nsPerOp(iterations, [&](int i) {
+			data::message_view v{ slot(i) };
+			g_sink += v.MessageId() + v.MessageData();
+		});
+		LOG_INFO("  message_view id+data: %7.2f ns/msg", ns);
+	}
+
+	void batchDecode(int iterations)
+	{
+		static const int s_batch = data::MessageBatch::s_capacity;
+		static const int s_stride = 64; // same as receive buffers of the server
+		std::vector<char> bufs(s_batch * s_stride);
+		const char* ptrs[s_batch];
+		for (int i = 0; i < s_batch; ++i) {
+			data::message m{
+				static_cast<uint16_t>(math::Random(10, 100)),
+				static_cast<uint8_t>(math::Random(10, 100)),
+				math::Random(0, 1u << 30),
+				math::Random(0, 100)
+			};
+			data::SerialiseMessage(bufs.data() + i * s_stride, &m);
+			ptrs[i] = bufs.data() + i * s_stride;
+		}
+
+		data::MessageBatch scalar, simd;
+		data::DeserialiseBatchScalar(ptrs, s_batch, &scalar);
+		data::DeserialiseBatch(ptrs, s_batch, &simd);
+		for (int i = 0; i < s_batch; ++i) {
+			if (scalar.MessageId[i] != simd.MessageId[i] || scalar.MessageData[i] != simd.MessageData[i] ||
+				scalar.MessageSize[i] != simd.MessageSize[i] || scalar.MessageType[i] != simd.MessageType[i]) {
+				LOG_ERROR("batch decoder %s mismatch at %d", data::BatchDecoderName(), i);
+				return;
+			}
+		}
+
+		int batches = iterations / s_batch + 1;
+		LOG_INFO("batch decode, %d batches of %d, dispatched decoder: %s", batches, s_batch, data::BatchDecoderName());
+
+		double ns = nsPerOp(batches, [&](int) {
+			data::message m;
+			for (int i = 0; i < s_batch; ++i) {
+				data::DeserialiseMessage(ptrs[i], &m);
+				g_sink += m.MessageId;
+			}
+		}) / s_batch;
+		LOG_INFO("  per message:  %6.2f ns/msg", ns);
+
+		ns = nsPerOp(batches, [&](int) {
+			data::DeserialiseBatchScalar(ptrs, s_batch, &scalar);
+			g_sink += scalar.MessageId[s_batch - 1];
+		}) / s_batch;
+		LOG_INFO("  batch scalar: %6.2f ns/msg", ns);
+
+		ns = nsPerOp(batches, [&](int) {
+			data::DeserialiseBatch(ptrs, s_batch, &simd);
+			g_sink += simd.MessageId[s_batch - 1];
+		}) / s_batch;
+		LOG_INFO("  batch %s:   %6.2f ns/msg", data::BatchDecoderName(), ns);
+	}
+
+	// ids arrive shuffled within reorder span and every 10th is resent
+	std::vector<data::MsgId> makeIdStream(int count, int reorderSpan)
+	{
+		std::vector<data::MsgId> ids;
+		ids.reserve(count + count / 10);
+		for (int i = 0; i < count; ++i) {
+			ids.push_back(static_cast<data::MsgId>(i));
+			if (i % 10 == 9) {
+				ids.push_back(static_cast<data::MsgId>(i - math::Random(0, 10)));
+			}
+		}
+		for (size_t i = 0; i < ids.size(); ++i) {
+			size_t j = i + math::Random(static_cast<unsigned int>(reorderSpan));
+			if (j < ids.size()) {
+				std::swap(ids[i], ids[j]);
+			}
+		}
+		return ids;
+	}
+
+	void dedup(int iterations)
+	{
+		static const int s_reorderSpan = 4096;
+		std::vector<data::MsgId> ids = makeIdStream(iterations, s_reorderSpan);
+		LOG_INFO("dedup, %d ids, reorder span %d", static_cast<int>(ids.size()), s_reorderSpan);
+
+		const int windows[] = { 1 << 16, 1 << 20, 1 << 24 };
+		for (int w : windows) {
+			cont::SlidingWindow sw;
+			sw.init(w);
+			int accepted = 0;
+			double ns = nsPerOp(static_cast<int>(ids.size()), [&](int i) {
+				accepted += sw.insert(ids[i]);
+			});
+			LOG_INFO("  window %8d: %6.2f ns/id, accepted %d", w, ns, accepted);
+		}
+
+		// stray ids far ahead of the stream (corrupt or foreign datagrams) must not make it look old
+		std::vector<data::MsgId> stray;
+		stray.reserve(ids.size() + ids.size() / 10000 + 1);
+		int strays = 0;
+		for (size_t i = 0; i < ids.size(); ++i) {
+			stray.push_back(ids[i]);
+			if (i % 10000 == 5000) {
+				stray.push_back(ids[i] + (1ull << 40));
+				strays++;
+			}
+		}
+		cont::SlidingWindow sw;
+		sw.init(1 << 20);
+		int accepted = 0;
+		double ns = nsPerOp(static_cast<int>(stray.size()), [&](int i) {
+			accepted += sw.insert(stray[i]);
+		});
+		LOG_INFO("  window %8d with %d stray ids: %6.2f ns/id, accepted %d, rejected far ahead %llu",
+			1 << 20, strays, ns, accepted, static_cast<unsigned long long>(sw.farRejected()));
+
+		// lock-free filter of the server gets the same stream, it has to accept exactly the in-range ids
+		cont::ConcurrentSlidingWindow clean;
+		clean.init(1 << 20);
+		int expected = 0;
+		for (data::MsgId id : ids) {
+			expected += clean.insert(id);
+		}
+		cont::ConcurrentSlidingWindow csw;
+		csw.init(1 << 20);
+		accepted = 0;
+		ns = nsPerOp(static_cast<int>(stray.size()), [&](int i) {
+			accepted += csw.insert(stray[i]);
+		});
+		LOG_INFO("  lock-free window %8d with %d stray ids: %6.2f ns/id, accepted %d, rejected far ahead %llu%s",
+			1 << 20, strays, ns, accepted, static_cast<unsigned long long>(csw.farRejected()),
+			accepted == expected ? "" : " (IN-RANGE IDS LOST)");
+	}
+
+	// table filled with sequential ids up to PagedTable rotation load,
+	// misses are what PagedTable::has/get do on every page which doesn't hold the id
+	void hashTable(int iterations)
+	{
+		using Table = cont::HashTable<data::message, data::MsgId, data::MessageHasher, data::MessageKey, std::equal_to<data::MsgId>>;
+		static const int s_tableSize = 1 << 16;
+		static const int s_count = s_tableSize * 8 / 10;
+		LOG_INFO("hash table, %d slots, %d sequential ids", s_tableSize, s_count);
+
+		Table t;
+		t.init(s_tableSize);
+		data::message msg{ 0, 0, 0, 0 };
+		// first fill only touches memory
+		for (int i = 0; i < s_count; ++i) {
+			msg.MessageId = static_cast<data::MsgId>(i);
+			t.insert(msg);
+		}
+		t.clear();
+		double insert = nsPerOp(s_count, [&](int i) {
+			msg.MessageId = static_cast<data::MsgId>(i);
+			t.insert(msg);
+		});
+
+		uint64_t found = 0;
+		double hit = nsPerOp(iterations, [&](int i) {
+			found += t.has(static_cast<data::MsgId>(i % s_count));
+		});
+		double miss = nsPerOp(iterations, [&](int i) {
+			found += t.has(static_cast<data::MsgId>(s_tableSize + i));
+		});
+		g_sink = found;
+		LOG_INFO("  insert %6.2f ns/op, hit %6.2f ns/op, miss %6.2f ns/op, load %.2f", insert, hit, miss, t.loadFactor());
+	}
+
+	// per insert latency while table grows from 1024 slots, against table allocated at full size
+	void hashTableGrowth(int iterations)
+	{
+		using Table = cont::HashTable<data::message, data::MsgId, data::MessageHasher, data::MessageKey, std::equal_to<data::MsgId>>;
+		static const int s_maxSize = 1 << 23;
+		const int count = iterations < s_maxSize * 7 / 10 ? iterations : s_maxSize * 7 / 10;
+		LOG_INFO("hash table growth, %d inserts", count);
+
+		auto report = [](const char* name, std::vector<uint32_t>& lat, int capacity) {
+			const size_t n = lat.size();
+			if (n == 0) {
+				return;
+			}
+			std::sort(lat.begin(), lat.end());
+			LOG_INFO("  %-9s p50 %5u ns, p99 %5u ns, p99.9 %5u ns, max %8u ns, %8d inserts, capacity %d", name,
+				lat[n / 2], lat[n * 99 / 100], lat[n * 999 / 1000], lat[n - 1], static_cast<int>(n), capacity);
+		};
+		// inserts which did a migration step are reported apart, growth must not show in their tail
+		auto run = [count, &report](const char* name, Table& t) {
+			std::vector<uint32_t> lat;
+			std::vector<uint32_t> migrating;
+			lat.reserve(count);
+			data::message msg{ 0, 0, 0, 0 };
+			for (int i = 0; i < count; ++i) {
+				msg.MessageId = static_cast<data::MsgId>(i);
+				const bool growing = t.isGrowing();
+				auto start = Clock::now();
+				t.insert(msg);
+				const uint32_t ns = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+				lat.push_back(ns);
+				if (growing) {
+					migrating.push_back(ns);
+				}
+			}
+			report(name, lat, static_cast<int>(t.capacity()));
+			report("migrating", migrating, static_cast<int>(t.capacity()));
+		};
+
+		Table fixed;
+		fixed.init(s_maxSize);
+		run("fixed", fixed);
+
+		Table growing;
+		growing.init(1024, s_maxSize);
+		run("growing", growing);
+	}
+
+	// lookup cost against number of pages, ids are inserted by "receiver" i % pages
+	void pagedLookup(int iterations)
+	{
+		using Paged = cont::PagedTable<data::message, data::MsgId, data::MessageHasher, data::MessageKey, std::equal_to<data::MsgId>>;
+		static const int s_count = 1 << 18;
+		LOG_INFO("paged table lookups, %d ids", s_count);
+
+		struct Mode {
+			const char* m_name;
+			cont::Routing m_routing;
+			int m_indexSize;
+		};
+		const Mode modes[] = {
+			{ "scan", cont::Routing::ByPage, 0 },
+			{ "index", cont::Routing::ByPage, 1 << 20 },
+			{ "key", cont::Routing::ByKey, 0 },
+		};
+
+		for (int pages = 2; pages <= 32; pages *= 2) {
+			double hit[3];
+			double miss[3];
+			for (int m = 0; m < 3; ++m) {
+				Paged t;
+				t.init(pages, 1024, 1 << 20, modes[m].m_routing, modes[m].m_indexSize);
+				data::message msg{ 0, 0, 0, 0 };
+				for (int i = 0; i < s_count; ++i) {
+					msg.MessageId = static_cast<data::MsgId>(i);
+					t.insert(i % pages, msg);
+				}
+
+				uint64_t found = 0;
+				hit[m] = nsPerOp(iterations, [&](int i) {
+					found += t.has(static_cast<data::MsgId>(i % s_count));
+				});
+				miss[m] = nsPerOp(iterations, [&](int i) {
+					found += t.has(static_cast<data::MsgId>(s_count + i));
+				});
+				g_sink = found;
+			}
+			LOG_INFO("  %2d pages: hit/miss ns - %s %6.1f/%6.1f, %s %6.1f/%6.1f, %s %6.1f/%6.1f", pages,
+				modes[0].m_name, hit[0], miss[0], modes[1].m_name, hit[1], miss[1], modes[2].m_name, hit[2], miss[2]);
+		}
+	}
+
+	// runs f(threadIdx, threadsCount) on n threads started together, returns wall time in seconds
+	template <typename Func>
+	double runThreads(int n, Func&& f)
+	{
+		std::atomic<int> ready{ 0 };
+		std::atomic<bool> go{ false };
+		std::vector<std::thread> threads;
+		for (int t = 0; t < n; ++t) {
+			threads.emplace_back([&, t]() {
+				ready.fetch_add(1);
+				while (!go.load(std::memory_order_acquire)) {}
+				f(t, n);
+			});
+		}
+		while (ready.load() != n) {}
+
+		auto start = Clock::now();
+		go.store(true, std::memory_order_release);
+		for (auto& t : threads) {
+			t.join();
+		}
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	// one writer ingests ids while readers look up recent ones under epoch guards,
+	// pages rotate all the time, readers should not slow the writer down
+	void queryDuringIngest(int iterations)
+	{
+		using Paged = cont::PagedTable<data::message, data::MsgId, data::MessageHasher, data::MessageKey, std::equal_to<data::MsgId>>;
+		static const int s_pages = 4;
+		LOG_INFO("lookups during ingest, %d ids, %d pages", iterations, s_pages);
+
+		for (int readers = 0; readers <= 8; readers = readers ? readers * 2 : 1) {
+			Paged t;
+			t.init(s_pages, 1024, 1 << 16, cont::Routing::ByKey);
+			std::atomic<uint64_t> written{ 0 };
+			std::atomic<bool> done{ false };
+			std::atomic<uint64_t> lookups{ 0 };
+			std::atomic<uint64_t> hits{ 0 };
+			double writerTime = 0;
+
+			runThreads(readers + 1, [&](int idx, int) {
+				if (idx == 0) {
+					auto start = Clock::now();
+					data::message msg{ 0, 0, 0, 0 };
+					for (int i = 0; i < iterations; ++i) {
+						msg.MessageId = static_cast<data::MsgId>(i);
+						t.insert(0, msg);
+						if ((i & 255) == 0) {
+							written.store(i, std::memory_order_relaxed);
+						}
+					}
+					writerTime = std::chrono::duration<double>(Clock::now() - start).count();
+					done.store(true, std::memory_order_release);
+					return;
+				}
+
+				uint64_t n = 0;
+				uint64_t found = 0;
+				uint64_t x = static_cast<uint64_t>(idx);
+				while (!done.load(std::memory_order_acquire)) {
+					// ids from the last ~64k written
+					x = x * 6364136223846793005ull + 1442695040888963407ull;
+					const uint64_t w = written.load(std::memory_order_relaxed);
+					const uint64_t back = (x >> 48) < w ? (x >> 48) : w;
+					sync::EpochGuard guard{ t.epoch() };
+					const data::message* msg = t.get(static_cast<data::MsgId>(w - back), guard);
+					found += msg && msg->MessageId == w - back;
+					++n;
+				}
+				lookups.fetch_add(n);
+				hits.fetch_add(found);
+			});
+
+			LOG_INFO("  %d readers: ingest %7.2f Mids/s, lookups %7.2f M/s (hit %.0f%%)", readers,
+				iterations / writerTime / 1e6, lookups.load() / writerTime / 1e6,
+				lookups.load() ? 100.0 * hits.load() / lookups.load() : 0.0);
+		}
+	}
+
+	// producers push batches like receivers do, one consumer drains like forwarder does
+	void forwardQueue(int iterations)
+	{
+		static const int s_batch = 16;
+		LOG_INFO("forward queue, %d messages, batches of %d", iterations, s_batch);
+
+		for (int producers = 1; producers <= 8; producers *= 2) {
+			const int perProducer = iterations / producers / s_batch * s_batch;
+			const uint64_t total = static_cast<uint64_t>(perProducer) * producers;
+
+			legacy::LockedQueue<data::message> locked;
+			uint64_t lockedSum = 0;
+			double lockedTime = runThreads(producers + 1, [&](int idx, int) {
+				data::message msgs[s_batch] = {};
+				if (idx == producers) {
+					for (uint64_t got = 0; got < total;) {
+						if (locked.pop(msgs)) {
+							lockedSum += msgs[0].MessageId;
+							++got;
+						}
+					}
+					return;
+				}
+				for (int i = 0; i < perProducer; i += s_batch) {
+					for (int j = 0; j < s_batch; ++j) {
+						msgs[j].MessageId = static_cast<data::MsgId>(i + j);
+					}
+					locked.push(msgs, s_batch);
+				}
+			});
+
+			cont::MpscRing<data::message> ring;
+			ring.init(4096, cont::FullPolicy::Backpressure);
+			uint64_t ringSum = 0;
+			double ringTime = runThreads(producers + 1, [&](int idx, int) {
+				data::message msgs[64] = {};
+				if (idx == producers) {
+					for (uint64_t got = 0; got < total;) {
+						const int n = ring.popWait(msgs, 64, std::chrono::milliseconds(10));
+						for (int i = 0; i < n; ++i) {
+							ringSum += msgs[i].MessageId;
+						}
+						got += n;
+					}
+					return;
+				}
+				for (int i = 0; i < perProducer; i += s_batch) {
+					for (int j = 0; j < s_batch; ++j) {
+						msgs[j].MessageId = static_cast<data::MsgId>(i + j);
+					}
+					ring.push(msgs, s_batch);
+				}
+			});
+
+			LOG_INFO("  %d producers: spinlock list %7.2f Mmsg/s, ring %7.2f Mmsg/s%s", producers,
+				total / lockedTime / 1e6, total / ringTime / 1e6, lockedSum == ringSum ? "" : " (SUM MISMATCH)");
+		}
+
+		// shard handoff, one producer spins while ring is full like a sharded receiver does
+		const int count = iterations / s_batch * s_batch;
+		cont::SpscRing<data::message> spsc;
+		spsc.init(4096);
+		uint64_t spscSum = 0;
+		double spscTime = runThreads(2, [&](int idx, int) {
+			data::message msgs[64] = {};
+			if (idx == 1) {
+				for (int got = 0; got < count;) {
+					const int n = spsc.pop(msgs, 64);
+					for (int i = 0; i < n; ++i) {
+						spscSum += msgs[i].MessageId;
+					}
+					got += n;
+					if (n == 0) {
+						std::this_thread::yield();
+					}
+				}
+				return;
+			}
+			for (int i = 0; i < count; i += s_batch) {
+				for (int j = 0; j < s_batch; ++j) {
+					msgs[j].MessageId = static_cast<data::MsgId>(i + j);
+				}
+				for (int pushed = 0; pushed < s_batch;) {
+					pushed += spsc.push(msgs + pushed, s_batch - pushed);
+					if (pushed < s_batch) {
+						std::this_thread::yield();
+					}
+				}
+			}
+		});
+		const uint64_t expected = static_cast<uint64_t>(count) * (count - 1) / 2;
+		LOG_INFO("  spsc handoff: %7.2f Mmsg/s%s", count / spscTime / 1e6, spscSum == expected ? "" : " (SUM MISMATCH)");
+	}
+
+	// receivers get interleaved ids, like flows spread between them
+	void dedupScaling(int iterations)
+	{
+		static const int s_window = 1 << 20;
+		std::vector<data::MsgId> ids = makeIdStream(iterations, 4096);
+		const int total = static_cast<int>(ids.size());
+		LOG_INFO("dedup scaling, %d ids, window %d, %d cores", total, s_window, static_cast<int>(std::thread::hardware_concurrency()));
+
+		for (int threads = 1; threads <= 32; threads *= 2) {
+			cont::SlidingWindow sw;
+			sw.init(s_window);
+			sync::spinlock lock;
+			std::atomic<int> lockedAccepted{ 0 };
+			double locked = runThreads(threads, [&](int t, int n) {
+				int accepted = 0;
+				for (int i = t; i < total; i += n) {
+					sync::lock_guard guard{ lock };
+					accepted += sw.insert(ids[i]);
+				}
+				lockedAccepted.fetch_add(accepted);
+			});
+
+			cont::ConcurrentSlidingWindow csw;
+			csw.init(s_window);
+			std::atomic<int> lockFreeAccepted{ 0 };
+			double lockFree = runThreads(threads, [&](int t, int n) {
+				int accepted = 0;
+				for (int i = t; i < total; i += n) {
+					accepted += csw.insert(ids[i]);
+				}
+				lockFreeAccepted.fetch_add(accepted);
+			});
+
+			LOG_INFO("  %2d threads: spinlock %7.2f Mids/s (accepted %d), lock-free %7.2f Mids/s (accepted %d)",
+				threads, total / locked / 1e6, lockedAccepted.load(), total / lockFree / 1e6, lockFreeAccepted.load());
+		}
+	}
+
+	// latency like values: log-normal body with rare slow tail, percentiles are checked against sorted input
+	void histogram(int iterations)
+	{
+		std::vector<uint64_t> values(iterations);
+		uint64_t x = 0x9e3779b97f4a7c15ull;
+		for (int i = 0; i < iterations; ++i) {
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+			const int exp = 10 + static_cast<int>(x % 5) + (x % 1000 == 0 ? 8 : 0);
+			values[i] = (1ull << exp) + (x >> 40) % (1ull << exp);
+		}
+
+		utils::Histogram h;
+		double record = nsPerOp(iterations, [&](int i) { h.record(values[i]); });
+		g_sink = h.count();
+
+		std::sort(values.begin(), values.end());
+		LOG_INFO("histogram, %d values, record %.2f ns", iterations, record);
+		const double ps[] = { 50.0, 99.0, 99.9, 99.99 };
+		for (double p : ps) {
+			const uint64_t exact = values[static_cast<size_t>(p / 100.0 * (iterations - 1))];
+			const uint64_t approx = h.percentile(p);
+			LOG_INFO("  p%-5g exact %10llu, histogram %10llu, error %.2f%%", p, static_cast<unsigned long long>(exact),
+				static_cast<unsigned long long>(approx), 100.0 * (static_cast<double>(approx) - exact) / exact);
+		}
+	}
+
+	// cost on logging thread of a message line: async logger vs formatting it in place (old LOG_*),
+	// output goes to null device so terminal speed doesn't count
+	void logging(int iterations)
+	{
+#ifdef WIN32
+		FILE* null = fopen("NUL", "w");
+#else
+		FILE* null = fopen("/dev/null", "w");
+#endif
+		if (!null) {
+			LOG_ERROR("log bench needs null device.");
+			return;
+		}
+
+		data::message m{ 19, 1, 0, 0 };
+		auto start = Clock::now();
+		double direct = nsPerOp(iterations, [&](int i) {
+			m.MessageId = static_cast<uint64_t>(i);
+			fprintf(null, "[INFO] Recieved on %d: " DATA_MSG_FMT "\n", 3, m.MessageSize, m.MessageType,
+				static_cast<unsigned long long>(m.MessageId), static_cast<unsigned long long>(m.MessageData));
+		});
+		fflush(null);
+		const double directTotal = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+		utils::Logger::setOutput(null);
+		// bursts which fit into the ring show what caller pays while logger keeps up
+		static const int s_burst = 256;
+		double burst = 0.0;
+		const int bursts = iterations / s_burst > 0 ? iterations / s_burst : 1;
+		for (int b = 0; b < bursts; ++b) {
+			burst += nsPerOp(s_burst, [&](int i) {
+				m.MessageId = static_cast<uint64_t>(i);
+				LOG_INFO("Recieved on %d: " DATA_MSG_FMT, 3, DATA_MSG_ARGS(m));
+			});
+			utils::Logger::flush();
+		}
+		burst /= bursts;
+
+		start = Clock::now();
+		double async = nsPerOp(iterations, [&](int i) {
+			m.MessageId = static_cast<uint64_t>(i);
+			LOG_INFO("Recieved on %d: " DATA_MSG_FMT, 3, DATA_MSG_ARGS(m));
+		});
+		utils::Logger::flush();
+		const double asyncTotal = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+		utils::Logger::setOutput(stdout);
+		fclose(null);
+
+		LOG_INFO("log, message line: printf %.1f ns (%.1f ns with flush), async burst %.1f ns, "
+			"async sustained %.1f ns on caller, %.1f ns with drain", direct, directTotal, burst, async, asyncTotal);
+	}
+
+	// cost of one time stamp from each clock, TSC drift against steady clock over 100 ms
+	void clocks(int iterations)
+	{
+		utils::CoarseClock::start();
+		uint64_t sum = 0;
+		double system = nsPerOp(iterations, [&](int) {
+			sum += static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+		});
+		double steady = nsPerOp(iterations, [&](int) { sum += utils::SteadyClock::nowNs(); });
+		double tsc = nsPerOp(iterations, [&](int) { sum += utils::TscClock::nowNs(); });
+		double coarse = nsPerOp(iterations, [&](int) { sum += utils::CoarseClock::nowNs(); });
+		g_sink = sum;
+
+		const uint64_t steady0 = utils::SteadyClock::nowNs();
+		const uint64_t tsc0 = utils::TscClock::nowNs();
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		const int64_t steadyDelta = static_cast<int64_t>(utils::SteadyClock::nowNs() - steady0);
+		const int64_t tscDelta = static_cast<int64_t>(utils::TscClock::nowNs() - tsc0);
+
+		LOG_INFO("clocks, ns per stamp: system %.2f, steady %.2f, tsc %.2f, coarse %.2f", system, steady, tsc, coarse);
+		LOG_INFO("  tsc %s, %.3f ticks/ns, drift over 100 ms %lld ns", utils::TscClock::usesTsc() ? "on" : "off (steady clock)",
+			utils::TscClock::ticksPerNs(), static_cast<long long>(tscDelta - steadyDelta));
+	}
+
+	// idle timers of many connections: each is scheduled, most are cancelled (connection
+	// became active), the rest expire while wheel advances through their whole range
+	void timerWheel(int iterations)
+	{
+		static const int s_timers = 10000;
+		utils::TimerWheel wheel;
+		std::vector<utils::TimerWheel::TimerId> ids(s_timers);
+		uint64_t fired = 0;
+		uint64_t x = 0x9e3779b97f4a7c15ull;
+		const int rounds = iterations / s_timers > 0 ? iterations / s_timers : 1;
+		uint64_t now = 0;
+
+		double schedule = 0.0;
+		double cancel = 0.0;
+		double expire = 0.0;
+		for (int r = 0; r < rounds; ++r) {
+			schedule += nsPerOp(s_timers, [&](int i) {
+				x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+				// 1 ms to ~65 s, so all levels but the top one are used
+				ids[i] = wheel.schedule(1 + x % 65536, [&fired]() { fired++; });
+			});
+			cancel += nsPerOp(s_timers, [&](int i) {
+				if (i % 4 != 0) {
+					wheel.cancel(ids[i]);
+				}
+			});
+			auto start = Clock::now();
+			now += 65536;
+			wheel.advance(now);
+			expire += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		}
+
+		LOG_INFO("timer wheel, %d timers per round: schedule %.1f ns, cancel %.1f ns, advance %.1f us per 65 s of ticks, fired %llu",
+			s_timers, schedule / rounds, cancel / rounds, expire / rounds / 1e3, static_cast<unsigned long long>(fired));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string name = "all";
+	int iterations = 1000000;
+	utils::setIfHasParams<std::string>(argc, argv, "-b", &name);
+	utils::setIfHasParams<int>(argc, argv, "-n", &iterations);
+
+	if (name == "all" || name == "codec") {
+		bench::codec(iterations);
+	}
+	if (name == "all" || name == "batch") {
+		bench::batchDecode(iterations);
+	}
+	if (name == "all" || name == "dedup") {
+		bench::dedup(iterations);
+	}
+	if (name == "all" || name == "table") {
+		bench::hashTable(iterations);
+	}
+	if (name == "all" || name == "growth") {
+		bench::hashTableGrowth(iterations);
+	}
+	if (name == "all" || name == "paged") {
+		bench::pagedLookup(iterations);
+	}
+	if (name == "all" || name == "dedupmt") {
+		bench::dedupScaling(iterations);
+	}
+	if (name == "all" || name == "query") {
+		bench::queryDuringIngest(iterations);
+	}
+	if (name == "all" || name == "ring") {
+		bench::forwardQueue(iterations);
+	}
+	if (name == "all" || name == "hist") {
+		bench::histogram(iterations);
+	}
+	if (name == "all" || name == "log") {
+		bench::logging(iterations);
+	}
+	if (name == "all" || name == "clock") {
+		bench::clocks(iterations);
+	}
+	if (name == "all" || name == "wheel") {
+		bench::timerWheel(iterations);
+	}
+	return 0;
+}
@@ -1,40 +1,234 @@
 
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include "../utils/histogram.h"
 #include "../utils/log.h"
+#include "../utils/misc.h"
+#include "../utils/timer.h"
 #include "../socket/socket.h"
+#include "../socket/reactor.h"
 #include "../logic/message.h"
+#include "../logic/streamDecoder.h"
 
-int main() {
-	if (!soc::initSocLib()) {
-		return -1;
-	}
-	
-	soc::Socket s1{soc::socTCPPortStart, soc::SocketType::TCP, soc::SocketRole::Listener, true};
-	if (!s1.init() || !s1.bind() || !s1.listen()) {
-		return -1;
-	}
-	
-	while (true) {
-		soc::Socket* newConnection = s1.accept(60000);
-		if (newConnection) {
-			char buf[64];
-			int receivedBytes = 1;
-			while (receivedBytes > 0) {
-				receivedBytes = newConnection->receive(buf, 64);
-				if (receivedBytes) {
-					data::message msg{};
-					data::DeserialiseMessage(buf, &msg);
-					std::string smsg{ data::toString(msg) };
-					LOG_INFO("Recieved: %d, Data: %s\n", receivedBytes, smsg.c_str());
+namespace {
+	using TimerId = utils::TimerWheel::TimerId;
+
+	// one upstream connection, bytes go straight into decoder buffer
+	struct Connection {
+		std::unique_ptr<soc::Socket> m_soc;
+		data::StreamDecoder m_decoder;
+		int m_id;
+		uint64_t m_messages;
+		// reactor time of the last read, idle timer compares against it when it fires
+		uint64_t m_lastActiveMs;
+		TimerId m_idleTimer;
+	};
+
+	class Listener {
+	public:
+		Listener(bool verbose)
+			:
+			m_listener{ soc::socTCPPortStart, soc::SocketType::TCP, soc::SocketRole::Listener },
+			m_nextId{ 0 },
+			m_messages{ 0u },
+			m_reportedMessages{ 0u },
+			m_lastReportMs{ 0u },
+			m_idleMs{ 0u },
+			m_connIdleMs{ 0u },
+			m_idleTimer{ 0u },
+			m_verbose{ verbose }
+		{}
+
+		~Listener()
+		{
+			for (auto& c : m_connections) {
+				m_reactor.remove(c.second->m_soc.get());
+			}
+		}
+
+		bool init()
+		{
+			if (!m_reactor.init() || !m_listener.init() || !m_listener.bind() || !m_listener.listen()) {
+				return false;
+			}
+			return m_reactor.add(&m_listener, soc::EvRead, [this](unsigned int) { _accept(); });
+		}
+
+		// serves connections until none was open for idleSec,
+		// connection which sent nothing for connIdleSec is closed, 0 keeps it open
+		void run(int idleSec, int connIdleSec)
+		{
+			m_idleMs = static_cast<uint64_t>(idleSec < 0 ? 0 : idleSec) * 1000u;
+			m_connIdleMs = static_cast<uint64_t>(connIdleSec < 0 ? 0 : connIdleSec) * 1000u;
+			_armIdle();
+			if (!m_verbose) {
+				m_lastReportMs = m_reactor.timers().nowMs();
+				m_reactor.timers().schedule(1000, [this]() { _report(); });
+			}
+			m_reactor.run();
+		}
+
+	private:
+		void _accept()
+		{
+			while (soc::Socket* s = m_listener.accept(0)) {
+				std::unique_ptr<Connection> c{ new Connection{ std::unique_ptr<soc::Socket>{ s }, {}, m_nextId++, 0u, 0u, 0u } };
+				c->m_decoder.init();
+				Connection* conn = c.get();
+				if (!m_reactor.add(s, soc::EvRead, [this, conn](unsigned int events) { _read(conn, events); })) {
+					continue;
+				}
+				LOG_INFO("Connection %d accepted, %d open.", conn->m_id, static_cast<int>(m_connections.size()) + 1);
+				m_reactor.timers().cancel(m_idleTimer);
+				m_idleTimer = 0;
+				conn->m_lastActiveMs = m_reactor.timers().nowMs();
+				if (m_connIdleMs > 0) {
+					_armConnIdle(conn, m_connIdleMs);
+				}
+				m_connections[conn->m_id] = std::move(c);
+			}
+		}
+
+		// drains socket, level triggered reactor calls again if something is left
+		void _read(Connection* c, unsigned int events)
+		{
+			c->m_lastActiveMs = m_reactor.timers().nowMs();
+			int received = 0;
+			while ((received = c->m_soc->receive(c->m_decoder.writePtr(), c->m_decoder.writeSpace(), 0)) > 0) {
+				const int frames = c->m_decoder.commit(received, [this, c](const char* payload, int len) {
+					_onMessage(c, data::message_view{ payload }, len);
+				});
+				if (frames < 0) {
+					LOG_ERROR("Connection %d sent a malformed frame.", c->m_id);
+					_close(c);
+					return;
+				}
+			}
+
+			if (c->m_soc->isClosed() || (events & soc::EvError)) {
+				_close(c);
+			}
+		}
+
+		void _onMessage(Connection* c, const data::message_view& v, int len)
+		{
+			c->m_messages++;
+			m_messages++;
+			if (len >= data::wire::s_stampedPayloadSize) {
+				const uint64_t now = utils::monotonicNs();
+				const uint64_t sentNs = data::wire::load<uint64_t>(v.data() + data::wire::s_messageSize);
+				const uint64_t forwardNs = data::wire::load<uint64_t>(v.data() + data::wire::s_messageSize + data::wire::s_stampSize);
+				m_forwardLatency.record(now > forwardNs ? now - forwardNs : 0u);
+				m_totalLatency.record(now > sentNs ? now - sentNs : 0u);
+			}
+			if (m_verbose) {
+				const data::message msg = v.toMessage();
+				LOG_INFO("Recieved on %d: " DATA_MSG_FMT, c->m_id, DATA_MSG_ARGS(msg));
+			}
+		}
+
+		void _close(Connection* c)
+		{
+			if (c->m_decoder.pending() > 0) {
+				LOG_ERROR("Connection %d closed in the middle of a frame, %d bytes dropped.", c->m_id, c->m_decoder.pending());
+			}
+			LOG_INFO("Connection %d closed, %llu messages received.", c->m_id, static_cast<unsigned long long>(c->m_messages));
+			m_reactor.remove(c->m_soc.get());
+			m_reactor.timers().cancel(c->m_idleTimer);
+			c->m_soc->shutdown();
+			m_connections.erase(c->m_id);
+			if (m_connections.empty()) {
+				_armIdle();
+			}
+		}
+
+		// listener gives up after m_idleMs without connections
+		void _armIdle()
+		{
+			m_idleTimer = m_reactor.timers().schedule(m_idleMs, [this]() {
+				m_idleTimer = 0;
+				LOG_INFO("No connections for %d seconds, %llu messages received in total.",
+					static_cast<int>(m_idleMs / 1000u), static_cast<unsigned long long>(m_messages));
+				// only messages stamped by AttoUDPSend -ts are recorded
+				if (m_totalLatency.count() > 0) {
+					LOG_INFO("Latency forward to receive: %s.", m_forwardLatency.describe().c_str());
+					LOG_INFO("Latency send to receive: %s.", m_totalLatency.describe().c_str());
 				}
+				m_reactor.stop();
+			});
+		}
+
+		// timer isn't moved on every read, it checks last activity when it fires and
+		// sleeps again for the rest of the period
+		void _armConnIdle(Connection* c, uint64_t delayMs)
+		{
+			c->m_idleTimer = m_reactor.timers().schedule(delayMs, [this, c]() {
+				// timer is cancelled when connection closes, so c is alive here
+				c->m_idleTimer = 0;
+				const uint64_t silent = m_reactor.timers().nowMs() - c->m_lastActiveMs;
+				if (silent >= m_connIdleMs) {
+					LOG_INFO("Connection %d sent nothing for %d seconds.", c->m_id, static_cast<int>(silent / 1000u));
+					_close(c);
+					return;
+				}
+				_armConnIdle(c, m_connIdleMs - silent);
+			});
+		}
+
+		void _report()
+		{
+			const uint64_t now = m_reactor.timers().nowMs();
+			if (m_messages != m_reportedMessages && now > m_lastReportMs) {
+				const double secs = static_cast<double>(now - m_lastReportMs) / 1e3;
+				LOG_INFO("%d connections, %.0f messages/s, %llu in total.", static_cast<int>(m_connections.size()),
+					(m_messages - m_reportedMessages) / secs, static_cast<unsigned long long>(m_messages));
+				m_reportedMessages = m_messages;
 			}
-			newConnection->shutdown();
-			delete newConnection;
+			m_lastReportMs = now;
+			m_reactor.timers().schedule(1000, [this]() { _report(); });
 		}
-		else {
-			break;
+
+	private:
+		soc::Reactor m_reactor;
+		soc::Socket m_listener;
+		std::unordered_map<int, std::unique_ptr<Connection>> m_connections;
+		int m_nextId;
+		uint64_t m_messages;
+		uint64_t m_reportedMessages;
+		uint64_t m_lastReportMs;
+		uint64_t m_idleMs;
+		uint64_t m_connIdleMs;
+		TimerId m_idleTimer;
+		bool m_verbose;
+		utils::Histogram m_forwardLatency;
+		utils::Histogram m_totalLatency;
+	};
+}
+
+int main(int argc, char** argv) {
+	if (!soc::initSocLib()) {
+		return -1;
+	}
+
+	int verbose = 1;
+	int idleSec = 60;
+	int connIdleSec = 0;
+	utils::setIfHasParams<int>(argc, argv, "-v", &verbose);
+	utils::setIfHasParams<int>(argc, argv, "-i", &idleSec);
+	utils::setIfHasParams<int>(argc, argv, "-ci", &connIdleSec);
+
+	{
+		Listener listener{ verbose != 0 };
+		if (!listener.init()) {
+			return -1;
 		}
+		listener.run(idleSec, connIdleSec);
 	}
+
+	utils::Logger::flush();
 	system("pause");
 	soc::shutdownSocLib();
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,66 +1,232 @@
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <chrono>
+#include <cmath>
 #include <memory>
+#include <queue>
 #include <string>
+#include <vector>
 
 #include <cstring>
+#include <ctime>
 #include <stdlib.h>
 
 #include "../utils/misc.h"
 #include "../utils/log.h"
 
 #include "../socket/socket.h"
-#include "../utils/spinlock.h"
+#include "../utils/clock.h"
 #include "../utils/Random.h"
+#include "../utils/thread.h"
+#include "../utils/threadGroup.h"
+#include "../utils/timer.h"
 #include "../logic/message.h"
 
 using MsgId = std::uint64_t;
-using aflag = sync::aflag;
-using spinlock = sync::spinlock;
+
+// network conditions senders imitate, rates are probabilities per datagram
+struct Impairment {
+	// every n-th datagram repeats previous id right away, 0 is off
+	int m_dupEvery = 0;
+	// copy of a datagram is sent m_dupDelay datagrams later
+	double m_dupRate = 0.0;
+	int m_dupDelay = 0;
+	// datagram is held back and sent after distance others, distance is geometric
+	// with mean m_reorderMean (uniform in [1, 2 * mean - 1] with m_reorderUniform),
+	// at most m_reorderMax
+	double m_reorderRate = 0.0;
+	double m_reorderMean = 1.0;
+	int m_reorderMax = 1;
+	bool m_reorderUniform = false;
+	// random loss, and burst loss (Gilbert model): good state starts a burst with
+	// m_burstLossRate, bursts lose every datagram and last m_burstLossLen on average
+	double m_lossRate = 0.0;
+	double m_burstLossRate = 0.0;
+	double m_burstLossLen = 1.0;
+	// every m_microburstMs m_microburstSize datagrams go out without pacing
+	int m_microburstSize = 0;
+	int m_microburstMs = 0;
+	// sender i draws from seed + i
+	uint32_t m_seed = 0;
+};
+
+namespace {
+	// none, classic (duplicate every 10th, the old behaviour), lan, wan, feed (A/B lines
+	// merged, so almost every datagram comes twice), storm
+	bool setImpairmentProfile(const std::string& name, Impairment* imp)
+	{
+		const uint32_t seed = imp->m_seed;
+		*imp = Impairment{};
+		imp->m_seed = seed;
+		if (name == "none") {
+			return true;
+		}
+		if (name == "classic") {
+			imp->m_dupEvery = 10;
+			return true;
+		}
+		if (name == "lan") {
+			imp->m_lossRate = 0.0001;
+			imp->m_reorderRate = 0.0005;
+			imp->m_reorderMean = 2.0;
+			imp->m_reorderMax = 4;
+			imp->m_dupRate = 0.0001;
+			return true;
+		}
+		if (name == "wan") {
+			imp->m_lossRate = 0.002;
+			imp->m_burstLossRate = 0.0002;
+			imp->m_burstLossLen = 10.0;
+			imp->m_reorderRate = 0.01;
+			imp->m_reorderMean = 6.0;
+			imp->m_reorderMax = 64;
+			imp->m_dupRate = 0.001;
+			imp->m_dupDelay = 8;
+			return true;
+		}
+		if (name == "feed") {
+			imp->m_dupRate = 0.98;
+			imp->m_dupDelay = 4;
+			imp->m_lossRate = 0.0005;
+			imp->m_burstLossRate = 0.0001;
+			imp->m_burstLossLen = 20.0;
+			imp->m_reorderRate = 0.005;
+			imp->m_reorderMean = 3.0;
+			imp->m_reorderMax = 16;
+			imp->m_microburstSize = 512;
+			imp->m_microburstMs = 100;
+			return true;
+		}
+		if (name == "storm") {
+			imp->m_lossRate = 0.02;
+			imp->m_burstLossRate = 0.005;
+			imp->m_burstLossLen = 50.0;
+			imp->m_reorderRate = 0.1;
+			imp->m_reorderMean = 32.0;
+			imp->m_reorderMax = 1024;
+			imp->m_dupRate = 0.05;
+			imp->m_dupDelay = 64;
+			imp->m_microburstSize = 4096;
+			imp->m_microburstMs = 20;
+			return true;
+		}
+		return false;
+	}
+}
 
 class Client {
 public:
-	Client(int tv, int delay);
-	void start(int numberOfSenders, int maxPacketToSend);
-
-	inline MsgId getMsgId() { return m_id++; }
-	inline int getPoolIdx() { return m_msgPoolIdx++ & (s_msgPoolSize - 1); }
+	// with stamp every datagram carries its send time (wire::s_stampedMessageSize).
+	// pps > 0 paces every sender to pps datagrams per second with a token bucket,
+	// otherwise sender sleeps delay microseconds per datagram
+	Client(int tv, int delay, int batchSize, bool stamp, int pps, const Impairment& imp);
+	// with sharedPort all senders target socUDPPortStart, otherwise sender i targets socUDPPortStart + i
+	void start(int numberOfSenders, int maxPacketToSend, bool sharedPort, const std::vector<int>& cpus);
 
 	using SocPtr = std::unique_ptr<soc::Socket>;
 	using Msg = data::message;
 private:
+	// datagram held back by reordering or duplication until m_release datagrams were made
+	struct Held {
+		uint64_t m_release;
+		uint64_t m_order;
+		Msg m_msg;
+
+		// priority_queue puts greatest on top, so earliest release wins
+		bool operator<(const Held& other) const
+		{
+			return m_release != other.m_release ? m_release > other.m_release : m_order > other.m_order;
+		}
+	};
+
 	struct DataSender {
 		Client* m_client;
 		SocPtr m_soc;
+		int m_index;
 		int m_packSinceDup;
+		int m_poolIdx;
+		// ids reserved by this sender, [m_nextId, m_endId)
+		MsgId m_nextId;
+		MsgId m_endId;
+		MsgId m_lastId;
+		bool m_hasLastId;
+		// token bucket, one token per datagram
+		double m_tokens;
+		uint64_t m_refillNs;
+		// impairment state
+		math::FastRandom m_rng;
+		std::priority_queue<Held> m_held;
+		uint64_t m_made;
+		uint64_t m_heldOrder;
+		bool m_burstLoss;
+		uint64_t m_nextBurstNs;
+		int m_burstLeft;
+		// what the sender did, read by main thread after stop
+		uint64_t m_sent;
+		uint64_t m_startNs;
+		uint64_t m_endNs;
+		uint64_t m_lost;
+		uint64_t m_reordered;
+		uint64_t m_duplicated;
 
-		DataSender(Client *c, SocPtr ptr);
+		DataSender(Client *c, SocPtr ptr, int index);
 		DataSender(DataSender&& other) noexcept;
 		DataSender& operator=(DataSender&& other) noexcept;
 		
 		DataSender(const DataSender&) = delete;
 		DataSender& operator=(const DataSender&) = delete;
 
+		bool prepare();
+		// sends until all packets are out or group is stopped
 		void operator()();
+
+		// up to count datagrams after impairment, fewer when ids run out and nothing is held
+		int _fill(Msg* msgs, int count);
+		// next message of undisturbed stream, false when ids run out
+		bool _next(Msg* msg);
+		bool _lose();
+		uint64_t _reorderDistance();
+		// true while count datagrams of a microburst go out unpaced
+		bool _inBurst(int count);
+		// waits until bucket holds count tokens and takes them
+		void _pace(int count);
 	};
 
 	static constexpr int s_msgPoolSize = 8;
+	// most ids a sender takes at once, fewer for small runs so every sender gets some
+	static constexpr int s_maxIdBlock = 1024;
+	// longer waits for tokens sleep, minus s_spinNs which is spun to be on time
+	static constexpr uint64_t s_sleepNs = 200000;
+	static constexpr uint64_t s_spinNs = 100000;
+	// failed send is retried after s_retryBackoffUs doubled per attempt, s_maxSendRetries
+	// failures in a row stop the sender
+	static constexpr int s_retryBackoffUs = 100;
+	static constexpr int s_maxSendRetries = 10;
 
 private:
-	void resetMsgId() { m_id = 0; } // maybe unused
-	
+	// false when every id is taken
+	bool _reserveIds(MsgId* next, MsgId* end);
+	void _report() const;
+
 	int m_targetVal;
-	int m_run;
-	sync::spinlock m_flagLock;
-	MsgId m_id;
-	int m_msgPoolIdx;
 	Msg m_messagePool[s_msgPoolSize];
 	int m_packetDelayInMicrosecs;
-	int m_curPacketSent;
 	int m_maxPacketToSend;
-	int m_dupFreq;
+	Impairment m_imp;
+	int m_batchSize;
+	int m_pps;
+	int m_idBlock;
+	bool m_stamp;
+	std::atomic<MsgId> m_reservedIds;
+	std::atomic<int> m_activeSenders;
+
+	std::vector<std::shared_ptr<DataSender>> m_senders;
+	utils::ThreadGroup m_threads;
 };
 
+constexpr int Client::s_maxIdBlock;
+
 int main(int argc, char** argv) {
 	if (!soc::initSocLib()) {
 		return -1;
@@ -69,38 +235,119 @@ int main(int argc, char** argv) {
 	int targetVal = 10;
 	int numOfPacketsToSend = 100;
 	int m_packetDelayInMicrosecs = 2000;
+	int batchSize = 1;
+	int sharedPort = 0;
+	int useUring = soc::getBackend() == soc::Backend::IoUring;
+	int stamp = 0;
+	int pps = 0;
+	int numberOfSenders = 2;
+	std::string cpuList;
+	std::string profile = "classic";
+	Impairment imp;
+	imp.m_seed = static_cast<uint32_t>(time(nullptr));
 	utils::setIfHasParams<int>(argc, argv, "-t", &targetVal);
 	utils::setIfHasParams<int>(argc, argv, "-ps", &numOfPacketsToSend);
 	utils::setIfHasParams<int>(argc, argv, "-pdm", &m_packetDelayInMicrosecs);
+	utils::setIfHasParams<int>(argc, argv, "-bs", &batchSize);
+	utils::setIfHasParams<int>(argc, argv, "-sp", &sharedPort);
+	utils::setIfHasParams<int>(argc, argv, "-uring", &useUring);
+	utils::setIfHasParams<int>(argc, argv, "-ts", &stamp);
+	utils::setIfHasParams<int>(argc, argv, "-pps", &pps);
+	utils::setIfHasParams<int>(argc, argv, "-th", &numberOfSenders);
+	std::vector<int> cpus;
+	if (utils::setIfHasParams<std::string>(argc, argv, "-cpu", &cpuList)) {
+		if (!utils::parseCpuList(cpuList, &cpus)) {
+			LOG_ERROR("Invalid cpu list %s (cpus 0-%d), senders aren't pinned.", cpuList.c_str(), utils::numberOfCores() - 1);
+		}
+	}
 
-	Client c{ targetVal, m_packetDelayInMicrosecs };
-	c.start(2, numOfPacketsToSend);
+	// profile first, single params override it, rates are given in percent
+	utils::setIfHasParams<uint32_t>(argc, argv, "-seed", &imp.m_seed);
+	utils::setIfHasParams<std::string>(argc, argv, "-imp", &profile);
+	if (!setImpairmentProfile(profile, &imp)) {
+		LOG_ERROR("Unknown impairment profile %s, classic is used.", profile.c_str());
+		profile = "classic";
+		setImpairmentProfile(profile, &imp);
+	}
+	double percent = 0.0;
+	if (utils::setIfHasParams<double>(argc, argv, "-loss", &percent)) {
+		imp.m_lossRate = percent / 100.0;
+	}
+	if (utils::setIfHasParams<double>(argc, argv, "-bloss", &percent)) {
+		imp.m_burstLossRate = percent / 100.0;
+	}
+	utils::setIfHasParams<double>(argc, argv, "-blen", &imp.m_burstLossLen);
+	if (utils::setIfHasParams<double>(argc, argv, "-reo", &percent)) {
+		imp.m_reorderRate = percent / 100.0;
+	}
+	utils::setIfHasParams<double>(argc, argv, "-reod", &imp.m_reorderMean);
+	utils::setIfHasParams<int>(argc, argv, "-reom", &imp.m_reorderMax);
+	utils::setIfHasParams<bool>(argc, argv, "-reou", &imp.m_reorderUniform);
+	if (utils::setIfHasParams<double>(argc, argv, "-dup", &percent)) {
+		imp.m_dupRate = percent / 100.0;
+	}
+	utils::setIfHasParams<int>(argc, argv, "-dupd", &imp.m_dupDelay);
+	utils::setIfHasParams<int>(argc, argv, "-dupe", &imp.m_dupEvery);
+	utils::setIfHasParams<int>(argc, argv, "-mbs", &imp.m_microburstSize);
+	utils::setIfHasParams<int>(argc, argv, "-mbp", &imp.m_microburstMs);
+	imp.m_reorderMean = imp.m_reorderMean < 1.0 ? 1.0 : imp.m_reorderMean;
+	imp.m_reorderMax = imp.m_reorderMax < 1 ? 1 : imp.m_reorderMax;
+	imp.m_burstLossLen = imp.m_burstLossLen < 1.0 ? 1.0 : imp.m_burstLossLen;
+	imp.m_dupDelay = imp.m_dupDelay < 0 ? 0 : imp.m_dupDelay;
+	LOG_INFO("impairment profile: %s", profile.c_str());
+	soc::setBackend(useUring ? soc::Backend::IoUring : soc::Backend::Poll);
+	utils::installStopSignals();
+
+	Client c{ targetVal, m_packetDelayInMicrosecs, batchSize, stamp != 0, pps, imp };
+	c.start(numberOfSenders < 1 ? 1 : numberOfSenders, numOfPacketsToSend, sharedPort != 0, cpus);
+	utils::Logger::flush();
 	system("pause");
 	soc::shutdownSocLib();
 	return 0;
 }
 
-Client::Client(int tv, int delay)
+Client::Client(int tv, int delay, int batchSize, bool stamp, int pps, const Impairment& imp)
+	:
+	m_imp{ imp },
+	m_reservedIds{ 0 },
+	m_activeSenders{ 0 }
 {
 	m_targetVal = tv;
-	m_run = 0;
-	m_id = 0;
-	m_msgPoolIdx = 0;
-	m_dupFreq = 10;
 	memset(m_messagePool, 0, sizeof(m_messagePool));
-	m_curPacketSent = 0;
 	m_maxPacketToSend = 100;
 	m_packetDelayInMicrosecs = delay;
+	m_stamp = stamp;
+	m_pps = pps < 0 ? 0 : pps;
+	m_batchSize = batchSize < 1 ? 1 : (batchSize > soc::Socket::s_maxBatchSize ? soc::Socket::s_maxBatchSize : batchSize);
+	m_idBlock = m_batchSize;
 }
 
-void Client::start(int numberOfSenders, int maxPacketToSend)
+void Client::start(int numberOfSenders, int maxPacketToSend, bool sharedPort, const std::vector<int>& cpus)
 {
 	m_maxPacketToSend = maxPacketToSend;
+	m_idBlock = std::min(s_maxIdBlock, std::max(m_batchSize, maxPacketToSend / (numberOfSenders * 16)));
 
 	LOG_INFO("Client starts with next params:");
 	LOG_INFO("target value: %d", m_targetVal);
 	LOG_INFO("numbef of packets to send: %d", m_maxPacketToSend);
-	LOG_INFO("delay to send packet: %d (in microseconds)", m_packetDelayInMicrosecs);
+	LOG_INFO("number of senders: %d", numberOfSenders);
+	if (m_pps > 0) {
+		LOG_INFO("target rate: %d packets per second per sender", m_pps);
+	}
+	else {
+		LOG_INFO("delay to send packet: %d (in microseconds)", m_packetDelayInMicrosecs);
+	}
+	LOG_INFO("packets per send call: %d", m_batchSize);
+	LOG_INFO("send time stamps: %s", m_stamp ? "on" : "off");
+	LOG_INFO("impairment seed: %u", m_imp.m_seed);
+	LOG_INFO("loss: %.4f%%, burst loss: %.4f%% of mean length %.1f", m_imp.m_lossRate * 100.0, m_imp.m_burstLossRate * 100.0, m_imp.m_burstLossLen);
+	LOG_INFO("reorder: %.4f%%, %s distance of mean %.1f, at most %d", m_imp.m_reorderRate * 100.0,
+		m_imp.m_reorderUniform ? "uniform" : "geometric", m_imp.m_reorderMean, m_imp.m_reorderMax);
+	LOG_INFO("duplicates: %.4f%% after %d packets, every %d-th packet", m_imp.m_dupRate * 100.0, m_imp.m_dupDelay, m_imp.m_dupEvery);
+	LOG_INFO("microbursts: %d packets every %d ms", m_imp.m_microburstSize, m_imp.m_microburstMs);
+
+	// message pool is reproducible with the seed too
+	math::SetRandomSeed(m_imp.m_seed);
 
 	// force at least one item to has desired value
 	m_messagePool[0] = {
@@ -119,28 +366,96 @@ void Client::start(int numberOfSenders, int maxPacketToSend)
 		};
 	}
 
+	m_threads.setCpus(cpus);
 	for (int i = 0; i < numberOfSenders; ++i) {
 		
 		SocPtr ptr{ std::make_unique<soc::Socket>(
-			soc::socUDPPortStart + i,
+			sharedPort ? soc::socUDPPortStart : soc::socUDPPortStart + i,
 			soc::SocketType::UDP,
 			soc::SocketRole::Sender) };
-		std::thread t = std::thread(DataSender{ this, std::move(ptr) });
-		t.detach();
+		auto s = std::make_shared<DataSender>(this, std::move(ptr), i);
+		m_senders.push_back(s);
+		m_activeSenders.fetch_add(1, std::memory_order_relaxed);
+		m_threads.spawn("atto-send-" + std::to_string(i),
+			[s]() { return s->prepare(); },
+			[s]() { (*s)(); },
+			nullptr);
 	}
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(500));
-	m_run = 1;
-	while (m_curPacketSent < m_maxPacketToSend) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	if (!m_threads.start()) {
+		return;
 	}
-	m_run = 0;
+
+	// senders leave as soon as their ids run out
+	while (!utils::stopSignalled() && m_activeSenders.load(std::memory_order_acquire) > 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	m_threads.stop();
 	LOG_INFO("All messages delivered.");
-	std::this_thread::sleep_for(std::chrono::seconds(15));
+	_report();
 }
 
-Client::DataSender::DataSender(Client* c, SocPtr ptr)
-	:m_client{c}, m_soc{std::move(ptr)}, m_packSinceDup{0}
+bool Client::_reserveIds(MsgId* next, MsgId* end)
+{
+	const MsgId max = static_cast<MsgId>(m_maxPacketToSend < 0 ? 0 : m_maxPacketToSend);
+	const MsgId first = m_reservedIds.fetch_add(static_cast<MsgId>(m_idBlock), std::memory_order_relaxed);
+	if (first >= max) {
+		return false;
+	}
+	*next = first;
+	*end = std::min(first + static_cast<MsgId>(m_idBlock), max);
+	return true;
+}
+
+void Client::_report() const
+{
+	uint64_t total = 0;
+	uint64_t lost = 0;
+	uint64_t reordered = 0;
+	uint64_t duplicated = 0;
+	uint64_t startNs = UINT64_MAX;
+	uint64_t endNs = 0;
+	for (size_t i = 0; i < m_senders.size(); ++i) {
+		const DataSender& s = *m_senders[i];
+		if (s.m_endNs <= s.m_startNs) {
+			continue;
+		}
+		const double sec = static_cast<double>(s.m_endNs - s.m_startNs) / 1e9;
+		LOG_INFO("Sender %d: %llu packets in %.3f s, %.0f packets per second, %llu lost, %llu reordered, %llu duplicated",
+			static_cast<int>(i), static_cast<unsigned long long>(s.m_sent), sec, static_cast<double>(s.m_sent) / sec,
+			static_cast<unsigned long long>(s.m_lost), static_cast<unsigned long long>(s.m_reordered), static_cast<unsigned long long>(s.m_duplicated));
+		total += s.m_sent;
+		lost += s.m_lost;
+		reordered += s.m_reordered;
+		duplicated += s.m_duplicated;
+		startNs = std::min(startNs, s.m_startNs);
+		endNs = std::max(endNs, s.m_endNs);
+	}
+	if (endNs <= startNs) {
+		return;
+	}
+	const double sec = static_cast<double>(endNs - startNs) / 1e9;
+	const double achieved = static_cast<double>(total) / sec;
+	if (m_pps > 0) {
+		const double target = static_cast<double>(m_pps) * static_cast<double>(m_senders.size());
+		LOG_INFO("Total: %llu packets in %.3f s, %.0f packets per second, %.1f%% of target %.0f",
+			static_cast<unsigned long long>(total), sec, achieved, achieved * 100.0 / target, target);
+	}
+	else {
+		LOG_INFO("Total: %llu packets in %.3f s, %.0f packets per second",
+			static_cast<unsigned long long>(total), sec, achieved);
+	}
+	LOG_INFO("Impairment: %llu lost, %llu reordered, %llu duplicated",
+		static_cast<unsigned long long>(lost), static_cast<unsigned long long>(reordered), static_cast<unsigned long long>(duplicated));
+}
+
+Client::DataSender::DataSender(Client* c, SocPtr ptr, int index)
+	:m_client{c}, m_soc{std::move(ptr)}, m_index{index}, m_packSinceDup{0}, m_poolIdx{0},
+	m_nextId{0}, m_endId{0}, m_lastId{0}, m_hasLastId{false},
+	m_tokens{0.0}, m_refillNs{0},
+	m_rng{ static_cast<uint64_t>(c->m_imp.m_seed) + static_cast<uint64_t>(index) },
+	m_made{0}, m_heldOrder{0}, m_burstLoss{false}, m_nextBurstNs{0}, m_burstLeft{0},
+	m_sent{0}, m_startNs{0}, m_endNs{0}, m_lost{0}, m_reordered{0}, m_duplicated{0}
 {
 }
 
@@ -155,54 +470,240 @@ Client::DataSender& Client::DataSender::operator=(DataSender&& other) noexcept
 	m_client = other.m_client;
 	other.m_client = nullptr;
 	m_soc = std::move(other.m_soc);
+	m_index = other.m_index;
 	m_packSinceDup = other.m_packSinceDup;
+	m_poolIdx = other.m_poolIdx;
+	m_nextId = other.m_nextId;
+	m_endId = other.m_endId;
+	m_lastId = other.m_lastId;
+	m_hasLastId = other.m_hasLastId;
+	m_tokens = other.m_tokens;
+	m_refillNs = other.m_refillNs;
+	m_rng = other.m_rng;
+	m_held = std::move(other.m_held);
+	m_made = other.m_made;
+	m_heldOrder = other.m_heldOrder;
+	m_burstLoss = other.m_burstLoss;
+	m_nextBurstNs = other.m_nextBurstNs;
+	m_burstLeft = other.m_burstLeft;
+	m_sent = other.m_sent;
+	m_startNs = other.m_startNs;
+	m_endNs = other.m_endNs;
+	m_lost = other.m_lost;
+	m_reordered = other.m_reordered;
+	m_duplicated = other.m_duplicated;
 	return *this;
 }
 
-void Client::DataSender::operator()()
+bool Client::DataSender::prepare()
 {
 	if (!m_soc->init()) {
-		return;
+		return false;
 	}
 	LOG_INFO("UDP DataSender initialized. It will start sending messages soon.");
+	return true;
+}
 
-	while (!m_client->m_run) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+bool Client::DataSender::_next(Msg* msg)
+{
+	const int dupEvery = m_client->m_imp.m_dupEvery;
+	MsgId newId = 0;
+	if (dupEvery > 0 && m_packSinceDup >= dupEvery && m_hasLastId) {
+		// duplicate of the last id this sender sent
+		m_packSinceDup %= dupEvery;
+		newId = m_lastId;
+	}
+	else {
+		if (m_nextId == m_endId && !m_client->_reserveIds(&m_nextId, &m_endId)) {
+			return false;
+		}
+		newId = m_nextId++;
+		m_lastId = newId;
+		m_hasLastId = true;
 	}
+	++m_packSinceDup;
 
-	while (true) {
-		if (!m_client->m_run) {
-			return;
+	*msg = m_client->m_messagePool[m_poolIdx++ & (s_msgPoolSize - 1)];
+	msg->MessageId = newId;
+	return true;
+}
+
+bool Client::DataSender::_lose()
+{
+	const Impairment& imp = m_client->m_imp;
+	if (m_burstLoss) {
+		m_burstLoss = m_rng.RandomD() >= 1.0 / imp.m_burstLossLen;
+		return true;
+	}
+	if (imp.m_burstLossRate > 0.0 && m_rng.RandomD() < imp.m_burstLossRate) {
+		m_burstLoss = true;
+		return true;
+	}
+	return imp.m_lossRate > 0.0 && m_rng.RandomD() < imp.m_lossRate;
+}
+
+uint64_t Client::DataSender::_reorderDistance()
+{
+	const Impairment& imp = m_client->m_imp;
+	double d = 1.0;
+	if (imp.m_reorderUniform) {
+		d += std::floor(m_rng.RandomD() * (2.0 * imp.m_reorderMean - 1.0));
+	}
+	else if (imp.m_reorderMean > 1.0) {
+		// geometric on 1, 2, ... with success rate 1 / mean
+		d += std::floor(std::log(1.0 - m_rng.RandomD()) / std::log(1.0 - 1.0 / imp.m_reorderMean));
+	}
+	return static_cast<uint64_t>(std::min(d, static_cast<double>(imp.m_reorderMax)));
+}
+
+int Client::DataSender::_fill(Msg* msgs, int count)
+{
+	const Impairment& imp = m_client->m_imp;
+	int n = 0;
+	while (n < count) {
+		if (!m_held.empty() && m_held.top().m_release <= m_made) {
+			msgs[n++] = m_held.top().m_msg;
+			m_held.pop();
+			continue;
 		}
 
-		MsgId newId = 0;
-		int poolIdx = 0;
-		if (m_packSinceDup < m_client->m_dupFreq)
-		{
-			sync::lock_guard lock{ m_client->m_flagLock };
-			newId = m_client->getMsgId();
-			poolIdx = m_client->getPoolIdx();
-			m_client->m_curPacketSent++;
+		Msg msg;
+		if (!_next(&msg)) {
+			if (m_held.empty()) {
+				break;
+			}
+			// stream ended, held ones go in their order
+			msgs[n++] = m_held.top().m_msg;
+			m_held.pop();
+			continue;
 		}
-		else {
-			m_packSinceDup %= m_client->m_dupFreq;
-			newId = m_client->m_id;
-			poolIdx = m_client->getPoolIdx();
+		m_made++;
+
+		if (_lose()) {
+			m_lost++;
+			continue;
+		}
+		if (imp.m_dupRate > 0.0 && m_rng.RandomD() < imp.m_dupRate) {
+			// copy without delay goes right after the original
+			m_held.push({ m_made + static_cast<uint64_t>(imp.m_dupDelay), m_heldOrder++, msg });
+			m_duplicated++;
+		}
+		if (imp.m_reorderRate > 0.0 && m_rng.RandomD() < imp.m_reorderRate) {
+			m_held.push({ m_made + _reorderDistance(), m_heldOrder++, msg });
+			m_reordered++;
+			continue;
 		}
+		msgs[n++] = msg;
+	}
+	return n;
+}
 
-		char buf[sizeof(data::message)];
-		data::message msg = m_client->m_messagePool[poolIdx];
-		msg.MessageId = newId;
-		data::SerialiseMessage(buf, &msg);
+bool Client::DataSender::_inBurst(int count)
+{
+	const Impairment& imp = m_client->m_imp;
+	if (imp.m_microburstSize <= 0 || imp.m_microburstMs <= 0) {
+		return false;
+	}
+	if (m_burstLeft <= 0) {
+		const uint64_t now = utils::TscClock::nowNs();
+		if (now < m_nextBurstNs) {
+			return false;
+		}
+		m_nextBurstNs = now + static_cast<uint64_t>(imp.m_microburstMs) * 1000000u;
+		m_burstLeft = imp.m_microburstSize;
+	}
+	m_burstLeft -= count;
+	return true;
+}
 
-		int sent = m_soc->send(buf, sizeof(data::message));
-		if (sent < 0) {
+void Client::DataSender::_pace(int count)
+{
+	const double tokensPerNs = static_cast<double>(m_client->m_pps) / 1e9;
+	// bucket holds two batches, so a late wakeup is caught up, a longer stall is not
+	const double capacity = 2.0 * m_client->m_batchSize;
+	while (m_client->m_threads.running()) {
+		const uint64_t now = utils::TscClock::nowNs();
+		m_tokens = std::min(capacity, m_tokens + static_cast<double>(now - m_refillNs) * tokensPerNs);
+		m_refillNs = now;
+		if (m_tokens >= count) {
+			m_tokens -= count;
 			return;
 		}
-		++m_packSinceDup;
+		const uint64_t waitNs = static_cast<uint64_t>((count - m_tokens) / tokensPerNs);
+		if (waitNs > s_sleepNs) {
+			std::this_thread::sleep_for(std::chrono::nanoseconds(waitNs - s_spinNs));
+		}
+#ifdef ATTO_HAS_TSC
+		else {
+			_mm_pause();
+		}
+#endif
+	}
+}
+
+void Client::DataSender::operator()()
+{
 
-		std::string smsg{ data::toString(msg) };
-		LOG_DEBUG("Sent: %s", smsg.c_str());
-		std::this_thread::sleep_for(std::chrono::microseconds(m_client->m_packetDelayInMicrosecs));
+	char bufs[soc::Socket::s_maxBatchSize][data::wire::s_stampedMessageSize];
+	soc::Datagram dgrams[soc::Socket::s_maxBatchSize];
+	const int batchSize = m_client->m_batchSize;
+	const bool paced = m_client->m_pps > 0;
+
+	m_startNs = utils::TscClock::nowNs();
+	m_refillNs = m_startNs;
+	// first burst comes one period in
+	m_nextBurstNs = m_startNs + static_cast<uint64_t>(m_client->m_imp.m_microburstMs) * 1000000u;
+	m_tokens = batchSize;
+	while (m_client->m_threads.running()) {
+
+		data::message msgs[soc::Socket::s_maxBatchSize];
+		const int count = _fill(msgs, batchSize);
+		if (count == 0) {
+			break;
+		}
+		// microburst datagrams come on top of the paced rate
+		const bool burst = _inBurst(count);
+		if (paced && !burst) {
+			_pace(count);
+		}
+
+		const uint64_t sentNs = m_client->m_stamp ? utils::monotonicNs() : 0u;
+		const int size = m_client->m_stamp ? data::wire::s_stampedMessageSize : data::wire::s_messageSize;
+		for (int i = 0; i < count; ++i) {
+			data::SerialiseMessage(bufs[i], &msgs[i]);
+			if (m_client->m_stamp) {
+				data::wire::store<uint64_t>(bufs[i] + data::wire::s_messageSize, sentNs);
+			}
+			dgrams[i] = { bufs[i], size, 0 };
+		}
+
+		// sendBatch returns 0 on error, socket has already logged it
+		int sent = 0;
+		int failures = 0;
+		while (sent < count && failures < s_maxSendRetries && m_client->m_threads.running()) {
+			const int result = m_soc->sendBatch(dgrams + sent, count - sent);
+			if (result > 0) {
+				sent += result;
+				failures = 0;
+				continue;
+			}
+			const int backoffUs = s_retryBackoffUs << failures;
+			std::this_thread::sleep_for(std::chrono::microseconds(backoffUs));
+			++failures;
+		}
+		m_sent += sent;
+
+		for (int i = 0; i < sent; ++i) {
+			LOG_DEBUG("Sent: " DATA_MSG_FMT, DATA_MSG_ARGS(msgs[i]));
+		}
+		if (failures == s_maxSendRetries) {
+			LOG_ERROR("Sender %d stops, %d sends in a row failed.", m_index, s_maxSendRetries);
+			break;
+		}
+		if (!paced && !burst) {
+			std::this_thread::sleep_for(std::chrono::microseconds(m_client->m_packetDelayInMicrosecs * count));
+		}
 	}
+	m_endNs = utils::TscClock::nowNs();
+	m_client->m_activeSenders.fetch_sub(1, std::memory_order_release);
 }
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "../logic/message.h"
+
+namespace cont {
+
+	// lock-free duplicate filter for many receivers
+	// each 64 bit slot covers 32 consecutive ids: low half is a bitmap, high half is generation of the block
+	// (block index / number of slots), so a slot belongs to exactly one block at a time
+	// - same generation: id bit is set by CAS, if it was set already it is a duplicate
+	// - newer generation: slot is recycled for the new block, bits of the old one are dropped
+	// - older generation: id has slid out of the window, treated as duplicate like SlidingWindow does
+	// - generation more than s_maxLeadWindows past the highest accepted one is rejected and counted,
+	//   stamped into a slot it would drop every id of that slot for as many window cycles as it ran
+	//   ahead. s_resyncRun such ids in a row mean the stream really jumped, then it is accepted
+	// generation check and bit update have to be one atomic step, so it is CAS and not a plain fetch_or,
+	// which could set a bit in a slot just recycled by another thread and lose a valid id later
+	class ConcurrentSlidingWindow
+	{
+	public:
+		using MsgId = data::MsgId;
+
+		static const int s_idsPerSlot = 32;
+		static const int s_maxWindowSize = 1 << 30;
+		static const int s_maxLeadWindows = 1;
+		static const int s_resyncRun = 64;
+
+	public:
+		ConcurrentSlidingWindow()
+			:
+			m_slots{ nullptr },
+			m_mask{ 0u },
+			m_slotBits{ 0 },
+			m_seen{ false },
+			m_topGen{ 0u },
+			m_farRun{ 0 },
+			m_farRejected{ 0u }
+		{}
+		~ConcurrentSlidingWindow()
+		{
+			if (m_slots) {
+				delete[] m_slots;
+			}
+		}
+
+		ConcurrentSlidingWindow(const ConcurrentSlidingWindow&) = delete;
+		ConcurrentSlidingWindow& operator=(const ConcurrentSlidingWindow&) = delete;
+
+		// window size is rounded up to power of two, at least 8 slots (one cache line)
+		bool init(int windowSize)
+		{
+			if (m_slots) {
+				return true;
+			}
+
+			int slotBits = 3;
+			while ((static_cast<int64_t>(s_idsPerSlot) << slotBits) < windowSize
+				&& (s_idsPerSlot << slotBits) < s_maxWindowSize) {
+				++slotBits;
+			}
+			m_slotBits = slotBits;
+			m_mask = (1ull << slotBits) - 1;
+			m_slots = new std::atomic<uint64_t>[m_mask + 1];
+			for (uint64_t i = 0; i <= m_mask; ++i) {
+				m_slots[i].store(0, std::memory_order_relaxed);
+			}
+			return m_slots != nullptr;
+		}
+
+		// returns false if id was seen before, is older than the window or far ahead of it,
+		// safe to call from any thread
+		bool insert(const MsgId& newId)
+		{
+			const uint64_t block = newId / s_idsPerSlot;
+			const uint32_t gen = static_cast<uint32_t>(block >> m_slotBits);
+			const uint64_t bit = 1ull << (newId % s_idsPerSlot);
+			std::atomic<uint64_t>& slot = m_slots[_slotIdx(block)];
+
+			// shared counters are only written when something changes, so receivers don't bounce them
+			const int32_t lead = static_cast<int32_t>(gen - m_topGen.load(std::memory_order_relaxed));
+			if (lead > s_maxLeadWindows && m_seen.load(std::memory_order_relaxed)) {
+				if (m_farRun.fetch_add(1, std::memory_order_relaxed) + 1 < s_resyncRun) {
+					m_farRejected.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+			}
+			else if (m_farRun.load(std::memory_order_relaxed) != 0) {
+				m_farRun.store(0, std::memory_order_relaxed);
+			}
+
+			uint64_t cur = slot.load(std::memory_order_acquire);
+			while (true) {
+				const int32_t age = static_cast<int32_t>(gen - static_cast<uint32_t>(cur >> 32));
+				if (age < 0) {
+					return false;
+				}
+
+				uint64_t next = 0;
+				if (age == 0) {
+					if (cur & bit) {
+						return false;
+					}
+					next = cur | bit;
+				}
+				else {
+					next = (static_cast<uint64_t>(gen) << 32) | bit;
+				}
+
+				if (slot.compare_exchange_weak(cur, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					_raiseTop(gen);
+					return true;
+				}
+			}
+		}
+
+		uint64_t size() const { return (m_mask + 1) * s_idsPerSlot; }
+		// ids rejected for being too far ahead, the ones which resynced the window aren't counted
+		uint64_t farRejected() const { return m_farRejected.load(std::memory_order_relaxed); }
+
+	private:
+		// rotates slot index by 3 bits, so consecutive blocks land 8 slots (a cache line) apart
+		// and receivers working on neighbour ids don't bounce the same line
+		inline uint64_t _slotIdx(uint64_t block) const
+		{
+			const uint64_t idx = block & m_mask;
+			return ((idx << 3) | (idx >> (m_slotBits - 3))) & m_mask;
+		}
+
+		// first accepted id places the window wherever the stream starts
+		inline void _raiseTop(uint32_t gen)
+		{
+			if (!m_seen.load(std::memory_order_relaxed)) {
+				m_topGen.store(gen, std::memory_order_relaxed);
+				m_seen.store(true, std::memory_order_relaxed);
+				return;
+			}
+			uint32_t top = m_topGen.load(std::memory_order_relaxed);
+			while (static_cast<int32_t>(gen - top) > 0
+				&& !m_topGen.compare_exchange_weak(top, gen, std::memory_order_relaxed)) {
+			}
+		}
+
+	private:
+		std::atomic<uint64_t>* m_slots;
+		uint64_t m_mask;
+		int m_slotBits;
+		std::atomic<bool> m_seen;
+		std::atomic<uint32_t> m_topGen;
+		std::atomic<int> m_farRun;
+		std::atomic<uint64_t> m_farRejected;
+	};
+}
@@ -1,12 +1,48 @@
 #pragma once
 
-#include <cstring> // memset
+#include <atomic>
+#include <cstdlib> // calloc
+#include <cstring> // memcpy
+#include <stdint.h>
 #include <type_traits>
 
+#include "../utils/epoch.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ATTO_HASH_TABLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace cont {
 
+	// open addressing table with separate control bytes, probed 16 slots (one group) at a time
+	// control byte per slot:
+	// - s_empty, never used since last clear, lookup stops at a group which has one
+	// - s_deleted, erased value, lookup goes on
+	// - 0x80 | h2, full slot, h2 is low 7 bits of hash, so only ~1/128 of foreign slots need key compare
+	// high bits of hash pick first group, next groups are visited by triangular probing
+	//
+	// table grows online: at 7/8 load new arrays are allocated and every insert moves
+	// s_migrateValues values of old array into them, until then lookups check both arrays.
+	//
+	// one writer at a time (insert, erase, clear), with epoch domain (setEpoch) get may run
+	// concurrently with it:
+	// - control bytes are kept in atomic words, 8 per word, writer stores a changed word with
+	//   release, lookup copies group with two loads and matches the copy
+	// - value is written before its control byte, and a full slot is never written again,
+	//   update goes to a new slot and erase leaves a tombstone which isn't reused, so slot
+	//   a lookup reads after matching its tag doesn't change under it
+	// - arrays are published through atomic pointers, growth start/end is guarded by a sequence
+	//   counter, so a lookup which raced with it is repeated
+	// - replaced arrays are retired to epoch domain, pointer from get stays valid while caller
+	//   is inside the domain. without domain slots are reused and arrays are freed at once,
+	//   so lookups must not overlap writes and pointers are valid until next insert or erase
 	template <
-		typename Type, 
+		typename Type,
 		typename KeyType,
 		typename Hasher,
 		typename KeyFunc,
@@ -23,165 +59,550 @@ namespace cont {
 		using key = KeyFunc;
 		using equal = Equality;
 
-		static const unsigned int s_null = 0xffffffff;
-		static const unsigned int s_tombstone = 0xfffffffe;
+		static const int s_groupSize = 16;
+		static const uint8_t s_empty = 0x00;
+		static const uint8_t s_deleted = 0x01;
+		static const uint8_t s_full = 0x80;
+
+		// migration step moves up to s_migrateValues values, looking at most at s_migrateScan
+		// slots for them, so it ends after (old live / 2 + old capacity / 64) inserts. by then
+		// new array holds at most 7/8 + 7/16 + 1/64 of old capacity when doubled (growth point 7/4)
+		// or 1/2 + 1/4 + 1/64 when rehashed in place with at most half live (growth point 7/8),
+		// so growths never overlap. moves are what costs, so insert pays for two at most
+		static const int s_migrateValues = 2;
+		static const int s_migrateScan = 64;
+
+	private:
+		using CtrlWord = std::atomic<uint64_t>;
+		static_assert(sizeof(CtrlWord) == sizeof(uint64_t), "control words are allocated as raw memory");
+		static const int s_ctrlPerWord = sizeof(uint64_t);
+
+#ifdef ATTO_HASH_TABLE_SSE2
+		using Group = __m128i;
+#else
+		struct Group {
+			uint8_t m_bytes[s_groupSize];
+		};
+#endif
+
+		struct Arrays {
+			pointer m_table;
+			CtrlWord* m_ctrl;
+			std::size_t m_size;
+			std::size_t m_deleted;
+			std::size_t m_maxSize;
+			std::size_t m_groupMask;
+		};
 
 	public:
 		HashTable()
 			:
-			m_hasher{}, 
-			m_table {nullptr},
-			m_size{ 0u }, m_maxSize{ 1024u }
+			m_hasher{},
+			m_cur{ nullptr },
+			m_old{ nullptr },
+			m_seq{ 0u },
+			m_migrated{ 0u },
+			m_capacityLimit{ 0u },
+			m_epoch{ nullptr }
 		{}
 
 		~HashTable() {
-			if (m_table) {
-				delete[] m_table;
-			}
+			_deleteArrays(m_cur.load(std::memory_order_relaxed));
+			_deleteArrays(m_old.load(std::memory_order_relaxed));
 		}
 
-		bool init(int tableSize)
+		HashTable(const HashTable&) = delete;
+		HashTable& operator=(const HashTable&) = delete;
+
+		// table size is rounded up to power of two, at least one group
+		// maxTableSize limits growth, 0 means table size
+		bool init(int tableSize, int maxTableSize = 0)
 		{
-			m_maxSize = tableSize;
-			m_table = new Type[m_maxSize];
-			if (!m_table) {
-				return false;
-			}
-			memset(m_table, s_null, tableSize * sizeof(value_type));
-			return true;
+			const std::size_t size = _roundUp(tableSize);
+			m_capacityLimit = maxTableSize > tableSize ? _roundUp(maxTableSize) : size;
+			Arrays* a = _newArrays(size);
+			m_cur.store(a, std::memory_order_release);
+			return a != nullptr;
 		}
 
+		// lookups may run concurrently with the writer, see above
+		void setEpoch(sync::EpochDomain* epoch) { m_epoch = epoch; }
+
+		// with concurrent readers must be called only when none of them can reach the table
 		void clear()
 		{
-			m_size = 0;
-			if (m_table) {
-				memset(m_table, s_null, m_maxSize * sizeof(value_type));
+			Arrays* old = m_old.load(std::memory_order_relaxed);
+			if (old) {
+				m_old.store(nullptr, std::memory_order_release);
+				_release(old);
+			}
+			m_migrated = 0;
+
+			Arrays& cur = _cur();
+			cur.m_size = 0;
+			cur.m_deleted = 0;
+			for (std::size_t i = 0; i < cur.m_maxSize / s_ctrlPerWord; ++i) {
+				cur.m_ctrl[i].store(0u, std::memory_order_relaxed);
 			}
 		}
 
-		void insert(const_reference val)
+		// returns false only if there is no free slot left and table can't grow
+		bool insert(const_reference val)
 		{
-			pointer target = _getFreeOrMe(val);
-			if (_isNull(target) || _isDeleted(target)) {
-				m_size++;
+			if (m_old.load(std::memory_order_relaxed)) {
+				_migrate();
 			}
-			*target = val;
+			else if (_needsGrowth()) {
+				_startGrowth();
+			}
+
+			const KeyType k = m_key(val);
+			const std::size_t h = m_hasher(k);
+			if (!_insert(_cur(), val, k, h)) {
+				return false;
+			}
+
+			// both arrays never hold the same key, stale copy goes only after new one is visible
+			Arrays* old = m_old.load(std::memory_order_relaxed);
+			if (old) {
+				pointer stale = _find(*old, k, h);
+				if (stale) {
+					_eraseSlot(*old, stale);
+				}
+			}
+			return true;
 		}
 
 
 		bool has(KeyType val)
 		{
-			return _find(val) != nullptr;
+			return get(val) != nullptr;
 		}
 
 		bool erase(const_reference val)
 		{
-			if (!has(m_key(val))) {
-				return false;
+			const KeyType k = m_key(val);
+			const std::size_t h = m_hasher(k);
+			Arrays& cur = _cur();
+			pointer p = _find(cur, k, h);
+			if (p) {
+				_eraseSlot(cur, p);
+				return true;
 			}
-
-			pointer p = _find(m_key(val));
-			_markDeleted(p);
-			m_size--;
-			return true;
+			Arrays* old = m_old.load(std::memory_order_relaxed);
+			if (old) {
+				p = _find(*old, k, h);
+				if (p) {
+					_eraseSlot(*old, p);
+					return true;
+				}
+			}
+			return false;
 		}
 
+		// old array is checked first: migration writes new slot before it buries old one
 		pointer get(KeyType val)
 		{
-			return _find(val);
+			const std::size_t h = m_hasher(val);
+			while (true) {
+				const uint32_t seq = m_seq.load(std::memory_order_acquire);
+				if (seq & 1) {
+					continue;
+				}
+
+				Arrays* old = m_old.load(std::memory_order_acquire);
+				Arrays* cur = m_cur.load(std::memory_order_acquire);
+				pointer p = old ? _find(*old, val, h) : nullptr;
+				if (!p) {
+					p = _find(*cur, val, h);
+				}
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (p || m_seq.load(std::memory_order_relaxed) == seq) {
+					return p;
+				}
+			}
+		}
+
+		// calls f(const_reference) for every value, in no particular order
+		template <typename Func>
+		void forEach(Func&& f) const
+		{
+			_forEach(m_cur.load(std::memory_order_acquire), f);
+			_forEach(m_old.load(std::memory_order_acquire), f);
 		}
 
+		// tombstones make probes as long as live values do, so they count too
 		float loadFactor()
 		{
-			return static_cast<float>(m_size) / static_cast<float>(m_maxSize);
+			const Arrays& cur = _cur();
+			const Arrays* old = m_old.load(std::memory_order_relaxed);
+			const std::size_t used = cur.m_size + cur.m_deleted + (old ? old->m_size : 0);
+			return static_cast<float>(used) / static_cast<float>(cur.m_maxSize);
 		}
 
+		std::size_t size() const
+		{
+			const Arrays* old = m_old.load(std::memory_order_relaxed);
+			return _cur().m_size + (old ? old->m_size : 0);
+		}
+		std::size_t capacity() const { return _cur().m_maxSize; }
+		bool canGrow() const { return _cur().m_maxSize < m_capacityLimit; }
+		bool isGrowing() const { return m_old.load(std::memory_order_relaxed) != nullptr; }
+
 	private:
+		inline Arrays& _cur() const { return *m_cur.load(std::memory_order_relaxed); }
 
-		inline void _markDeleted(pointer p)
+		static std::size_t _roundUp(int tableSize)
 		{
-			*reinterpret_cast<unsigned int*>(p) = s_tombstone;
+			std::size_t size = s_groupSize;
+			while (size < static_cast<std::size_t>(tableSize)) {
+				size <<= 1;
+			}
+			return size;
 		}
 
-		inline bool _isNull(pointer p)
+		// control bytes come from calloc, big blocks are fresh zero pages from the system,
+		// so growth doesn't memset megabytes in one insert, pages are touched as they fill
+		static Arrays* _newArrays(std::size_t size)
 		{
-			return *reinterpret_cast<unsigned int*>(p) == s_null;
+			Arrays* a = new Arrays{ nullptr, nullptr, 0u, 0u, size, size / s_groupSize - 1 };
+			a->m_table = new Type[size];
+			// all zero words are empty control bytes
+			a->m_ctrl = static_cast<CtrlWord*>(calloc(size / s_ctrlPerWord, sizeof(CtrlWord)));
+			if (!a->m_table || !a->m_ctrl) {
+				_deleteArrays(a);
+				return nullptr;
+			}
+			return a;
 		}
 
-		inline bool _isDeleted(pointer p)
+		static void _deleteArrays(void* p)
 		{
-			return *reinterpret_cast<unsigned int*>(p) == s_tombstone;
+			Arrays* a = static_cast<Arrays*>(p);
+			if (!a) {
+				return;
+			}
+			if (a->m_table) {
+				delete[] a->m_table;
+			}
+			if (a->m_ctrl) {
+				free(a->m_ctrl);
+			}
+			delete a;
 		}
 
-		pointer _getFreeOrMe(const_reference val)
+		// arrays which readers may still probe wait in epoch domain
+		void _release(Arrays* a)
 		{
-			auto idx = index(m_key(val));
-			pointer target = m_table + idx;
-			if (_isNull(target) || _isDeleted(target)) {
-				return target;
+			if (m_epoch) {
+				m_epoch->retire(a, &_deleteArrays);
 			}
+			else {
+				_deleteArrays(a);
+			}
+		}
 
-			for (int i = 1; i < m_maxSize && !_isNull(target); ++i) {
-				if (_isDeleted(target)) {
-					return target;
+		template <typename Func>
+		static void _forEach(const Arrays* a, Func& f)
+		{
+			if (!a) {
+				return;
+			}
+			for (std::size_t base = 0; base < a->m_maxSize; base += s_groupSize) {
+				const Group ctrl = _loadGroup(*a, base / s_groupSize);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				for (uint32_t m = _matchFull(ctrl); m; m &= m - 1) {
+					f(static_cast<const_reference>(a->m_table[base + _lowestBit(m)]));
 				}
+			}
+		}
 
-				//if (target->MessageId == val.MessageId) {
-				if (m_equal(m_key(*target), m_key(val))) {
-					return target;
+		inline bool _needsGrowth() const
+		{
+			const Arrays& cur = _cur();
+			return (cur.m_size + cur.m_deleted) * 8 >= cur.m_maxSize * 7;
+		}
+
+		// mostly tombstones - rehash into same size, otherwise double
+		void _startGrowth()
+		{
+			Arrays* cur = m_cur.load(std::memory_order_relaxed);
+			std::size_t size = cur->m_maxSize;
+			if (cur->m_size * 2 > cur->m_maxSize) {
+				if (!canGrow()) {
+					return;
 				}
-			
-				idx = index(idx + i);
-				target = m_table + idx;
+				size <<= 1;
 			}
 
-			return target;
+			Arrays* next = _newArrays(size);
+			if (!next) {
+				return;
+			}
+			m_migrated = 0;
+			m_seq.fetch_add(1, std::memory_order_acq_rel);
+			m_old.store(cur, std::memory_order_release);
+			m_cur.store(next, std::memory_order_release);
+			m_seq.fetch_add(1, std::memory_order_release);
 		}
 
-		pointer _find(const KeyType& val)
+		// moves next slots of old array, moved slots become tombstones so old probe chains stay intact
+		void _migrate()
 		{
-			auto idx = index(val);
-			pointer target = m_table + idx;
+			Arrays* old = m_old.load(std::memory_order_relaxed);
+			Arrays& cur = _cur();
+			const std::size_t end = m_migrated + s_migrateScan < old->m_maxSize ? m_migrated + s_migrateScan : old->m_maxSize;
+			int moved = 0;
+			for (; m_migrated < end && moved < s_migrateValues; ++m_migrated) {
+				if (_ctrlAt(*old, m_migrated) & s_full) {
+					const_reference val = old->m_table[m_migrated];
+					_insertNew(cur, val, m_hasher(m_key(val)));
+					// release store, new copy is published before old one is buried
+					_setCtrl(*old, m_migrated, s_deleted);
+					old->m_size--;
+					++moved;
+				}
+			}
 
-			if (_isNull(target)) {
-				return nullptr;
+			if (m_migrated == old->m_maxSize) {
+				m_seq.fetch_add(1, std::memory_order_acq_rel);
+				m_old.store(nullptr, std::memory_order_release);
+				m_seq.fetch_add(1, std::memory_order_release);
+				m_migrated = 0;
+				_release(old);
 			}
+		}
 
-			if (!_isDeleted(target) && m_equal(val, m_key(*target))) {
-				return target;
+		bool _insert(Arrays& a, const_reference val, const KeyType& k, std::size_t h)
+		{
+			const uint8_t tag = _tag(h);
+
+			pointer existing = nullptr;
+			std::size_t freeSlot = a.m_maxSize;
+			std::size_t group = _firstGroup(a, h);
+			for (std::size_t i = 1; i <= a.m_groupMask + 1; ++i) {
+				const Group ctrl = _loadGroup(a, group);
+				const std::size_t base = group * s_groupSize;
+
+				for (uint32_t m = existing ? 0 : _match(ctrl, tag); m; m &= m - 1) {
+					pointer target = a.m_table + base + _lowestBit(m);
+					if (m_equal(m_key(*target), k)) {
+						if (!m_epoch) {
+							*target = val;
+							return true;
+						}
+						existing = target;
+						break;
+					}
+				}
+
+				if (freeSlot == a.m_maxSize) {
+					const uint32_t free = _matchFree(ctrl);
+					if (free) {
+						freeSlot = base + _lowestBit(free);
+					}
+				}
+				if (_matchEmpty(ctrl)) {
+					break;
+				}
+				group = (group + i) & a.m_groupMask;
 			}
 
-			for (int i = 1; i < m_maxSize; ++i) {
-				auto idx_ = index(idx + i);
-				target = m_table + idx_;
+			if (freeSlot == a.m_maxSize) {
+				return false;
+			}
+			_fill(a, freeSlot, tag, val);
+			// readers may hold old value, so it is replaced by a new slot
+			if (existing) {
+				_eraseSlot(a, existing);
+			}
+			return true;
+		}
 
-				if (_isNull(target)) {
-					return nullptr;
+		// key is known to be absent, first free slot is taken
+		void _insertNew(Arrays& a, const_reference val, std::size_t h)
+		{
+			std::size_t group = _firstGroup(a, h);
+			for (std::size_t i = 1; i <= a.m_groupMask + 1; ++i) {
+				const Group ctrl = _loadGroup(a, group);
+				const uint32_t free = _matchFree(ctrl);
+				if (free) {
+					_fill(a, group * s_groupSize + _lowestBit(free), _tag(h), val);
+					return;
 				}
+				group = (group + i) & a.m_groupMask;
+			}
+		}
 
-				if (_isDeleted(target)) {
-					continue;
+		static inline void _fill(Arrays& a, std::size_t slot, uint8_t tag, const_reference val)
+		{
+			if (_ctrlAt(a, slot) == s_deleted) {
+				a.m_deleted--;
+			}
+			a.m_table[slot] = val;
+			// reader which sees the tag sees the value
+			_setCtrl(a, slot, tag);
+			a.m_size++;
+		}
+
+		pointer _find(const Arrays& a, const KeyType& val, std::size_t h) const
+		{
+			const uint8_t tag = _tag(h);
+
+			std::size_t group = _firstGroup(a, h);
+			for (std::size_t i = 1; i <= a.m_groupMask + 1; ++i) {
+				const Group ctrl = _loadGroup(a, group);
+				pointer slots = a.m_table + group * s_groupSize;
+
+				uint32_t m = _match(ctrl, tag);
+				if (m) {
+					// pairs with release store of the tag, value of matched slot is visible
+					std::atomic_thread_fence(std::memory_order_acquire);
+				}
+				for (; m; m &= m - 1) {
+					pointer target = slots + _lowestBit(m);
+					if (m_equal(val, m_key(*target))) {
+						return target;
+					}
 				}
 
-				if (m_equal(val, m_key(*target))) {
-					return target;
+				if (_matchEmpty(ctrl)) {
+					return nullptr;
 				}
+				group = (group + i) & a.m_groupMask;
 			}
 
 			return nullptr;
 		}
 
-		std::size_t index(const std::size_t  val)
+		// group with an empty slot has never been full since clear, so no probe went past it
+		// and the slot can go back to empty instead of becoming a tombstone.
+		// with readers slot is never reused, it stays a tombstone until arrays are replaced
+		void _eraseSlot(Arrays& a, pointer p)
+		{
+			const std::size_t idx = p - a.m_table;
+			const Group ctrl = _loadGroup(a, idx / s_groupSize);
+			if (!m_epoch && _matchEmpty(ctrl)) {
+				_setCtrl(a, idx, s_empty);
+			}
+			else {
+				_setCtrl(a, idx, s_deleted);
+				a.m_deleted++;
+			}
+			a.m_size--;
+		}
+
+		// with readers only never used slots are free
+		inline uint32_t _matchFree(const Group& ctrl) const
+		{
+			return m_epoch ? _matchEmpty(ctrl) : _matchNotFull(ctrl);
+		}
+
+		// group control bytes taken with two loads, byte i is slot i whatever the byte order is
+		static inline Group _loadGroup(const Arrays& a, std::size_t group)
+		{
+			const CtrlWord* w = a.m_ctrl + group * (s_groupSize / s_ctrlPerWord);
+			const uint64_t lo = w[0].load(std::memory_order_relaxed);
+			const uint64_t hi = w[1].load(std::memory_order_relaxed);
+#ifdef ATTO_HASH_TABLE_SSE2
+			// straight into a register, going through memory would stall on store forwarding
+			return _mm_set_epi64x(static_cast<long long>(hi), static_cast<long long>(lo));
+#else
+			Group g;
+			memcpy(g.m_bytes, &lo, sizeof(lo));
+			memcpy(g.m_bytes + sizeof(lo), &hi, sizeof(hi));
+			return g;
+#endif
+		}
+
+		static inline uint8_t _ctrlAt(const Arrays& a, std::size_t slot)
+		{
+			const uint64_t w = a.m_ctrl[slot / s_ctrlPerWord].load(std::memory_order_relaxed);
+			uint8_t b;
+			memcpy(&b, reinterpret_cast<const uint8_t*>(&w) + slot % s_ctrlPerWord, 1);
+			return b;
+		}
+
+		// only writer changes words, so load and store of the whole word loses nothing
+		static inline void _setCtrl(Arrays& a, std::size_t slot, uint8_t b)
+		{
+			CtrlWord& word = a.m_ctrl[slot / s_ctrlPerWord];
+			uint64_t w = word.load(std::memory_order_relaxed);
+			memcpy(reinterpret_cast<uint8_t*>(&w) + slot % s_ctrlPerWord, &b, 1);
+			word.store(w, std::memory_order_release);
+		}
+
+		static inline std::size_t _firstGroup(const Arrays& a, std::size_t h)
+		{
+			return (h >> 7) & a.m_groupMask;
+		}
+
+		static inline uint8_t _tag(std::size_t h)
+		{
+			return static_cast<uint8_t>(s_full | (h & 0x7f));
+		}
+
+		static inline int _lowestBit(uint32_t mask)
+		{
+#ifdef _MSC_VER
+			unsigned long idx;
+			_BitScanForward(&idx, mask);
+			return static_cast<int>(idx);
+#else
+			return __builtin_ctz(mask);
+#endif
+		}
+
+		// bit i of result is set if ctrl[i] == b
+		static inline uint32_t _match(const Group& ctrl, uint8_t b)
+		{
+#ifdef ATTO_HASH_TABLE_SSE2
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(b)))));
+#else
+			uint32_t mask = 0;
+			for (int i = 0; i < s_groupSize; ++i) {
+				mask |= static_cast<uint32_t>(ctrl.m_bytes[i] == b) << i;
+			}
+			return mask;
+#endif
+		}
+
+		static inline uint32_t _matchEmpty(const Group& ctrl)
+		{
+			return _match(ctrl, s_empty);
+		}
+
+		// full slots have high bit set
+		static inline uint32_t _matchFull(const Group& ctrl)
+		{
+#ifdef ATTO_HASH_TABLE_SSE2
+			return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+			uint32_t mask = 0;
+			for (int i = 0; i < s_groupSize; ++i) {
+				mask |= static_cast<uint32_t>((ctrl.m_bytes[i] & s_full) != 0) << i;
+			}
+			return mask;
+#endif
+		}
+
+		// empty or deleted, i.e. high bit is clear
+		static inline uint32_t _matchNotFull(const Group& ctrl)
 		{
-			return m_hasher(val) & m_maxSize - 1;
+			return ~_matchFull(ctrl) & 0xffff;
 		}
 
 	private:
 		hash m_hasher;
 		key m_key;
 		equal m_equal;
-		pointer m_table;
-		std::size_t m_size;
-		std::size_t m_maxSize;
+		std::atomic<Arrays*> m_cur;
+		std::atomic<Arrays*> m_old;
+		// odd while growth start or end is being published
+		std::atomic<uint32_t> m_seq;
+		std::size_t m_migrated;
+		std::size_t m_capacityLimit;
+		sync::EpochDomain* m_epoch;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "../utils/eventCount.h"
+
+namespace cont {
+
+	// what producer does when ring is full
+	// - Drop, values which don't fit are counted in dropped() and lost
+	// - Backpressure, producer sleeps until consumer frees space or ring is stopped
+	enum class FullPolicy {
+		Drop,
+		Backpressure
+	};
+
+	// bounded multi-producer single-consumer ring, allocates only in init
+	// - producers reserve a range of positions with one CAS on m_tail, write values and mark
+	//   every slot ready by storing its position + 1 into slot sequence
+	// - consumer takes ready slots in order and publishes m_head once per batch,
+	//   position p may be reused when p < m_head + capacity
+	// - consumer sleeps in popWait, producers wake it only if it really sleeps
+	// head, tail and counters live on separate cache lines, so producers and consumer
+	// don't bounce each others lines
+	template <typename T>
+	class MpscRing
+	{
+	public:
+		static const int s_maxCapacity = 1 << 30;
+
+	public:
+		MpscRing()
+			:
+			m_slots{ nullptr },
+			m_mask{ 0u },
+			m_policy{ FullPolicy::Drop },
+			m_head{ 0u },
+			m_tail{ 0u },
+			m_dropped{ 0u },
+			m_stopped{ false }
+		{}
+
+		~MpscRing()
+		{
+			if (m_slots) {
+				delete[] m_slots;
+			}
+		}
+
+		MpscRing(const MpscRing&) = delete;
+		MpscRing& operator=(const MpscRing&) = delete;
+
+		// capacity is rounded up to power of two
+		bool init(int capacity, FullPolicy policy)
+		{
+			if (m_slots) {
+				return true;
+			}
+
+			uint64_t size = 2;
+			while (size < static_cast<uint64_t>(capacity) && size < s_maxCapacity) {
+				size <<= 1;
+			}
+			m_mask = size - 1;
+			m_policy = policy;
+			m_slots = new Slot[size];
+			for (uint64_t i = 0; i < size; ++i) {
+				// nothing is ready, position 0 expects 1
+				m_slots[i].m_seq.store(0, std::memory_order_relaxed);
+			}
+			return m_slots != nullptr;
+		}
+
+		bool push(const T& val)
+		{
+			return push(&val, 1) == 1;
+		}
+
+		// any thread, returns number of values which got in, less than count
+		// only with Drop policy or after stop()
+		int push(const T* vals, int count)
+		{
+			int pushed = 0;
+			while (pushed < count) {
+				const int n = _pushSome(vals + pushed, count - pushed);
+				pushed += n;
+				if (pushed == count) {
+					break;
+				}
+				if (m_policy == FullPolicy::Drop || m_stopped.load(std::memory_order_relaxed)) {
+					m_dropped.fetch_add(count - pushed, std::memory_order_relaxed);
+					break;
+				}
+				if (n == 0) {
+					_waitForSpace();
+				}
+			}
+			if (pushed > 0) {
+				m_dataEvent.notify();
+			}
+			return pushed;
+		}
+
+		// consumer only, doesn't block, returns number of values taken
+		int pop(T* out, int maxCount)
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			int n = 0;
+			for (; n < maxCount; ++n) {
+				Slot& s = m_slots[(head + n) & m_mask];
+				if (s.m_seq.load(std::memory_order_acquire) != head + n + 1) {
+					break;
+				}
+				out[n] = s.m_val;
+			}
+			if (n > 0) {
+				m_head.store(head + n, std::memory_order_release);
+				m_spaceEvent.notify();
+			}
+			return n;
+		}
+
+		// consumer only, sleeps until something is pushed, ring is stopped or timeout passes
+		template <typename Duration>
+		int popWait(T* out, int maxCount, Duration timeout)
+		{
+			int n = pop(out, maxCount);
+			if (n > 0) {
+				return n;
+			}
+
+			const uint32_t key = m_dataEvent.prepareWait();
+			n = pop(out, maxCount);
+			if (n > 0 || m_stopped.load(std::memory_order_acquire)) {
+				m_dataEvent.cancelWait();
+				return n;
+			}
+			m_dataEvent.wait(key, timeout);
+			return pop(out, maxCount);
+		}
+
+		// wakes consumer and producers waiting for space, later pushes behave like Drop
+		void stop()
+		{
+			m_stopped.store(true, std::memory_order_release);
+			m_dataEvent.notify();
+			m_spaceEvent.notify();
+		}
+
+		bool stopped() const { return m_stopped.load(std::memory_order_acquire); }
+
+		// consumer only
+		bool empty() const
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			return m_slots[head & m_mask].m_seq.load(std::memory_order_acquire) != head + 1;
+		}
+
+		// reserved positions not taken by consumer yet, approximate while producers push
+		uint64_t size() const
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0u;
+		}
+
+		uint64_t capacity() const { return m_mask + 1; }
+		uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	private:
+		struct Slot {
+			std::atomic<uint64_t> m_seq;
+			T m_val;
+		};
+
+		// reserves as many positions as are free, up to count
+		int _pushSome(const T* vals, int count)
+		{
+			uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			uint64_t n = 0;
+			while (true) {
+				const uint64_t free = m_mask + 1 - (tail - m_head.load(std::memory_order_acquire));
+				n = free < static_cast<uint64_t>(count) ? free : static_cast<uint64_t>(count);
+				if (n == 0) {
+					return 0;
+				}
+				if (m_tail.compare_exchange_weak(tail, tail + n, std::memory_order_relaxed, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+
+			for (uint64_t i = 0; i < n; ++i) {
+				Slot& s = m_slots[(tail + i) & m_mask];
+				s.m_val = vals[i];
+				s.m_seq.store(tail + i + 1, std::memory_order_release);
+			}
+			return static_cast<int>(n);
+		}
+
+		void _waitForSpace()
+		{
+			const uint32_t key = m_spaceEvent.prepareWait();
+			const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) <= m_mask || m_stopped.load(std::memory_order_acquire)) {
+				m_spaceEvent.cancelWait();
+				return;
+			}
+			m_spaceEvent.wait(key, std::chrono::milliseconds(10));
+		}
+
+	private:
+		// read mostly part
+		Slot* m_slots;
+		uint64_t m_mask;
+		FullPolicy m_policy;
+		char m_pad0[64];
+		// consumer position
+		std::atomic<uint64_t> m_head;
+		char m_pad1[64 - sizeof(std::atomic<uint64_t>)];
+		// producers position
+		std::atomic<uint64_t> m_tail;
+		char m_pad2[64 - sizeof(std::atomic<uint64_t>)];
+		std::atomic<uint64_t> m_dropped;
+		std::atomic<bool> m_stopped;
+		char m_pad3[64];
+		sync::EventCount m_dataEvent;
+		char m_pad4[64];
+		sync::EventCount m_spaceEvent;
+	};
+}
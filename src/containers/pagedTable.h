@@ -1,9 +1,29 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <stdint.h>
+
+#include "../utils/epoch.h"
 #include "../utils/spinlock.h"
 #include "hashTable.h"
 
 namespace cont {
+
+	// how value finds its page
+	// - ByKey, page comes from key hash, every operation touches exactly one page and one lock
+	// - ByPage, caller picks the page (e.g. receiver id), lookups use optional secondary index
+	//   and fall back to scanning all pages
+	enum class Routing {
+		ByKey,
+		ByPage
+	};
+
+	// readers don't take page locks: get is valid under an EpochGuard of epoch() and returned
+	// pointer stays valid until the guard is gone. retired table is cleared only after every
+	// reader which could reach it has left, so writers never wait for readers
+
 	template <typename Type, typename Key, typename Hasher, typename KeyFunc, typename Equality>
 	class PagedTable {
 	public:
@@ -12,12 +32,19 @@ namespace cont {
 			m_pages{nullptr},
 			m_activePages{nullptr},
 			m_pageLocks{nullptr},
+			m_busy{nullptr},
+			m_index{nullptr},
+			m_indexMask{0u},
 			m_pageSize{1024u},
-			m_numberOfPages{4}
+			m_numberOfPages{4},
+			m_routing{Routing::ByPage}
 		{}
 
 		~PagedTable()
 		{
+			// nobody reads any more, deferred clears run while tables still exist
+			m_epoch.collect();
+
 			if (m_pages) {
 				delete[] m_pages;
 			}
@@ -29,62 +56,170 @@ namespace cont {
 			if (m_pageLocks) {
 				delete[] m_pageLocks;
 			}
+
+			if (m_busy) {
+				delete[] m_busy;
+			}
+
+			if (m_index) {
+				delete[] m_index;
+			}
 		}
 
 
 	public:
 		using Table = HashTable<Type, Key, Hasher, KeyFunc, Equality>;
-		
-		bool init(int numberOfPages, int pageSize)
+		// gets index of full table which left active set, table belongs to handler until release(tableIdx)
+		using RetireFunc = std::function<void(int tableIdx)>;
+
+		static const int s_maxPages = 0xffff;
+
+		// pages grow online from pageSize up to maxPageSize
+		// indexSize is number of secondary index slots for ByPage routing, 0 turns index off
+		bool init(int numberOfPages, int pageSize, int maxPageSize = 0, Routing routing = Routing::ByPage, int indexSize = 0)
 		{
+			if (numberOfPages < 1 || numberOfPages > s_maxPages) {
+				return false;
+			}
+
 			// double buffering
 			m_numberOfPages = numberOfPages;
 			m_pageSize = pageSize;
+			m_routing = routing;
 
 			m_pages = new Table[m_numberOfPages * 2];
-			m_activePages = new int[numberOfPages];
+			m_activePages = new std::atomic<int>[numberOfPages];
 			m_pageLocks = new sync::spinlock[numberOfPages] ;
+			m_busy = new std::atomic<bool>[m_numberOfPages * 2];
 
 			if (!m_pages || !m_activePages) {
 				return false;
 			}
 
 			for (int i = 0; i < m_numberOfPages * 2; ++i) {
-				m_pages[i].init(m_pageSize);
+				m_busy[i].store(false, std::memory_order_relaxed);
+			}
+
+			for (int i = 0; i < m_numberOfPages * 2; ++i) {
+				m_pages[i].setEpoch(&m_epoch);
+				if (!m_pages[i].init(m_pageSize, maxPageSize)) {
+					return false;
+				}
 			}
 
 			for (int i = 0; i < m_numberOfPages; ++i) {
-				m_activePages[i] = i;
+				m_activePages[i].store(i, std::memory_order_relaxed);
+			}
+
+			if (m_routing == Routing::ByPage && indexSize > 0) {
+				uint64_t size = 64;
+				while (size < static_cast<uint64_t>(indexSize)) {
+					size <<= 1;
+				}
+				m_indexMask = size - 1;
+				m_index = new std::atomic<uint64_t>[size];
+				for (uint64_t i = 0; i < size; ++i) {
+					m_index[i].store(0, std::memory_order_relaxed);
+				}
 			}
 
 			return true;
 		}
 
+		// pageIdx is used only with ByPage routing
 		void insert(int pageIdx, const Type& val)
 		{
-			sync::lock_guard lock{ m_pageLocks[pageIdx] };
-			int targetPage = m_activePages[pageIdx];
-			Table& t = m_pages[targetPage];
-			t.insert(val);
-			if (t.loadFactor() > 0.8) {
+			const int page = _routeInsert(pageIdx, val);
+			while (true) {
+				{
+					sync::lock_guard lock{ m_pageLocks[page] };
+					if (_insert(page, val)) {
+						return;
+					}
+				}
+				_waitPair(page);
+			}
+		}
+
+		// takes each page lock once for the whole batch
+		void insertBatch(int pageIdx, const Type* vals, int count)
+		{
+			if (m_routing == Routing::ByPage) {
+				if (m_index) {
+					for (int i = 0; i < count; ++i) {
+						_indexStore(m_hasher(m_key(vals[i])), pageIdx);
+					}
+				}
+				int i = 0;
+				while (true) {
+					{
+						sync::lock_guard lock{ m_pageLocks[pageIdx] };
+						for (; i < count && _insert(pageIdx, vals[i]); ++i) {
+						}
+					}
+					if (i == count) {
+						return;
+					}
+					_waitPair(pageIdx);
+				}
+			}
+
+			// values are grouped by page in chunks, so lock is taken once per page per chunk
+			static const int s_chunk = 64;
+			uint16_t pages[s_chunk];
+			for (int first = 0; first < count; first += s_chunk) {
+				const int n = count - first < s_chunk ? count - first : s_chunk;
+				for (int i = 0; i < n; ++i) {
+					pages[i] = static_cast<uint16_t>(_pageOf(m_hasher(m_key(vals[first + i]))));
+				}
 
-				// if we are here it means that table is full
-				// and we can pass it to another thread which persists it somewhere
-				// by simply placing table index in the queue and notifying cond_var
-				// p.s. it isn't implemented here, as it is not required by task. Just notes to a reader.
-				_changeActivePage(pageIdx);
-				t.clear();
+				for (int i = 0; i < n; ++i) {
+					const uint16_t page = pages[i];
+					if (page == s_done) {
+						continue;
+					}
+					bool full = true;
+					while (full) {
+						{
+							sync::lock_guard lock{ m_pageLocks[page] };
+							full = false;
+							for (int j = i; j < n && !full; ++j) {
+								if (pages[j] != page) {
+									continue;
+								}
+								if (_insert(page, vals[first + j])) {
+									pages[j] = s_done;
+								}
+								else {
+									full = true;
+								}
+							}
+						}
+						if (full) {
+							_waitPair(page);
+						}
+					}
+				}
 			}
 		}
 
 		void remove(const Type& val) {
+			const int page = _routeLookup(m_key(val));
+			if (page >= 0) {
+				sync::lock_guard lock{ m_pageLocks[page] };
+				if (_active(page).erase(val) || m_routing == Routing::ByKey) {
+					return;
+				}
+			}
+			else if (page == s_absent) {
+				return;
+			}
+
 			for (int i = 0; i < m_numberOfPages; ++i) {
 				sync::lock_guard lock{ m_pageLocks[i] };
-				int activeIdx = m_activePages[i];
 				// here we only care about active pages
 				// as inactive are passed somewhere else
-				Table& t = m_pages[activeIdx];
-				if (t.erase(val)) {
+				if (_active(i).erase(val)) {
 					return;
 				}
 			}
@@ -92,46 +227,230 @@ namespace cont {
 
 		bool has(const Key& val)
 		{
-			for (int i = 0; i < m_numberOfPages; ++i) {
-				sync::lock_guard lock{ m_pageLocks[i] };
-				int activeIdx = m_activePages[i];
-				// here we only care about active pages
-				// as inactive are passed somewhere else
-				Table& t = m_pages[activeIdx];
-				if (t.has(val)) {
-					return true;
-				}
-			}
-			return false;
+			sync::EpochGuard guard{ m_epoch };
+			return get(val, guard) != nullptr;
 		}
 
-		Type* get(const Key& val)
+		// lock-free, guard has to be taken on epoch() and result is valid while it lives.
+		// retired table is looked at until retire handler releases it, so value doesn't
+		// disappear while its page is being flushed
+		const Type* get(const Key& val, const sync::EpochGuard&)
 		{
+			const int page = _routeLookup(val);
+			if (page >= 0) {
+				const Type* res = _getPage(page, val);
+				if (res || m_routing == Routing::ByKey) {
+					return res;
+				}
+			}
+			else if (page == s_absent) {
+				return nullptr;
+			}
+
 			for (int i = 0; i < m_numberOfPages; ++i) {
-				sync::lock_guard lock{ m_pageLocks[i] };
-				int activeIdx = m_activePages[i];
-				// here we only care about active pages
-				// as inactive are passed somewhere else
-				Table& t = m_pages[activeIdx];
-				if (t.has(val)) {
-					return t.get(val);
+				const Type* res = _getPage(i, val);
+				if (res) {
+					return res;
 				}
 			}
 			return nullptr;
 		}
 
+		sync::EpochDomain& epoch() { return m_epoch; }
+
+		// reclaims tables and arrays which readers have left, writers do it on their own
+		// when they need a table back, idle owner may call it to release memory earlier
+		int collect() { return m_epoch.collect(); }
+
+		Routing routing() const { return m_routing; }
+
+		// page ByKey routing puts the key into, callers may shard their work the same way
+		int pageOfKey(const Key& key) const { return _pageOf(m_hasher(key)); }
+
+		// without handler full page is cleared in place and its values are lost,
+		// must be set before first insert
+		void setRetireHandler(RetireFunc f) { m_retire = std::move(f); }
+
+		// retired table, only its owner (retire handler) may use it, readers only look into it
+		const Table& table(int tableIdx) const { return m_pages[tableIdx]; }
+
+		// clears retired table and lets its page pair switch to it again, called by retire handler.
+		// clear is deferred until readers are done with the table
+		void release(int tableIdx)
+		{
+			m_epoch.retire(new Released{ this, tableIdx }, &_clearReleased);
+			m_epoch.collect();
+		}
+
 	private:
-		inline void _changeActivePage(int pageIdx)
+		static const uint16_t s_done = 0xffff;
+		// _routeLookup results which are not a page
+		static const int s_scan = -1;
+		static const int s_absent = -2;
+
+		struct Released {
+			PagedTable* m_owner;
+			int m_tableIdx;
+		};
+
+		static void _clearReleased(void* p)
+		{
+			Released* r = static_cast<Released*>(p);
+			r->m_owner->m_pages[r->m_tableIdx].clear();
+			r->m_owner->m_busy[r->m_tableIdx].store(false, std::memory_order_release);
+			delete r;
+		}
+
+		// writer side, under page lock
+		inline Table& _active(int pageIdx)
+		{
+			return m_pages[m_activePages[pageIdx].load(std::memory_order_relaxed)];
+		}
+
+		// active table, then its pair while it is retired. busy flag is set before page switches
+		// and cleared only after readers left the table, so a value moving to the pair is seen
+		// in one of them
+		inline const Type* _getPage(int pageIdx, const Key& val)
+		{
+			const int cur = m_activePages[pageIdx].load(std::memory_order_acquire);
+			const Type* res = m_pages[cur].get(val);
+			if (!res) {
+				const int pair = _pairOf(cur);
+				if (m_busy[pair].load(std::memory_order_acquire)) {
+					res = m_pages[pair].get(val);
+				}
+			}
+			return res;
+		}
+
+		// multiply-shift over high half of hash, low bits are used by page itself
+		inline int _pageOf(std::size_t h) const
+		{
+			return static_cast<int>(((static_cast<uint64_t>(h) >> 32) * static_cast<uint64_t>(m_numberOfPages)) >> 32);
+		}
+
+		inline int _routeInsert(int pageIdx, const Type& val)
+		{
+			const std::size_t h = m_hasher(m_key(val));
+			if (m_routing == Routing::ByKey) {
+				return _pageOf(h);
+			}
+			if (m_index) {
+				_indexStore(h, pageIdx);
+			}
+			return pageIdx;
+		}
+
+		// page to look at first, s_scan if any page may hold the key, s_absent if none does
+		inline int _routeLookup(const Key& val) const
+		{
+			const std::size_t h = m_hasher(val);
+			if (m_routing == Routing::ByKey) {
+				return _pageOf(h);
+			}
+			if (!m_index) {
+				return s_scan;
+			}
+
+			const uint64_t entry = m_index[h & m_indexMask].load(std::memory_order_acquire);
+			if (entry == 0) {
+				return s_absent;
+			}
+			if ((entry >> 16) == (static_cast<uint64_t>(h) >> 16)) {
+				return static_cast<int>(entry & 0xffff) - 1;
+			}
+			return s_scan;
+		}
+
+		// secondary index is lossy: slot keeps fingerprint (high 48 bits of hash) and page of
+		// the last key hashed into it, older key sharing the slot falls back to scanning pages.
+		// slots are never cleared, so empty slot proves that no key with this hash was inserted.
+		// it is stored before the value is inserted, so reader never misses a value which is there
+		inline void _indexStore(std::size_t h, int pageIdx)
+		{
+			const uint64_t entry = (static_cast<uint64_t>(h) >> 16 << 16) | static_cast<uint64_t>(pageIdx + 1);
+			m_index[h & m_indexMask].store(entry, std::memory_order_release);
+		}
+
+		// under page lock, false when table is completely full and its pair is still being
+		// flushed: caller drops the lock, waits in _waitPair and tries again
+		inline bool _insert(int pageIdx, const Type& val)
+		{
+			Table* t = &_active(pageIdx);
+			if (!t->insert(val)) {
+				if (!_retire(pageIdx)) {
+					return false;
+				}
+				t = &_active(pageIdx);
+				t->insert(val);
+			}
+
+			// table grows by itself, page is rotated only when it hits size limit
+			if (t->loadFactor() > 0.8 && !t->canGrow()) {
+				_retire(pageIdx);
+			}
+			return true;
+		}
+
+		// switches page to its pair table and hands full one to retire handler,
+		// pair is reused only after handler released it and readers left it.
+		// false if pair isn't free yet, page keeps filling current table then.
+		// without handler table is released at once
+		inline bool _retire(int pageIdx)
+		{
+			const int cur = m_activePages[pageIdx].load(std::memory_order_relaxed);
+			const int pair = _pairOf(cur);
+
+			if (m_busy[pair].load(std::memory_order_acquire)) {
+				// pair may only wait for readers to leave
+				m_epoch.collect();
+				if (m_busy[pair].load(std::memory_order_acquire)) {
+					return false;
+				}
+			}
+
+			m_busy[cur].store(true, std::memory_order_relaxed);
+			m_activePages[pageIdx].store(pair, std::memory_order_release);
+			if (m_retire) {
+				m_retire(cur);
+			}
+			else {
+				release(cur);
+			}
+			return true;
+		}
+
+		// without page lock, so other writers of the page don't spin behind a flush
+		void _waitPair(int pageIdx)
+		{
+			const int pair = _pairOf(m_activePages[pageIdx].load(std::memory_order_acquire));
+			while (m_busy[pair].load(std::memory_order_acquire)) {
+				m_epoch.collect();
+				std::this_thread::yield();
+			}
+		}
+
+		// toggles between page and its pair
+		inline int _pairOf(int tableIdx) const
 		{
-			m_activePages[pageIdx] = (pageIdx + m_numberOfPages) & (m_numberOfPages * 2 - 1);
+			return (tableIdx + m_numberOfPages) % (m_numberOfPages * 2);
 		}
 
 	private:
 
 		Table* m_pages;
-		int* m_activePages;
+		std::atomic<int>* m_activePages;
 		sync::spinlock* m_pageLocks;
+		// table is retired and not released yet
+		std::atomic<bool>* m_busy;
+		RetireFunc m_retire;
+		std::atomic<uint64_t>* m_index;
+		uint64_t m_indexMask;
+		Hasher m_hasher;
+		KeyFunc m_key;
 		int m_pageSize;
 		int m_numberOfPages;
+		Routing m_routing;
+		sync::EpochDomain m_epoch;
 	};
-}
\ No newline at end of file
+}
@@ -1,66 +1,145 @@
 #pragma once
 
+#include <cstring> // memset
+#include <stdint.h>
+
 #include "../logic/message.h"
 
 namespace cont {
+
+	// duplicate filter over ids [m_base, m_base + m_size), one bit per id in a ring bitmap
+	// - ids below m_base are too old to tell, they are treated as duplicates
+	// - id past the window slides it forward, bits of ids which fall out are cleared
+	// - id more than s_maxLeadWindows windows past the window (corrupt or foreign datagram)
+	//   is rejected and counted instead, otherwise one such id would make every id of the
+	//   stream look old. s_resyncRun of them in a row mean the stream really jumped
+	//   (e.g. sender restarted), then window follows
+	// insert is O(1), sliding is amortized O(1) (one word clear per 64 ids of advance)
 	class SlidingWindow
 	{
 	public:
 		using MsgId = data::MsgId;
 
+		static const int s_maxWindowSize = 1 << 30;
+		static const int s_maxLeadWindows = 1;
+		static const int s_resyncRun = 64;
+
 	public:
 		SlidingWindow()
-			: 
-			m_minVal{ 0u }, 
-			m_lastProcessed{nullptr},
-			m_workIdx{0},
-			m_size{0}
+			:
+			m_base{ 0u },
+			m_bits{ nullptr },
+			m_mask{ 0u },
+			m_size{ 0u },
+			m_seen{ false },
+			m_farRun{ 0 },
+			m_farRejected{ 0u }
 		{}
 		~SlidingWindow()
 		{
-			if (m_lastProcessed) {
-				delete[] m_lastProcessed;
+			if (m_bits) {
+				delete[] m_bits;
 			}
 		}
 
+		SlidingWindow(const SlidingWindow&) = delete;
+		SlidingWindow& operator=(const SlidingWindow&) = delete;
+
+		// window size is rounded up to power of two, at least 64
 		bool init(int windowSize) {
-			m_size = windowSize;
-			if (!m_lastProcessed) {
-				m_lastProcessed = new MsgId[m_size];
-				memset(m_lastProcessed, ~0, sizeof(MsgId) * m_size);
+			if (m_bits) {
+				return true;
 			}
 
-			return m_lastProcessed != nullptr;
+			uint64_t size = 64;
+			while (size < static_cast<uint64_t>(windowSize) && size < s_maxWindowSize) {
+				size <<= 1;
+			}
+			m_size = size;
+			m_mask = size - 1;
+			m_bits = new uint64_t[m_size / 64];
+			memset(m_bits, 0, sizeof(uint64_t) * (m_size / 64));
+			return m_bits != nullptr;
 		}
 
+		// returns false if id was seen before, is older than the window or far ahead of it
 		bool insert(const MsgId& newId)
 		{
-			// it makes no sense to check upper-bound
-			// because if we discard it, it will be lost
-			if (newId < m_minVal) {
+			if (newId < m_base) {
 				return false;
 			}
 
-			for (int i = 0; i < m_size; ++i) {
-				if (m_lastProcessed[i] == newId) {
+			if (newId - m_base >= m_size) {
+				// first id places the window wherever the stream starts
+				if (m_seen && newId - m_base >= m_size * (1 + s_maxLeadWindows) && ++m_farRun < s_resyncRun) {
+					m_farRejected++;
 					return false;
 				}
+				_slide(newId - m_size + 1);
 			}
+			m_farRun = 0;
+			m_seen = true;
 
-			if (newId == m_minVal) {
-				++m_minVal;
+			const uint64_t pos = newId & m_mask;
+			uint64_t& word = m_bits[pos >> 6];
+			const uint64_t bit = 1ull << (pos & 63);
+			if (word & bit) {
+				return false;
 			}
-
-			m_lastProcessed[m_workIdx] = newId;
-			m_workIdx = ++m_workIdx % m_size;
+			word |= bit;
 			return true;
 		}
+
+		bool has(const MsgId& id) const
+		{
+			if (id < m_base) {
+				return true;
+			}
+			if (id - m_base >= m_size) {
+				return false;
+			}
+			const uint64_t pos = id & m_mask;
+			return (m_bits[pos >> 6] >> (pos & 63)) & 1;
+		}
+
+		// lowest id which still can be accepted
+		MsgId watermark() const { return m_base; }
+		uint64_t size() const { return m_size; }
+		// ids rejected for being too far ahead, the ones which resynced the window aren't counted
+		uint64_t farRejected() const { return m_farRejected; }
+
+	private:
+		// clears bits of ids [m_base, newBase) and moves window
+		void _slide(MsgId newBase)
+		{
+			uint64_t count = newBase - m_base;
+			if (count >= m_size) {
+				memset(m_bits, 0, sizeof(uint64_t) * (m_size / 64));
+				m_base = newBase;
+				return;
+			}
+
+			// size is a multiple of 64, so a chunk never crosses the ring end
+			uint64_t pos = m_base & m_mask;
+			while (count > 0) {
+				const uint64_t offset = pos & 63;
+				const uint64_t n = count < 64 - offset ? count : 64 - offset;
+				const uint64_t mask = n == 64 ? ~0ull : ((1ull << n) - 1) << offset;
+				m_bits[pos >> 6] &= ~mask;
+				count -= n;
+				pos = (pos + n) & m_mask;
+			}
+			m_base = newBase;
+		}
+
 	private:
-		MsgId m_minVal;
-		MsgId* m_lastProcessed;
-		int m_workIdx;
-		int m_size;
+		MsgId m_base;
+		uint64_t* m_bits;
+		uint64_t m_mask;
+		uint64_t m_size;
+		bool m_seen;
+		// far ids in a row
+		int m_farRun;
+		uint64_t m_farRejected;
 	};
-	
-	
-}
\ No newline at end of file
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace cont {
+
+	// bounded single-producer single-consumer ring, allocates only in init
+	// - producer writes values and publishes m_tail once per push
+	// - consumer reads values and publishes m_head once per pop
+	// each side keeps a cached copy of the other side position and reloads it only
+	// when the ring looks full (producer) or empty (consumer), so in steady state
+	// neither side touches the line the other one writes
+	// never blocks, caller decides what to do when push doesn't fit
+	template <typename T>
+	class SpscRing
+	{
+	public:
+		static const int s_maxCapacity = 1 << 30;
+
+	public:
+		SpscRing()
+			:
+			m_slots{ nullptr },
+			m_mask{ 0u },
+			m_head{ 0u },
+			m_tailCache{ 0u },
+			m_tail{ 0u },
+			m_headCache{ 0u }
+		{}
+
+		~SpscRing()
+		{
+			if (m_slots) {
+				delete[] m_slots;
+			}
+		}
+
+		SpscRing(const SpscRing&) = delete;
+		SpscRing& operator=(const SpscRing&) = delete;
+
+		// capacity is rounded up to power of two
+		bool init(int capacity)
+		{
+			if (m_slots) {
+				return true;
+			}
+
+			uint64_t size = 2;
+			while (size < static_cast<uint64_t>(capacity) && size < s_maxCapacity) {
+				size <<= 1;
+			}
+			m_mask = size - 1;
+			m_slots = new T[size];
+			return m_slots != nullptr;
+		}
+
+		// producer only, returns number of values which got in
+		int push(const T* vals, int count)
+		{
+			const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			uint64_t free = m_mask + 1 - (tail - m_headCache);
+			if (free < static_cast<uint64_t>(count)) {
+				m_headCache = m_head.load(std::memory_order_acquire);
+				free = m_mask + 1 - (tail - m_headCache);
+			}
+
+			const int n = free < static_cast<uint64_t>(count) ? static_cast<int>(free) : count;
+			for (int i = 0; i < n; ++i) {
+				m_slots[(tail + i) & m_mask] = vals[i];
+			}
+			if (n > 0) {
+				m_tail.store(tail + n, std::memory_order_release);
+			}
+			return n;
+		}
+
+		// consumer only, returns number of values taken
+		int pop(T* out, int maxCount)
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			uint64_t ready = m_tailCache - head;
+			if (ready < static_cast<uint64_t>(maxCount)) {
+				m_tailCache = m_tail.load(std::memory_order_acquire);
+				ready = m_tailCache - head;
+			}
+
+			const int n = ready < static_cast<uint64_t>(maxCount) ? static_cast<int>(ready) : maxCount;
+			for (int i = 0; i < n; ++i) {
+				out[i] = m_slots[(head + i) & m_mask];
+			}
+			if (n > 0) {
+				m_head.store(head + n, std::memory_order_release);
+			}
+			return n;
+		}
+
+		// consumer only
+		bool empty() const
+		{
+			return m_tail.load(std::memory_order_acquire) == m_head.load(std::memory_order_relaxed);
+		}
+
+		uint64_t capacity() const { return m_mask + 1; }
+
+	private:
+		// read mostly part
+		T* m_slots;
+		uint64_t m_mask;
+		char m_pad0[64];
+		// consumer line
+		std::atomic<uint64_t> m_head;
+		uint64_t m_tailCache;
+		char m_pad1[64 - sizeof(std::atomic<uint64_t>) - sizeof(uint64_t)];
+		// producer line
+		std::atomic<uint64_t> m_tail;
+		uint64_t m_headCache;
+		char m_pad2[64 - sizeof(std::atomic<uint64_t>) - sizeof(uint64_t)];
+	};
+}
@@ -1,42 +1,14 @@
 #include "message.h"
 
-#include <stddef.h> // offsetof
-#include <cstring>
 #include <sstream>
-#ifdef __linux
-#include <backward/hash_fun.h>
-#else
-#include <xhash>
-#endif
-
-void data::SerialiseMessage(char* outBuf, message* inMsg)
-{
-	std::ostringstream stream{ std::string{outBuf, sizeof(message)} };
-	char* base = reinterpret_cast<char*>(inMsg);
-	char* src = base;
-	stream.write(src, sizeof(inMsg->MessageSize));
-	src = base + offsetof(message, MessageType);
-	stream.write(src, sizeof(inMsg->MessageType));
-	src = base + offsetof(message, MessageId);
-	stream.write(src, sizeof(inMsg->MessageId));
-	src = base + offsetof(message, MessageData);
-	stream.write(src, sizeof(inMsg->MessageData));
-	memcpy(outBuf, stream.str().c_str(), stream.str().length());
-}
 
-void data::DeserialiseMessage(char* inBuf, message* outMsg)
-{
-	std::istringstream stream{ std::string{inBuf, sizeof(message)} };
-	char* base = reinterpret_cast<char*>(outMsg);
-	char* dst = base;
-	stream.read(dst, sizeof(outMsg->MessageSize));
-	dst = base + offsetof(message, MessageType);
-	stream.read(dst, sizeof(outMsg->MessageType));
-	dst = base + offsetof(message, MessageId);
-	stream.read(dst, sizeof(outMsg->MessageId));
-	dst = base + offsetof(message, MessageData);
-	stream.read(dst, sizeof(outMsg->MessageData));	
-}
+#if defined(__x86_64__) || defined(_M_X64)
+#define ATTO_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 std::string data::toString(const message& msg)
 {
@@ -49,14 +21,141 @@ std::string data::toString(const message& msg)
 	return stream.str();
 }
 
-size_t data::MessageHasher::operator()(const uint64_t& _Keyval) const noexcept
+
+// Batch decoder
+// id and data are adjacent on the wire, so one unaligned 16 byte load at s_idOffset
+// brings both, unpacking two such loads gives two ids and two data values.
+// size and type are in the first 4 bytes and are split with plain shifts.
+namespace {
+	using BatchDecoder = int(*)(const char* const*, int, data::MessageBatch*);
+
+#ifdef ATTO_X86_SIMD
+	// x86 is little endian, so wire layout matches registers as is
+	inline void _decodeHeader(const char* buf, data::MessageBatch* out, int i)
+	{
+		uint32_t head;
+		memcpy(&head, buf, sizeof(head));
+		out->MessageSize[i] = static_cast<uint16_t>(head);
+		out->MessageType[i] = static_cast<uint8_t>(head >> 16);
+	}
+
+	// decodes messages [begin, count)
+	void _decodeSSE2(const char* const* bufs, int begin, int count, data::MessageBatch* out)
+	{
+		using namespace data::wire;
+		int i = begin;
+		for (; i + 2 <= count; i += 2) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i] + s_idOffset));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i + 1] + s_idOffset));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out->MessageId + i), _mm_unpacklo_epi64(a, b));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out->MessageData + i), _mm_unpackhi_epi64(a, b));
+			_decodeHeader(bufs[i], out, i);
+			_decodeHeader(bufs[i + 1], out, i + 1);
+		}
+		if (i < count) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i] + s_idOffset));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out->MessageId + i), a);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out->MessageData + i), _mm_unpackhi_epi64(a, a));
+			_decodeHeader(bufs[i], out, i);
+		}
+	}
+
+	int _deserialiseBatchSSE2(const char* const* bufs, int count, data::MessageBatch* out)
+	{
+		_decodeSSE2(bufs, 0, count, out);
+		return count;
+	}
+
+#ifndef _MSC_VER
+	__attribute__((target("avx2")))
+#endif
+	int _deserialiseBatchAVX2(const char* const* bufs, int count, data::MessageBatch* out)
+	{
+		using namespace data::wire;
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+			// lanes hold messages (i, i + 2) and (i + 1, i + 3), so unpack yields i..i+3 in order
+			__m256i ac = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i] + s_idOffset))),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i + 2] + s_idOffset)), 1);
+			__m256i bd = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i + 1] + s_idOffset))),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(bufs[i + 3] + s_idOffset)), 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out->MessageId + i), _mm256_unpacklo_epi64(ac, bd));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out->MessageData + i), _mm256_unpackhi_epi64(ac, bd));
+			for (int j = i; j < i + 4; ++j) {
+				_decodeHeader(bufs[j], out, j);
+			}
+		}
+		_decodeSSE2(bufs, i, count, out);
+		return count;
+	}
+
+	bool _hasAVX2()
+	{
+#ifdef _MSC_VER
+		int regs[4];
+		__cpuid(regs, 0);
+		if (regs[0] < 7) {
+			return false;
+		}
+		__cpuid(regs, 1);
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+			return false;
+		}
+		__cpuidex(regs, 7, 0);
+		return (regs[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+	struct DecoderChoice {
+		BatchDecoder m_func;
+		const char* m_name;
+	};
+
+	DecoderChoice _pickDecoder()
+	{
+#ifdef ATTO_X86_SIMD
+		if (_hasAVX2()) {
+			return { &_deserialiseBatchAVX2, "avx2" };
+		}
+		return { &_deserialiseBatchSSE2, "sse2" };
+#else
+		return { &data::DeserialiseBatchScalar, "scalar" };
+#endif
+	}
+
+	const DecoderChoice s_decoder = _pickDecoder();
+}
+
+int data::DeserialiseBatchScalar(const char* const* bufs, int count, MessageBatch* out)
+{
+	count = count > MessageBatch::s_capacity ? MessageBatch::s_capacity : count;
+	for (int i = 0; i < count; ++i) {
+		message_view v{ bufs[i] };
+		out->MessageId[i] = v.MessageId();
+		out->MessageData[i] = v.MessageData();
+		out->MessageSize[i] = v.MessageSize();
+		out->MessageType[i] = v.MessageType();
+	}
+	out->Count = count;
+	return count;
+}
+
+int data::DeserialiseBatch(const char* const* bufs, int count, MessageBatch* out)
 {
-	auto h = std::hash<unsigned long long>();
-	return h(_Keyval);
+	count = count > MessageBatch::s_capacity ? MessageBatch::s_capacity : count;
+	out->Count = s_decoder.m_func(bufs, count, out);
+	return out->Count;
 }
 
-size_t data::MessageHasher::operator()(const argument_type& _Keyval) const noexcept
+const char* data::BatchDecoderName()
 {
-	auto h = std::hash<decltype(_Keyval.MessageId)>();
-	return h(_Keyval.MessageId);
+	return s_decoder.m_name;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstring>
 #include <stdint.h>
 
 namespace data {
@@ -14,12 +15,154 @@ namespace data {
 		uint64_t MessageData;
 	};
 
-	// both functions assume that there is enough space in buffers
+	// packed wire layout, all fields are little endian
+	// | MessageSize u16 | MessageType u8 | MessageId u64 | MessageData u64 |
+	namespace wire {
+		constexpr int s_sizeOffset = 0;
+		constexpr int s_typeOffset = 2;
+		constexpr int s_idOffset = 3;
+		constexpr int s_dataOffset = 11;
+		constexpr int s_messageSize = 19;
+
+		// stream framing (TCP forward): | payload length u16 | payload |
+		// payload starts with a wire message, readers skip bytes past fields they know
+		constexpr int s_frameHeaderSize = 2;
+		constexpr int s_maxPayloadSize = 0xffff;
+		constexpr int s_frameSize = s_frameHeaderSize + s_messageSize;
+
+		// optional latency stamps (monotonic ns) appended to a wire message
+		// datagram: | wire message | send time u64 |
+		// frame payload: | wire message | send time u64 | forward time u64 |
+		constexpr int s_stampSize = 8;
+		constexpr int s_stampedMessageSize = s_messageSize + s_stampSize;
+		constexpr int s_stampedPayloadSize = s_messageSize + 2 * s_stampSize;
+		constexpr int s_stampedFrameSize = s_frameHeaderSize + s_stampedPayloadSize;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		inline uint16_t toLE(uint16_t v) { return __builtin_bswap16(v); }
+		inline uint32_t toLE(uint32_t v) { return __builtin_bswap32(v); }
+		inline uint64_t toLE(uint64_t v) { return __builtin_bswap64(v); }
+#else
+		inline uint16_t toLE(uint16_t v) { return v; }
+		inline uint32_t toLE(uint32_t v) { return v; }
+		inline uint64_t toLE(uint64_t v) { return v; }
+#endif
+
+		// memcpy with constant size compiles to a single unaligned load/store
+		template <typename T>
+		inline T load(const char* src)
+		{
+			T v;
+			memcpy(&v, src, sizeof(T));
+			return toLE(v);
+		}
+
+		template <typename T>
+		inline void store(char* dst, T v)
+		{
+			v = toLE(v);
+			memcpy(dst, &v, sizeof(T));
+		}
+
+		template <>
+		inline uint8_t load<uint8_t>(const char* src)
+		{
+			return static_cast<uint8_t>(*src);
+		}
+
+		template <>
+		inline void store<uint8_t>(char* dst, uint8_t v)
+		{
+			*dst = static_cast<char>(v);
+		}
+	}
+
+	// message with latency stamps, stamp is 0 when sender didn't stamp the message
+	struct stamped_message {
+		message Msg;
+		uint64_t SentNs;
+		uint64_t DedupNs;
+	};
+
+	// reads fields straight from a wire buffer, buffer has to outlive the view
+	class message_view {
+	public:
+		explicit message_view(const char* buf) : m_buf{ buf } {}
+
+		uint16_t MessageSize() const { return wire::load<uint16_t>(m_buf + wire::s_sizeOffset); }
+		uint8_t MessageType() const { return wire::load<uint8_t>(m_buf + wire::s_typeOffset); }
+		uint64_t MessageId() const { return wire::load<uint64_t>(m_buf + wire::s_idOffset); }
+		uint64_t MessageData() const { return wire::load<uint64_t>(m_buf + wire::s_dataOffset); }
+
+		message toMessage() const { return { MessageSize(), MessageType(), MessageId(), MessageData() }; }
+		const char* data() const { return m_buf; }
+
+	private:
+		const char* m_buf;
+	};
+
+	// both functions assume that there is enough space in buffers (wire::s_messageSize)
 	// and pointers are valid
-	void SerialiseMessage(char* outBuf, message* inMsg);
-	void DeserialiseMessage(char* inBuf, message* outMsg);
+	inline void SerialiseMessage(char* outBuf, const message* inMsg)
+	{
+		wire::store<uint16_t>(outBuf + wire::s_sizeOffset, inMsg->MessageSize);
+		wire::store<uint8_t>(outBuf + wire::s_typeOffset, inMsg->MessageType);
+		wire::store<uint64_t>(outBuf + wire::s_idOffset, inMsg->MessageId);
+		wire::store<uint64_t>(outBuf + wire::s_dataOffset, inMsg->MessageData);
+	}
+
+	inline void DeserialiseMessage(const char* inBuf, message* outMsg)
+	{
+		*outMsg = message_view{ inBuf }.toMessage();
+	}
+
+	// writes length prefixed message, returns number of bytes written (wire::s_frameSize)
+	inline int SerialiseFrame(char* outBuf, const message* inMsg)
+	{
+		wire::store<uint16_t>(outBuf, static_cast<uint16_t>(wire::s_messageSize));
+		SerialiseMessage(outBuf + wire::s_frameHeaderSize, inMsg);
+		return wire::s_frameSize;
+	}
+
+	// adds stamps to the payload, used when message carries send time,
+	// returns number of bytes written (wire::s_stampedFrameSize)
+	inline int SerialiseStampedFrame(char* outBuf, const message* inMsg, uint64_t sentNs, uint64_t forwardNs)
+	{
+		wire::store<uint16_t>(outBuf, static_cast<uint16_t>(wire::s_stampedPayloadSize));
+		char* payload = outBuf + wire::s_frameHeaderSize;
+		SerialiseMessage(payload, inMsg);
+		wire::store<uint64_t>(payload + wire::s_messageSize, sentNs);
+		wire::store<uint64_t>(payload + wire::s_messageSize + wire::s_stampSize, forwardNs);
+		return wire::s_stampedFrameSize;
+	}
+
 	std::string toString(const message& msg);
 
+	// same text as toString for LOG_* macros, fields are copied into the log record
+	// and formatted on logger thread, so logging a message doesn't build a string
+#define DATA_MSG_FMT "[Msg] Size: %u, Type: %u, Id: %llu, Data: %llu"
+#define DATA_MSG_ARGS(msg) (msg).MessageSize, (msg).MessageType, (msg).MessageId, (msg).MessageData
+
+	// structure of arrays for a batch of decoded messages,
+	// filters run over contiguous columns instead of message structs
+	struct MessageBatch {
+		static const int s_capacity = 64;
+
+		alignas(32) uint64_t MessageId[s_capacity];
+		alignas(32) uint64_t MessageData[s_capacity];
+		uint16_t MessageSize[s_capacity];
+		uint8_t MessageType[s_capacity];
+		int Count;
+
+		message get(int i) const { return { MessageSize[i], MessageType[i], MessageId[i], MessageData[i] }; }
+	};
+
+	// decodes up to MessageBatch::s_capacity wire messages, returns number of decoded messages
+	// implementation (avx2, sse2 or scalar) is picked once from cpu features
+	int DeserialiseBatch(const char* const* bufs, int count, MessageBatch* out);
+	int DeserialiseBatchScalar(const char* const* bufs, int count, MessageBatch* out);
+	const char* BatchDecoderName();
+
 	struct MessageKey {
 		using result_type = uint64_t;
 		using argument_type = message;
@@ -29,12 +172,30 @@ namespace data {
 		}
 	};
 
+	// std::hash on integers is identity, sequential ids would fill neighbour slots and
+	// share low bits, so id is mixed (murmur3 finalizer) to spread every input bit over the result
 	struct MessageHasher {
 		using result_type = size_t;
 		using argument_type = message;
 
-		size_t operator()(const uint64_t& _Keyval) const noexcept;
-		size_t operator()(const argument_type& _Keyval) const noexcept;
+		static inline uint64_t mix(uint64_t k) noexcept
+		{
+			k ^= k >> 33;
+			k *= 0xff51afd7ed558ccdull;
+			k ^= k >> 33;
+			k *= 0xc4ceb9fe1a85ec53ull;
+			k ^= k >> 33;
+			return k;
+		}
+
+		inline size_t operator()(const uint64_t& _Keyval) const noexcept
+		{
+			return static_cast<size_t>(mix(_Keyval));
+		}
+
+		inline size_t operator()(const argument_type& _Keyval) const noexcept
+		{
+			return static_cast<size_t>(mix(_Keyval.MessageId));
+		}
 	};
 }
-
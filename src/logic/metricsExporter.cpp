@@ -0,0 +1,189 @@
+#include "metricsExporter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "../utils/log.h"
+
+#ifdef __linux
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+#ifndef __linux
+	// without pipe stop() is noticed at most this late
+	const int s_sliceMs = 100;
+#endif
+}
+
+MetricsExporter::MetricsExporter(const utils::MetricsRegistry* registry)
+	:
+	m_registry{ registry },
+	m_periodSec{ 0 },
+	m_listenFd{ -1 },
+	m_wakeFd{ -1, -1 },
+	m_stopped{ false },
+	m_last{}
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+#ifdef __linux
+	if (m_listenFd != -1) {
+		close(m_listenFd);
+		unlink(m_socketPath.c_str());
+	}
+	for (int fd : m_wakeFd) {
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+#endif
+}
+
+bool MetricsExporter::init(int periodSec, const std::string& socketPath)
+{
+	m_periodSec = periodSec < 0 ? 0 : periodSec;
+#ifdef __linux
+	// stop() writes into pipe, so exporter sleeps in poll until next period
+	if (pipe2(m_wakeFd, O_NONBLOCK | O_CLOEXEC) < 0) {
+		LOG_ERROR("Failed to create stats wakeup pipe. Error: %d", errno);
+		return false;
+	}
+#endif
+	if (socketPath.empty()) {
+		return true;
+	}
+
+#ifdef __linux
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(addr.sun_path)) {
+		LOG_ERROR("Stats socket path %s is too long.", socketPath.c_str());
+		return false;
+	}
+	memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+
+	m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_listenFd == -1) {
+		LOG_ERROR("Failed to create stats socket. Error: %d", errno);
+		return false;
+	}
+	// socket file left by previous run would fail bind
+	unlink(socketPath.c_str());
+	if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(m_listenFd, 16) < 0) {
+		LOG_ERROR("Failed to bind stats socket %s. Error: %d", socketPath.c_str(), errno);
+		close(m_listenFd);
+		m_listenFd = -1;
+		return false;
+	}
+	m_socketPath = socketPath;
+	LOG_INFO("Stats are served on unix socket %s.", socketPath.c_str());
+	return true;
+#else
+	LOG_ERROR("Stats socket isn't supported on this platform.");
+	return false;
+#endif
+}
+
+void MetricsExporter::operator()()
+{
+	m_registry->snapshot(m_last);
+	Clock::time_point last = Clock::now();
+	Clock::time_point next = last + std::chrono::seconds(m_periodSec);
+
+	while (!m_stopped.load(std::memory_order_acquire)) {
+		int timeoutMs = -1;
+		if (m_periodSec > 0) {
+			const Clock::time_point now = Clock::now();
+			timeoutMs = next > now
+				? static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count()) + 1 : 0;
+		}
+
+#ifdef __linux
+		pollfd fds[2] = { { m_wakeFd[0], POLLIN, 0 }, { m_listenFd, POLLIN, 0 } };
+		if (poll(fds, m_listenFd != -1 ? 2 : 1, timeoutMs) > 0 && (fds[1].revents & POLLIN)) {
+			_serve();
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs < 0 || timeoutMs > s_sliceMs ? s_sliceMs : timeoutMs));
+#endif
+
+		const Clock::time_point now = Clock::now();
+		if (m_periodSec > 0 && now >= next) {
+			uint64_t values[utils::s_metricCount];
+			m_registry->snapshot(values);
+			_print(values, std::chrono::duration<double>(now - last).count());
+			memcpy(m_last, values, sizeof(values));
+			last = now;
+			next = now + std::chrono::seconds(m_periodSec);
+		}
+	}
+}
+
+void MetricsExporter::stop()
+{
+	m_stopped.store(true, std::memory_order_release);
+#ifdef __linux
+	if (m_wakeFd[1] != -1) {
+		const char one = 1;
+		ssize_t res = write(m_wakeFd[1], &one, 1);
+		(void)res;
+	}
+#endif
+}
+
+void MetricsExporter::_print(const uint64_t* values, double secs)
+{
+	using utils::Metric;
+	auto rate = [&](Metric m) {
+		const int i = static_cast<int>(m);
+		return static_cast<double>(values[i] - m_last[i]) / secs;
+	};
+
+	const uint64_t depth = values[static_cast<int>(Metric::ForwardQueueDepth)];
+	if (values[static_cast<int>(Metric::PacketsReceived)] == m_last[static_cast<int>(Metric::PacketsReceived)]
+		&& values[static_cast<int>(Metric::ForwardWrites)] == m_last[static_cast<int>(Metric::ForwardWrites)] && depth == 0) {
+		return;
+	}
+
+	LOG_INFO("Stats: %.0f packets/s, %.2f MB/s, %.0f duplicates/s, %.0f matches/s, %.0f handed over/s, "
+		"%.0f forwarded/s in %.0f writes/s, forward queue %llu.",
+		rate(Metric::PacketsReceived), rate(Metric::BytesReceived) / 1e6, rate(Metric::Duplicates),
+		rate(Metric::TargetMatches), rate(Metric::HandedOver), rate(Metric::ForwardedMessages),
+		rate(Metric::ForwardWrites), static_cast<unsigned long long>(depth));
+}
+
+void MetricsExporter::_serve()
+{
+#ifdef __linux
+	uint64_t values[utils::s_metricCount];
+	m_registry->snapshot(values);
+
+	std::string text;
+	for (int i = 0; i < utils::s_metricCount; ++i) {
+		char line[96];
+		snprintf(line, sizeof(line), "%s %llu\n", utils::metricName(static_cast<utils::Metric>(i)),
+			static_cast<unsigned long long>(values[i]));
+		text += line;
+	}
+
+	int fd = -1;
+	while ((fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC)) != -1) {
+		// snapshot is far below socket buffer, one send is enough
+		ssize_t res = send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+		(void)res;
+		close(fd);
+	}
+#endif
+}
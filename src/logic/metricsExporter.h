@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "../utils/metrics.h"
+
+// reads metrics registry from its own thread, so workers never wait for export
+// - every period prints rates to stdout, nothing while server is idle
+// - unix socket endpoint (linux) answers every connection with a snapshot,
+//   one "name value" line per metric, and closes it
+class MetricsExporter {
+public:
+	explicit MetricsExporter(const utils::MetricsRegistry* registry);
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	// periodSec 0 turns stdout export off, empty path turns endpoint off
+	bool init(int periodSec, const std::string& socketPath);
+	bool enabled() const { return m_periodSec > 0 || m_listenFd != -1; }
+
+	// runs until stop()
+	void operator()();
+	void stop();
+
+private:
+	void _print(const uint64_t* values, double secs);
+	void _serve();
+
+private:
+	const utils::MetricsRegistry* m_registry;
+	int m_periodSec;
+	std::string m_socketPath;
+	int m_listenFd;
+	int m_wakeFd[2];
+	std::atomic<bool> m_stopped;
+	uint64_t m_last[utils::s_metricCount];
+};
@@ -1,32 +1,104 @@
 #include "server.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <thread>
 #include <memory>
 
 #include "message.h"
 #include "../utils/log.h"
 #include "../socket/socket.h"
+#include "../socket/reactor.h"
 
 using SocPtr = std::unique_ptr<soc::Socket>;
+using Clock = std::chrono::steady_clock;
+
+// state of one shard, written only by its receiver thread
+struct Server::Shard {
+	cont::SlidingWindow m_sw;
+	// m_inbound[j] carries messages receiver j got for this shard, none from itself
+	std::vector<std::unique_ptr<HandoffRing>> m_inbound;
+	soc::Reactor* m_reactor;
+	char m_pad0[64];
+	// receiver is about to sleep in its reactor, producers have to wake it up
+	std::atomic<bool> m_idle;
+	char m_pad1[64];
+
+	Shard() : m_reactor{ nullptr }, m_idle{ false } {}
+};
+
+// last time receiver got a packet, on coarse clock, so stamping costs no clock call.
+// value is stored only once per clock tick, in between idle timer reads a clean line
+struct Server::Activity {
+	char m_pad0[64];
+	std::atomic<uint64_t> m_lastPacketNs;
+	char m_pad1[64];
+
+	Activity() : m_lastPacketNs{ utils::CoarseClock::nowNs() } {}
+
+	void touch()
+	{
+		const uint64_t now = utils::CoarseClock::nowNs();
+		if (m_lastPacketNs.load(std::memory_order_relaxed) != now) {
+			m_lastPacketNs.store(now, std::memory_order_relaxed);
+		}
+	}
+};
 
 struct Server::DataReceiver {
 	Server* m_server;
 	SocPtr m_soc;
+	soc::Reactor* m_reactor;
+	// sharded mode only
+	Shard* m_shard;
+	Activity* m_activity;
+	utils::MetricsSlot* m_metrics;
+	// latency from send to dedup of stamped messages, read after receiver is joined
+	utils::Histogram* m_wireLatency;
 	int m_id;
-
-	DataReceiver(Server* c, SocPtr ptr, int id);
+	bool m_sharedPort;
+	// counted in Server::m_idleReceivers
+	bool m_idle;
+	// messages for other shards grouped by shard, s_batchSize slots each
+	std::vector<data::stamped_message> m_outgoing;
+	std::vector<int> m_outCount;
+
+	DataReceiver(Server* c, SocPtr ptr, soc::Reactor* reactor, Shard* shard, int id, bool sharedPort);
 	DataReceiver(DataReceiver&& other) noexcept;
 	DataReceiver& operator=(DataReceiver&& other) noexcept;
 
 	DataReceiver(const DataReceiver&) = delete;
 	DataReceiver& operator=(const DataReceiver&) = delete;
 
+	// binds socket and registers it in reactor, runs before start barrier
+	bool prepare();
 	void operator()();
+
+	// reads everything available on the socket, called by reactor
+	void _drain();
+	// idle timer on reactor wheel, fires when silence would reach s_idleTimeoutSec
+	void _armIdle(uint64_t delayMs);
+	void _checkIdle();
+	void _onBatch(soc::Datagram* dgrams, int count);
+
+	// sharded mode, messages run to completion on the receiver of their shard
+	void _runSharded();
+	// sent holds send time of every message in batch, 0 if it isn't stamped
+	void _route(const data::MessageBatch& batch, const uint64_t* sent);
+	void _handOver(int shard, const data::stamped_message* msgs, int count);
+	void _drainInbound();
+	bool _hasInbound() const;
+	// dedup, store and forward of messages which belong to this shard
+	void _process(const data::stamped_message* msgs, int count);
+
+	static const int s_batchSize = 32;
 };
 
 struct Server::DataSender {
 	Server* m_server;
 	SocPtr m_soc;
+	utils::MetricsSlot* m_metrics;
 	int m_id;
 
 	DataSender(Server* s, SocPtr ptr, int id);
@@ -36,14 +108,49 @@ struct Server::DataSender {
 	DataSender(const DataSender&) = delete;
 	DataSender& operator=(const DataSender&) = delete;
 
+	// connects to listener, runs before start barrier
+	bool prepare();
+	// forwards until forward queue is stopped and drained
 	void operator()();
+
+	// frames messages into one buffer and writes it with one call, false if connection is lost
+	// stamped messages get forward time and their queue latency is recorded
+	bool _flush(const data::stamped_message* msgs, int count, char* buf);
+	void _logBatches() const;
+
+	// stop() of forward queue wakes sender, this only bounds one sleep
+	static const std::chrono::milliseconds s_idlePeriod;
+	// batch sizes are counted in power of two buckets: 1, 2-3, 4-7 ... 512-1023, 1024
+	static const int s_buckets = 11;
+
+	uint64_t m_batchSizes[s_buckets];
 };
 
+const std::chrono::milliseconds Server::DataSender::s_idlePeriod{ 100 };
+
+// writes retired pages into segment log, so receivers never wait for disk
+struct Server::PageFlusher {
+	Server* m_server;
+
+	explicit PageFlusher(Server* s);
+
+	void operator()();
+
+	void _flush(int tableIdx);
+
+	// messages are copied out of the table and appended in chunks
+	static const int s_chunkSize = 256;
+	// idle flusher reclaims tables and arrays readers have left this often
+	static const std::chrono::milliseconds s_collectPeriod;
+};
+
+const std::chrono::milliseconds Server::PageFlusher::s_collectPeriod{ 10 };
+
 
 Server::Server(int tv)
+	: m_idleReceivers{ 0 }, m_exporter{ &m_metrics }
 {
-	m_run = 0;
-	m_dupesDiscarded = 0;
+	m_forwardBatch = 1;
 	m_targetVal = tv;
 }
 
@@ -52,69 +159,218 @@ Server::~Server()
 	// cleanup resources
 }
 
-void Server::start(int numberOfReceivers)
+void Server::start(const Params& params)
 {
-	// create sliding window, basically array and init
-	if (!m_sw.init(16)) {
+	const int numberOfReceivers = params.m_numberOfReceivers;
+	LOG_INFO("Server starts %d receivers, %s%s.", numberOfReceivers, 
+		params.m_sharedPort ? "sharing one port" : "port per receiver", params.m_sharded ? ", sharded by message id" : "");
+
+	// create sliding window, ring bitmap of dedup window size
+	// sharded receivers have a window each and handoff ring from every other receiver
+	if (params.m_sharded) {
+		for (int i = 0; i < numberOfReceivers; ++i) {
+			m_shards.emplace_back(std::make_unique<Shard>());
+			Shard& shard = *m_shards.back();
+			if (!shard.m_sw.init(params.m_dedupWindow)) {
+				LOG_ERROR("Failed to initialize sliding window of shard %d, aborting.", i);
+				return;
+			}
+			shard.m_inbound.resize(numberOfReceivers);
+			for (int j = 0; j < numberOfReceivers; ++j) {
+				if (j == i) {
+					continue;
+				}
+				shard.m_inbound[j].reset(new HandoffRing{});
+				if (!shard.m_inbound[j]->init(s_handoffSize)) {
+					LOG_ERROR("Failed to initialize handoff ring %d -> %d, aborting.", j, i);
+					return;
+				}
+			}
+		}
+	}
+	else if (!m_sw.init(params.m_dedupWindow)) {
 		LOG_ERROR("Failed to initialize sliding window, aborting.");
 		return;
 	}
 	
 	// create message countainer with number of pages = threads * 2
-	if (!m_msgCont.init(numberOfReceivers, 1024)) {
+	// pages start small and grow online up to m_maxPageSize
+	// lookups go to one page: either the one id hash points to or the one secondary index remembers
+	// sharded mode needs page of receiver i to be the page ids of shard i hash to
+	const cont::Routing routing = params.m_routeByKey || params.m_sharded ? cont::Routing::ByKey : cont::Routing::ByPage;
+	if (!m_msgCont.init(numberOfReceivers, s_pageSize, params.m_maxPageSize, routing, s_indexSize)) {
 		LOG_ERROR("Failed to initialize message container, aborting.");
 		return;
 	}
 
+	// full pages are handed to flusher, their pair takes over until flush is done
+	if (!params.m_segmentDir.empty()) {
+		if (!m_log.init(params.m_segmentDir)) {
+			LOG_ERROR("Failed to initialize segment log in %s, aborting.", params.m_segmentDir.c_str());
+			return;
+		}
+		// every table may be in flight at once, so push never waits
+		if (!m_flushQueue.init(numberOfReceivers * 2, cont::FullPolicy::Backpressure)) {
+			LOG_ERROR("Failed to initialize flush queue, aborting.");
+			return;
+		}
+		m_msgCont.setRetireHandler([this](int tableIdx) {
+			m_flushQueue.push(tableIdx);
+		});
+	}
+
+	m_forwardBatch = params.m_forwardBatch < 1 ? 1
+		: params.m_forwardBatch > s_maxForwardBatch ? s_maxForwardBatch : params.m_forwardBatch;
+	m_forwardDeadline = std::chrono::microseconds{ params.m_forwardDeadlineUs < 0 ? 0 : params.m_forwardDeadlineUs };
+	if (!m_exporter.init(params.m_statsPeriodSec, params.m_statsSocket)) {
+		LOG_ERROR("Failed to initialize stats export, aborting.");
+		return;
+	}
+
+	if (!m_tcpQueue.init(s_forwardQueueSize,
+		params.m_forwardBackpressure ? cont::FullPolicy::Backpressure : cont::FullPolicy::Drop)) {
+		LOG_ERROR("Failed to initialize forward queue, aborting.");
+		return;
+	}
+
+	for (int i = 0; i < numberOfReceivers; ++i) {
+		m_wireLatency.emplace_back(std::make_unique<utils::Histogram>());
+		m_activity.emplace_back(std::make_unique<Activity>());
+	}
+	utils::CoarseClock::start();
+
+	// workers are spawned in shutdown order: receivers stop first, then forwarder and flusher
+	// drain what receivers have left in their queues
+	m_threads.setCpus(params.m_cpus);
+	for (int i = 0; i < numberOfReceivers; ++i) {
+
+		SocPtr ptr{ std::make_unique<soc::Socket>(
+			params.m_sharedPort ? soc::socUDPPortStart : soc::socUDPPortStart + i,
+			soc::SocketType::UDP,
+			soc::SocketRole::Listener) };
+		
+		m_reactors.emplace_back(std::make_unique<soc::Reactor>());
+		soc::Reactor* reactor = m_reactors.back().get();
+		if (!reactor->init()) {
+			LOG_ERROR("Failed to initialize reactor for receiver %d, aborting.", i);
+			return;
+		}
+		Shard* shard = nullptr;
+		if (params.m_sharded) {
+			shard = m_shards[i].get();
+			shard->m_reactor = reactor;
+		}
+		auto r = std::make_shared<DataReceiver>(this, std::move(ptr), reactor, shard, i, params.m_sharedPort);
+		m_threads.spawn("atto-recv-" + std::to_string(i),
+			[r]() { return r->prepare(); },
+			[r]() { (*r)(); },
+			[reactor]() { reactor->stop(); });
+	}
+
 	{
 		SocPtr ptr{ std::make_unique<soc::Socket>(
 			soc::socTCPPortStart,
 			soc::SocketType::TCP,
 			soc::SocketRole::Sender) };
-		std::thread t = std::thread(DataSender(this, std::move(ptr), 0));
-		t.detach();
+		auto s = std::make_shared<DataSender>(this, std::move(ptr), 0);
+		m_threads.spawn("atto-forward",
+			[s]() { return s->prepare(); },
+			[s]() { (*s)(); },
+			[this]() { m_tcpQueue.stop(); });
 	}
-	
-	for (int i = 0; i < numberOfReceivers; ++i) {
 
-		SocPtr ptr{ std::make_unique<soc::Socket>(
-			soc::socUDPPortStart + i,
-			soc::SocketType::UDP,
-			soc::SocketRole::Listener) };
-		std::thread t = std::thread(DataReceiver{ this, std::move(ptr), i });
-		t.detach();
+	if (!params.m_segmentDir.empty()) {
+		m_threads.spawn("atto-flush", nullptr, PageFlusher{ this }, [this]() { m_flushQueue.stop(); });
 	}
 
-	m_run = 1;
-	m_lastPacketTimestamp.reset();
-	while (true) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(5000));
-		if (m_lastPacketTimestamp.hasPassed<std::chrono::seconds>(10)) {
+	if (m_exporter.enabled()) {
+		m_threads.spawn("atto-stats", nullptr, [this]() { m_exporter(); }, [this]() { m_exporter.stop(); });
+	}
+
+	if (!m_threads.start()) {
+		LOG_ERROR("Failed to start workers, aborting.");
+		return;
+	}
+
+	// receivers detect idleness on their reactor timers, wait is bounded only because
+	// stop signals don't interrupt it
+	while (!utils::stopSignalled()) {
+		const uint32_t key = m_idleEvent.prepareWait();
+		if (m_idleReceivers.load(std::memory_order_acquire) == numberOfReceivers) {
+			m_idleEvent.cancelWait();
 			break;
 		}
+		m_idleEvent.wait(key, std::chrono::milliseconds(100));
 	}
-	m_run = 0;
+
 	LOG_INFO("Shutdown server.");
-	LOG_INFO("Duplicates discarded: %d.", m_dupesDiscarded);
+	m_threads.stop();
+	LOG_INFO("Received %llu packets, %llu bytes.", static_cast<unsigned long long>(m_metrics.read(utils::Metric::PacketsReceived)),
+		static_cast<unsigned long long>(m_metrics.read(utils::Metric::BytesReceived)));
+	LOG_INFO("Duplicates discarded: %llu.", static_cast<unsigned long long>(m_metrics.read(utils::Metric::Duplicates)));
+	uint64_t farRejected = m_sw.farRejected();
+	if (!m_shards.empty()) {
+		LOG_INFO("Shards handed over %llu messages.", static_cast<unsigned long long>(m_metrics.read(utils::Metric::HandedOver)));
+		for (auto& shard : m_shards) {
+			farRejected += shard->m_sw.farRejected();
+		}
+	}
+	if (farRejected > 0) {
+		LOG_INFO("Ids far ahead of dedup window discarded: %llu.", static_cast<unsigned long long>(farRejected));
+	}
 
+	// only stamped messages are recorded, see AttoUDPSend -ts
+	utils::Histogram wireLatency;
+	for (auto& h : m_wireLatency) {
+		wireLatency.merge(*h);
+	}
+	if (wireLatency.count() > 0) {
+		LOG_INFO("Latency send to dedup: %s.", wireLatency.describe().c_str());
+	}
+	if (m_queueLatency.count() > 0) {
+		LOG_INFO("Latency dedup to forward: %s.", m_queueLatency.describe().c_str());
+	}
 
-	auto msg = m_msgCont.get(122);
-	m_msgCont.remove(*msg);
-	msg = m_msgCont.get(122);
-	
-	
-	std::this_thread::sleep_for(std::chrono::seconds(10));
-}
+	if (m_tcpQueue.dropped() > 0) {
+		LOG_INFO("Forward queue was full, %llu messages weren't forwarded.",
+			static_cast<unsigned long long>(m_tcpQueue.dropped()));
+	}
 
+	if (!params.m_segmentDir.empty()) {
+		LOG_INFO("Segment log holds %llu messages in %d segments.",
+			static_cast<unsigned long long>(m_log.messageCount()), m_log.segmentCount());
+	}
+
+	{
+		sync::EpochGuard guard{ m_msgCont.epoch() };
+		const data::message* msg = m_msgCont.get(122, guard);
+		if (msg) {
+			// pointer stays valid under the guard even after remove
+			const data::message found = *msg;
+			m_msgCont.remove(found);
+			LOG_INFO("Message 122 removed from store: " DATA_MSG_FMT, DATA_MSG_ARGS(found));
+		}
+		else {
+			data::message flushed;
+			if (m_log.get(122, &flushed)) {
+				LOG_INFO("Message 122 is in segment log: " DATA_MSG_FMT, DATA_MSG_ARGS(flushed));
+			}
+		}
+	}
+}
 
 // Data Receiver
-Server::DataReceiver::DataReceiver(Server* c, SocPtr ptr, int id)
-	: m_server{c}, m_soc{std::move(ptr)}, m_id{id}
+Server::DataReceiver::DataReceiver(Server* c, SocPtr ptr, soc::Reactor* reactor, Shard* shard, int id, bool sharedPort)
+	: m_server{c}, m_soc{std::move(ptr)}, m_reactor{reactor}, m_shard{shard}, m_activity{c->m_activity[id].get()}, m_metrics{nullptr}, m_wireLatency{c->m_wireLatency[id].get()}, m_id{id}, m_sharedPort{sharedPort}, m_idle{false}
 {
+	if (m_shard) {
+		m_outgoing.resize(c->m_shards.size() * s_batchSize);
+		m_outCount.resize(c->m_shards.size(), 0);
+	}
 }
 
 Server::DataReceiver::DataReceiver(DataReceiver&& other) noexcept
-	: m_server{nullptr}, m_id {0}
+	: m_server{nullptr}, m_reactor{nullptr}, m_shard{nullptr}, m_activity{nullptr}, m_metrics{nullptr}, m_wireLatency{nullptr}, m_id {0}, m_sharedPort{false}, m_idle{false}
 {
 	this->operator=(std::move(other));
 }
@@ -124,67 +380,330 @@ Server::DataReceiver& Server::DataReceiver::operator=(DataReceiver&& other) noex
 	m_server = other.m_server;
 	other.m_server = nullptr;
 	m_soc = std::move(other.m_soc);
+	m_reactor = other.m_reactor;
+	other.m_reactor = nullptr;
+	m_shard = other.m_shard;
+	other.m_shard = nullptr;
+	m_activity = other.m_activity;
+	other.m_activity = nullptr;
+	m_metrics = other.m_metrics;
+	other.m_metrics = nullptr;
+	m_wireLatency = other.m_wireLatency;
+	other.m_wireLatency = nullptr;
 	m_id = other.m_id;
+	m_sharedPort = other.m_sharedPort;
+	m_idle = other.m_idle;
+	m_outgoing = std::move(other.m_outgoing);
+	m_outCount = std::move(other.m_outCount);
 	return *this;
 }
 
+bool Server::DataReceiver::prepare()
+{
+	m_metrics = m_server->m_metrics.registerThread();
+	if (!m_metrics) {
+		LOG_ERROR("No metrics slot left for receiver %d.", m_id);
+		return false;
+	}
+	if (!m_soc->init() || (m_sharedPort && !m_soc->setReusePort()) || !m_soc->bind()) {
+		return false;
+	}
+	LOG_INFO("Receiver %d decodes batches with %s.", m_id, data::BatchDecoderName());
+	return m_reactor->add(m_soc.get(), soc::EvRead, [this](unsigned int) { _drain(); });
+}
+
 void Server::DataReceiver::operator()()
 {
-	if (!m_soc->init() || !m_soc->bind()) {
+	// timers are registered from the loop thread
+	m_activity->touch();
+	_armIdle(static_cast<uint64_t>(s_idleTimeoutSec) * 1000u);
+	if (m_shard) {
+		_runSharded();
+	}
+	else {
+		m_reactor->run();
+	}
+	m_reactor->remove(m_soc.get());
+}
+
+void Server::DataReceiver::_armIdle(uint64_t delayMs)
+{
+	m_reactor->timers().schedule(delayMs, [this]() { _checkIdle(); });
+}
+
+void Server::DataReceiver::_checkIdle()
+{
+	const uint64_t timeoutMs = static_cast<uint64_t>(s_idleTimeoutSec) * 1000u;
+	const uint64_t now = utils::CoarseClock::nowNs();
+	const uint64_t last = m_activity->m_lastPacketNs.load(std::memory_order_relaxed);
+	const uint64_t quietMs = now > last ? (now - last) / 1000000u : 0u;
+	if (quietMs < timeoutMs) {
+		if (m_idle) {
+			m_idle = false;
+			m_server->m_idleReceivers.fetch_sub(1, std::memory_order_relaxed);
+		}
+		_armIdle(timeoutMs - quietMs);
 		return;
 	}
 
-	while (!m_server->m_run) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	if (!m_idle) {
+		m_idle = true;
+		m_server->m_idleReceivers.fetch_add(1, std::memory_order_release);
+		m_server->m_idleEvent.notify();
 	}
+	// others may still be busy, so traffic can come back before the server stops
+	_armIdle(s_idleRecheckMs);
+}
 
-	while (true) {
-		if (!m_server->m_run) {
+void Server::DataReceiver::_drain()
+{
+	char buffers[s_batchSize][64];
+	soc::Datagram dgrams[s_batchSize];
+	for (int i = 0; i < s_batchSize; ++i) {
+		dgrams[i] = { buffers[i], 64, 0 };
+	}
+
+	while (m_server->m_threads.running()) {
+		int received = m_soc->receiveBatch(dgrams, s_batchSize, 0);
+		if (received <= 0) {
 			return;
 		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < received; ++i) {
+			bytes += static_cast<uint64_t>(dgrams[i].m_received);
+		}
+		m_metrics->add(utils::Metric::PacketsReceived, received);
+		m_metrics->add(utils::Metric::BytesReceived, bytes);
+		m_activity->touch();
+		_onBatch(dgrams, received);
+	}
+}
 
-		char buffer[64];
-		int received = m_soc->receive(buffer, 64);
-		if (received < 0) {
-			return;
+void Server::DataReceiver::_onBatch(soc::Datagram* dgrams, int count)
+{
+	const char* bufs[s_batchSize];
+	// send time of stamped datagrams, 0 otherwise
+	uint64_t sent[s_batchSize];
+	bool stamped = false;
+	int valid = 0;
+	for (int i = 0; i < count; ++i) {
+		if (dgrams[i].m_received >= data::wire::s_messageSize) {
+			sent[valid] = dgrams[i].m_received >= data::wire::s_stampedMessageSize
+				? data::wire::load<uint64_t>(dgrams[i].m_buf + data::wire::s_messageSize) : 0u;
+			stamped = stamped || sent[valid] != 0;
+			bufs[valid++] = dgrams[i].m_buf;
 		}
-		else if (received == 0) {
+	}
+
+	data::MessageBatch batch;
+	data::DeserialiseBatch(bufs, valid, &batch);
+
+	if (m_shard) {
+		_route(batch, sent);
+		return;
+	}
+
+	// dedup runs over id column, unique messages are compacted to the front
+	data::message msgs[s_batchSize];
+	bool isUnique[s_batchSize];
+	int unique = 0;
+	for (int i = 0; i < batch.Count; ++i) {
+		isUnique[i] = m_server->m_sw.insert(batch.MessageId[i]);
+		if (isUnique[i]) {
+			msgs[unique++] = batch.get(i);
+		}
+	}
+
+	if (unique != batch.Count) {
+		m_metrics->add(utils::Metric::Duplicates, batch.Count - unique);
+	}
+	if (unique == 0) {
+		return;
+	}
+
+	const uint64_t dedupNs = stamped ? utils::monotonicNs() : 0u;
+	if (stamped) {
+		for (int i = 0; i < batch.Count; ++i) {
+			if (isUnique[i] && sent[i] != 0) {
+				m_wireLatency->record(dedupNs > sent[i] ? dedupNs - sent[i] : 0u);
+			}
+		}
+	}
+
+	LOG_DEBUG("Received batch of %d packets, unique: %d, threadId: %d", count, unique, m_id);
+	for (int i = 0; i < unique; ++i) {
+		LOG_DEBUG(DATA_MSG_FMT, DATA_MSG_ARGS(msgs[i]));
+	}
+
+	m_server->m_msgCont.insertBatch(m_id, msgs, unique);
+
+	// target filter runs over data column
+	data::stamped_message fwd[s_batchSize];
+	int matched = 0;
+	const uint64_t target = static_cast<uint64_t>(m_server->m_targetVal);
+	for (int i = 0; i < batch.Count; ++i) {
+		if (isUnique[i] && batch.MessageData[i] == target) {
+			fwd[matched++] = { batch.get(i), sent[i], sent[i] != 0 ? dedupNs : 0u };
+		}
+	}
+
+	if (matched == 0) {
+		return;
+	}
+
+	m_metrics->add(utils::Metric::TargetMatches, matched);
+	m_server->m_tcpQueue.push(fwd, matched);
+}
+
+void Server::DataReceiver::_runSharded()
+{
+	Shard& me = *m_shard;
+	while (m_server->m_threads.running()) {
+		_drainInbound();
+
+		// pairs with fence in _handOver: either producer sees us idle or we see its values
+		me.m_idle.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const bool pending = _hasInbound();
+		if (pending) {
+			me.m_idle.store(false, std::memory_order_relaxed);
+		}
+		if (m_reactor->poll(pending ? 0 : -1) < 0) {
+			break;
+		}
+		me.m_idle.store(false, std::memory_order_relaxed);
+	}
+}
+
+void Server::DataReceiver::_route(const data::MessageBatch& batch, const uint64_t* sent)
+{
+	data::stamped_message local[s_batchSize];
+	int localCount = 0;
+	std::fill(m_outCount.begin(), m_outCount.end(), 0);
+
+	for (int i = 0; i < batch.Count; ++i) {
+		const int shard = m_server->m_msgCont.pageOfKey(batch.MessageId[i]);
+		const data::stamped_message msg{ batch.get(i), sent[i], 0u };
+		if (shard == m_id) {
+			local[localCount++] = msg;
+		}
+		else {
+			m_outgoing[shard * s_batchSize + m_outCount[shard]++] = msg;
+		}
+	}
+
+	for (int shard = 0; shard < static_cast<int>(m_outCount.size()); ++shard) {
+		if (m_outCount[shard] > 0) {
+			_handOver(shard, &m_outgoing[shard * s_batchSize], m_outCount[shard]);
+		}
+	}
+	if (localCount > 0) {
+		_process(local, localCount);
+	}
+}
+
+void Server::DataReceiver::_handOver(int shard, const data::stamped_message* msgs, int count)
+{
+	Shard& to = *m_server->m_shards[shard];
+	HandoffRing& ring = *to.m_inbound[m_id];
+	int pushed = 0;
+	while (true) {
+		pushed += ring.push(msgs + pushed, count - pushed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (to.m_idle.load(std::memory_order_relaxed)) {
+			to.m_reactor->wakeup();
+		}
+		if (pushed == count || !m_server->m_threads.running()) {
+			break;
+		}
+		// owner is behind, take what others handed to us meanwhile, so two shards
+		// waiting for each other still make progress
+		_drainInbound();
+		std::this_thread::yield();
+	}
+	m_metrics->add(utils::Metric::HandedOver, pushed);
+}
+
+void Server::DataReceiver::_drainInbound()
+{
+	data::stamped_message msgs[s_batchSize];
+	for (auto& ring : m_shard->m_inbound) {
+		if (!ring) {
 			continue;
 		}
-		
-		data::message msg{};
-		data::DeserialiseMessage(buffer, &msg);
-
-		{
-			sync::lock_guard lock{ m_server->m_slidingWindowLock };
-			if (!m_server->m_sw.insert(msg.MessageId)) {
-				m_server->m_dupesDiscarded++;
-				continue;
+		int n = 0;
+		while ((n = ring->pop(msgs, s_batchSize)) > 0) {
+			_process(msgs, n);
+		}
+	}
+}
+
+bool Server::DataReceiver::_hasInbound() const
+{
+	for (auto& ring : m_shard->m_inbound) {
+		if (ring && !ring->empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Server::DataReceiver::_process(const data::stamped_message* msgs, int count)
+{
+	Shard& me = *m_shard;
+	data::stamped_message unique[s_batchSize];
+	data::message store[s_batchSize];
+	bool stamped = false;
+	int uniqueCount = 0;
+	for (int i = 0; i < count; ++i) {
+		if (me.m_sw.insert(msgs[i].Msg.MessageId)) {
+			stamped = stamped || msgs[i].SentNs != 0;
+			store[uniqueCount] = msgs[i].Msg;
+			unique[uniqueCount++] = msgs[i];
+		}
+	}
+
+	if (uniqueCount != count) {
+		m_metrics->add(utils::Metric::Duplicates, count - uniqueCount);
+	}
+	if (uniqueCount == 0) {
+		return;
+	}
+
+	if (stamped) {
+		const uint64_t dedupNs = utils::monotonicNs();
+		for (int i = 0; i < uniqueCount; ++i) {
+			if (unique[i].SentNs != 0) {
+				unique[i].DedupNs = dedupNs;
+				m_wireLatency->record(dedupNs > unique[i].SentNs ? dedupNs - unique[i].SentNs : 0u);
 			}
 		}
+	}
 
-		std::string smsg{ data::toString(msg) };
-		LOG_DEBUG("Received packet size: %d, threadId: %d", received, m_id);
-		LOG_DEBUG("%s", smsg.c_str());
-		
-		m_server->m_msgCont.insert(m_id, msg);
-		m_server->m_lastPacketTimestamp.reset();
+	// every id here hashes to page m_id, so no other receiver takes its lock
+	m_server->m_msgCont.insertBatch(m_id, store, uniqueCount);
 
-		if (msg.MessageData == m_server->m_targetVal) {
-			sync::lock_guard lock{ m_server->m_tcpQueueLock };
-			m_server->m_tcpQueue.push(msg);
+	int matched = 0;
+	const uint64_t target = static_cast<uint64_t>(m_server->m_targetVal);
+	for (int i = 0; i < uniqueCount; ++i) {
+		if (unique[i].Msg.MessageData == target) {
+			unique[matched++] = unique[i];
 		}
 	}
+	if (matched > 0) {
+		m_metrics->add(utils::Metric::TargetMatches, matched);
+		m_server->m_tcpQueue.push(unique, matched);
+	}
 }
 
 // Data Sender
 Server::DataSender::DataSender(Server* s, SocPtr ptr, int id)
-	:m_server{ s }, m_soc{std::move(ptr)}, m_id{id}
+	:m_server{ s }, m_soc{std::move(ptr)}, m_metrics{nullptr}, m_id{id}, m_batchSizes{}
 {
 }
 
 Server::DataSender::DataSender(Server::DataSender&& other) noexcept
-	:m_server{nullptr}, m_id{0}
+	:m_server{nullptr}, m_metrics{nullptr}, m_id{0}, m_batchSizes{}
 {
 	this->operator=(std::move(other));
 }
@@ -194,47 +713,174 @@ Server::DataSender& Server::DataSender::operator=(Server::DataSender&& other) no
 	m_server = other.m_server;
 	other.m_server = nullptr;
 	m_soc = std::move(other.m_soc);
+	m_metrics = other.m_metrics;
+	other.m_metrics = nullptr;
 	m_id = other.m_id;
+	std::copy(other.m_batchSizes, other.m_batchSizes + s_buckets, m_batchSizes);
 	return *this;
 }
 
-void Server::DataSender::operator()()
+bool Server::DataSender::prepare()
 {
-	if (!m_soc->init() || !m_soc->connect()) {
-		return;
+	m_metrics = m_server->m_metrics.registerThread();
+	if (!m_metrics) {
+		LOG_ERROR("No metrics slot left for TCP sender.");
+		return false;
 	}
+	return m_soc->init() && m_soc->connect();
+}
 
-	while (!m_server->m_run) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
-	}
+void Server::DataSender::operator()()
+{
+	const int batch = m_server->m_forwardBatch;
+	const std::chrono::microseconds deadline = m_server->m_forwardDeadline;
 
-	data::message msg{};
+	data::stamped_message msgs[s_maxForwardBatch];
+	std::vector<char> buf(s_maxForwardBatch * data::wire::s_stampedFrameSize);
+	int pending = 0;
+	Clock::time_point flushAt;
 
 	while (true) {
-		if (!m_server->m_run) {
-			m_soc->shutdown();
-			return;
+		// partial batch waits only until its deadline
+		Clock::duration timeout = s_idlePeriod;
+		if (pending > 0) {
+			const Clock::time_point now = Clock::now();
+			timeout = flushAt > now ? flushAt - now : Clock::duration::zero();
 		}
 
-		{
-			sync::lock_guard lock{ m_server->m_tcpQueueLock };
-			if (m_server->m_tcpQueue.empty()) {
-				continue;
+		const int count = pending > 0 && timeout == Clock::duration::zero()
+			? m_server->m_tcpQueue.pop(msgs + pending, batch - pending)
+			: m_server->m_tcpQueue.popWait(msgs + pending, batch - pending, timeout);
+		if (pending == 0 && count > 0) {
+			flushAt = Clock::now() + deadline;
+		}
+		pending += count;
+		m_metrics->set(utils::Metric::ForwardQueueDepth, m_server->m_tcpQueue.size());
+
+		// what is left goes out before connection is closed
+		const bool stopped = count == 0 && m_server->m_tcpQueue.stopped() && m_server->m_tcpQueue.empty();
+		if (pending == batch || (pending > 0 && (stopped || Clock::now() >= flushAt))) {
+			if (!_flush(msgs, pending, buf.data())) {
+				// receivers must not wait for space nobody frees
+				m_server->m_tcpQueue.stop();
+				break;
 			}
-			msg = m_server->m_tcpQueue.pop();
+			pending = 0;
+		}
+		if (stopped) {
+			break;
+		}
+	}
+	_logBatches();
+	m_soc->shutdown();
+}
+
+bool Server::DataSender::_flush(const data::stamped_message* msgs, int count, char* buf)
+{
+	if (count == 0) {
+		return true;
+	}
+
+	char* out = buf;
+	uint64_t forwardNs = 0;
+	for (int i = 0; i < count; ++i) {
+		if (msgs[i].SentNs == 0) {
+			out += data::SerialiseFrame(out, &msgs[i].Msg);
+		}
+		else {
+			forwardNs = forwardNs ? forwardNs : utils::monotonicNs();
+			m_server->m_queueLatency.record(forwardNs > msgs[i].DedupNs ? forwardNs - msgs[i].DedupNs : 0u);
+			out += data::SerialiseStampedFrame(out, &msgs[i].Msg, msgs[i].SentNs, forwardNs);
 		}
+		LOG_DEBUG("Sending message: " DATA_MSG_FMT, DATA_MSG_ARGS(msgs[i].Msg));
+	}
+
+	const int size = static_cast<int>(out - buf);
+	if (m_soc->sendStream(buf, size) != size) {
+		return false;
+	}
+
+	int bucket = 0;
+	while ((2 << bucket) <= count && bucket + 1 < s_buckets) {
+		++bucket;
+	}
+	m_batchSizes[bucket]++;
+	m_metrics->add(utils::Metric::ForwardWrites, 1);
+	m_metrics->add(utils::Metric::ForwardedMessages, count);
+	return true;
+}
 
+void Server::DataSender::_logBatches() const
+{
+	const uint64_t writes = m_metrics->get(utils::Metric::ForwardWrites);
+	const uint64_t forwarded = m_metrics->get(utils::Metric::ForwardedMessages);
+	if (writes == 0) {
+		return;
+	}
+
+	LOG_INFO("Forwarded %llu messages with %llu writes, %.1f messages per write.",
+		static_cast<unsigned long long>(forwarded), static_cast<unsigned long long>(writes),
+		static_cast<double>(forwarded) / writes);
+	std::string sizes;
+	for (int i = 0; i < s_buckets; ++i) {
+		if (m_batchSizes[i] == 0) {
+			continue;
+		}
+		char entry[64];
+		snprintf(entry, sizeof(entry), " %d+: %llu", 1 << i, static_cast<unsigned long long>(m_batchSizes[i]));
+		sizes += entry;
+	}
+	LOG_INFO("Forward batch sizes:%s", sizes.c_str());
+}
 
-		char buff[sizeof(data::message)];
-		data::SerialiseMessage(buff, &msg);
+// Page Flusher
+Server::PageFlusher::PageFlusher(Server* s)
+	: m_server{ s }
+{
+}
 
-		int result = m_soc->send(buff, sizeof(data::message));
-		if (result <= 0) {
-			m_soc->shutdown();
+void Server::PageFlusher::operator()()
+{
+	Server& s = *m_server;
+	while (true) {
+		int tableIdx = 0;
+		if (s.m_flushQueue.popWait(&tableIdx, 1, s_collectPeriod) == 1) {
+			_flush(tableIdx);
+		}
+		// queue is drained before stop
+		else if (s.m_flushQueue.stopped()) {
 			return;
 		}
+		// tables released while readers held them are cleared here, so ingest finds them free
+		s.m_msgCont.collect();
+	}
+}
 
-		std::string smsg{ data::toString(msg) };
-		LOG_DEBUG("Sending message: %s", smsg.c_str());
+void Server::PageFlusher::_flush(int tableIdx)
+{
+	Server& s = *m_server;
+	data::message chunk[s_chunkSize];
+	int n = 0;
+	bool ok = true;
+	int total = 0;
+
+	s.m_msgCont.table(tableIdx).forEach([&](const data::message& msg) {
+		chunk[n++] = msg;
+		if (n == s_chunkSize) {
+			ok = s.m_log.append(chunk, n) && ok;
+			total += n;
+			n = 0;
+		}
+	});
+	if (n > 0) {
+		ok = s.m_log.append(chunk, n) && ok;
+		total += n;
 	}
-}
\ No newline at end of file
+
+	if (!ok) {
+		LOG_ERROR("Page %d wasn't fully written to segment log, messages are lost.", tableIdx);
+	}
+	LOG_DEBUG("Flushed page %d, %d messages.", tableIdx, total);
+	// pair page may switch back to this table only now
+	s.m_msgCont.release(tableIdx);
+}
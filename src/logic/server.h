@@ -2,43 +2,129 @@
 
 #include <cstring>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
 #include "message.h"
+#include "metricsExporter.h"
 
 
-#include "../containers/slidingWindow.h"
+#include "../containers/concurrentSlidingWindow.h"
 #include "../containers/pagedTable.h"
-#include "../containers/queue.h"
+#include "../containers/mpscRing.h"
+#include "../containers/slidingWindow.h"
+#include "../containers/spscRing.h"
+#include "../storage/segmentLog.h"
+#include "../utils/eventCount.h"
+#include "../utils/histogram.h"
+#include "../utils/metrics.h"
 #include "../utils/spinlock.h"
+#include "../utils/threadGroup.h"
 #include "../utils/timer.h"
 
+namespace soc {
+	class Reactor;
+}
+
 class Server {
 public:
+	struct Params {
+		int m_numberOfReceivers;
+		// all receivers bind socUDPPortStart with SO_REUSEPORT instead of a port per receiver
+		bool m_sharedPort;
+		// workers are pinned in order: receivers, forwarder, flusher; empty disables pinning
+		std::vector<int> m_cpus;
+		// number of latest ids the duplicate filter remembers, rounded up to power of two
+		int m_dedupWindow;
+		// message store page is picked by id hash, otherwise by receiver with secondary index
+		bool m_routeByKey;
+		// upper limit of page growth, full page is flushed to segment log
+		int m_maxPageSize;
+		// directory of segment log, empty drops full pages instead
+		std::string m_segmentDir;
+		// receivers wait when forward queue is full, otherwise messages are dropped
+		bool m_forwardBackpressure;
+		// forwarder writes up to m_forwardBatch messages with one send, partial batch goes
+		// out when its first message has waited m_forwardDeadlineUs
+		int m_forwardBatch;
+		int m_forwardDeadlineUs;
+		// receiver i owns dedup shard and store page i, message goes to shard its id hashes to,
+		// receivers hand over foreign messages through SPSC rings
+		bool m_sharded;
+		// stats are printed every m_statsPeriodSec (0 disables) and served on unix socket
+		// m_statsSocket (empty disables)
+		int m_statsPeriodSec;
+		std::string m_statsSocket;
+	};
+
 	Server(int tv);
 	~Server();
 
-	void start(int numberOfReceivers);
+	void start(const Params& params);
 
 	using SLock = sync::spinlock;
 	using MsgId = data::MsgId;
-	using SW = cont::SlidingWindow;
+	using SW = cont::ConcurrentSlidingWindow;
 	using MsgCont = cont::PagedTable<data::message, MsgId, data::MessageHasher, data::MessageKey, std::equal_to<MsgId>>;
-	using Queue = cont::Queue<data::message>;
-	using Timer = utils::Timer;
+	using ForwardQueue = cont::MpscRing<data::stamped_message>;
+	using PageQueue = cont::MpscRing<int>;
+	using HandoffRing = cont::SpscRing<data::stamped_message>;
+
+	static const int s_pageSize = 1024;
+	static const int s_maxPageSize = 1 << 20;
+	// secondary index slots, used when pages are picked by receiver
+	static const int s_indexSize = 1 << 20;
+	// messages waiting for TCP forwarder
+	static const int s_forwardQueueSize = 1 << 16;
+	static const int s_maxForwardBatch = 1024;
+	// messages one shard may have in flight to another
+	static const int s_handoffSize = 1 << 12;
+	// server stops when no packet came for this long
+	static const int s_idleTimeoutSec = 10;
+	// quiet receiver checks this often whether traffic came back
+	static const int s_idleRecheckMs = 100;
 private:
 	struct DataReceiver;
 	struct DataSender;
+	struct PageFlusher;
+	struct Shard;
+	struct Activity;
 
 private:
-	int m_run;
-	SLock m_slidingWindowLock;
+	// one event loop per receiver, receivers sleep in epoll while idle
+	std::vector<std::unique_ptr<soc::Reactor>> m_reactors;
+	// receivers call it concurrently, no lock
 	SW m_sw;
+	// sharded mode only, one per receiver
+	std::vector<std::unique_ptr<Shard>> m_shards;
 	
 	MsgCont m_msgCont;
 
+	// full pages go to flusher thread, which writes them into m_log and releases them
+	storage::SegmentLog m_log;
+	PageQueue m_flushQueue;
+
 	int m_targetVal;
-	SLock m_tcpQueueLock;
-	Queue m_tcpQueue;
+	// receivers push matched messages, TCP sender sleeps until there are some
+	ForwardQueue m_tcpQueue;
+	int m_forwardBatch;
+	std::chrono::microseconds m_forwardDeadline;
 	
-	int m_dupesDiscarded;
-	Timer m_lastPacketTimestamp;
+	// one per receiver, it stamps its own line and idle timer of the receiver reads it
+	std::vector<std::unique_ptr<Activity>> m_activity;
+	// receivers which are quiet for s_idleTimeoutSec, main thread waits until all are
+	std::atomic<int> m_idleReceivers;
+	sync::EventCount m_idleEvent;
+
+	// every worker writes its own slot, exporter sums them
+	utils::MetricsRegistry m_metrics;
+	MetricsExporter m_exporter;
+	// one writer each: receiver i and forwarder
+	std::vector<std::unique_ptr<utils::Histogram>> m_wireLatency;
+	utils::Histogram m_queueLatency;
+
+	// last member, workers are stopped before anything they use is destroyed
+	utils::ThreadGroup m_threads;
 };
\ No newline at end of file
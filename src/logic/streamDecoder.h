@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "message.h"
+
+namespace data {
+
+	// splits a byte stream into length prefixed frames (see wire::s_frameHeaderSize)
+	// caller receives straight into writePtr() and commits received bytes, complete frames
+	// are handed out in place, only the unfinished tail of a read is moved to buffer start
+	// and only when the buffer can't take a whole frame behind it any more
+	class StreamDecoder
+	{
+	public:
+		// buffer holds at least two max frames, so a partial frame never blocks the reader
+		static const int s_minBufferSize = 2 * (wire::s_frameHeaderSize + wire::s_maxPayloadSize);
+
+	public:
+		StreamDecoder()
+			:
+			m_begin{ 0 },
+			m_end{ 0 },
+			m_minPayload{ wire::s_messageSize },
+			m_broken{ false }
+		{}
+
+		// payloads shorter than minPayload mark stream as broken
+		void init(int bufferSize = s_minBufferSize, int minPayload = wire::s_messageSize)
+		{
+			m_buf.resize(bufferSize < s_minBufferSize ? s_minBufferSize : bufferSize);
+			m_begin = 0;
+			m_end = 0;
+			m_minPayload = minPayload;
+			m_broken = false;
+		}
+
+		char* writePtr() { return m_buf.data() + m_end; }
+		int writeSpace() const { return static_cast<int>(m_buf.size()) - m_end; }
+
+		// takes count bytes written at writePtr(), calls f(const char* payload, int length)
+		// for every complete frame, returns number of frames or -1 once stream is broken
+		template <typename Func>
+		int commit(int count, Func&& f)
+		{
+			if (m_broken) {
+				return -1;
+			}
+			m_end += count;
+
+			int frames = 0;
+			while (m_end - m_begin >= wire::s_frameHeaderSize) {
+				const char* frame = m_buf.data() + m_begin;
+				const int length = wire::load<uint16_t>(frame);
+				if (length < m_minPayload) {
+					m_broken = true;
+					return -1;
+				}
+				if (m_end - m_begin < wire::s_frameHeaderSize + length) {
+					break;
+				}
+				f(frame + wire::s_frameHeaderSize, length);
+				m_begin += wire::s_frameHeaderSize + length;
+				++frames;
+			}
+
+			_compact();
+			return frames;
+		}
+
+		// bytes of a frame which isn't complete yet
+		int pending() const { return m_end - m_begin; }
+		bool broken() const { return m_broken; }
+
+	private:
+		void _compact()
+		{
+			if (m_begin == m_end) {
+				m_begin = 0;
+				m_end = 0;
+			}
+			else if (writeSpace() < wire::s_frameHeaderSize + wire::s_maxPayloadSize) {
+				memmove(m_buf.data(), m_buf.data() + m_begin, m_end - m_begin);
+				m_end -= m_begin;
+				m_begin = 0;
+			}
+		}
+
+	private:
+		std::vector<char> m_buf;
+		int m_begin;
+		int m_end;
+		int m_minPayload;
+		bool m_broken;
+	};
+}
@@ -1,6 +1,9 @@
 #include "socket/socket.h"
 #include "logic/server.h"
+#include "utils/log.h"
 #include "utils/misc.h"
+#include "utils/thread.h"
+#include "utils/threadGroup.h"
 
 int main(int argc, char** argv) {
 	if (!soc::initSocLib()) {
@@ -8,11 +11,57 @@ int main(int argc, char** argv) {
 	}
 	
 	int targetVal = 10;
+	int numberOfReceivers = 2;
+	int sharedPort = 0;
+	std::string cpuList;
+	int dedupWindow = 1 << 20;
+	int useUring = soc::getBackend() == soc::Backend::IoUring;
+	int pageByReceiver = 0;
+	int maxPageSize = Server::s_maxPageSize;
+	std::string segmentDir = "segments";
+	int forwardBackpressure = 0;
+	int forwardBatch = 64;
+	int forwardDeadlineUs = 0;
+	int sharded = 0;
+	int statsPeriodSec = 5;
+	std::string statsSocket = "-";
 	utils::setIfHasParams<int>(argc, argv, "-t", &targetVal);
-	
+	utils::setIfHasParams<int>(argc, argv, "-r", &numberOfReceivers);
+	utils::setIfHasParams<int>(argc, argv, "-rp", &sharedPort);
+	utils::setIfHasParams<int>(argc, argv, "-uring", &useUring);
+	utils::setIfHasParams<int>(argc, argv, "-dw", &dedupWindow);
+	utils::setIfHasParams<int>(argc, argv, "-pr", &pageByReceiver);
+	utils::setIfHasParams<int>(argc, argv, "-pm", &maxPageSize);
+	utils::setIfHasParams<std::string>(argc, argv, "-sd", &segmentDir);
+	utils::setIfHasParams<int>(argc, argv, "-fq", &forwardBackpressure);
+	utils::setIfHasParams<int>(argc, argv, "-fb", &forwardBatch);
+	utils::setIfHasParams<int>(argc, argv, "-fd", &forwardDeadlineUs);
+	utils::setIfHasParams<int>(argc, argv, "-sh", &sharded);
+	utils::setIfHasParams<int>(argc, argv, "-mi", &statsPeriodSec);
+	utils::setIfHasParams<std::string>(argc, argv, "-ms", &statsSocket);
+	std::vector<int> cpus;
+	if (utils::setIfHasParams<std::string>(argc, argv, "-cpu", &cpuList)) {
+		if (!utils::parseCpuList(cpuList, &cpus)) {
+			LOG_ERROR("Invalid cpu list %s (cpus 0-%d), workers aren't pinned.", cpuList.c_str(), utils::numberOfCores() - 1);
+		}
+	}
+	else if (sharedPort) {
+		// sharded receivers are pinned core per receiver by default
+		for (int i = 0; i < utils::numberOfCores(); ++i) {
+			cpus.push_back(i);
+		}
+	}
+
+	soc::setBackend(useUring ? soc::Backend::IoUring : soc::Backend::Poll);
+	utils::installStopSignals();
+
 	Server s{ targetVal };
-	s.start(2);
+	s.start({ numberOfReceivers < 1 ? 1 : numberOfReceivers, sharedPort != 0, cpus, dedupWindow, pageByReceiver == 0, maxPageSize, segmentDir == "-" ? std::string{} : segmentDir,
+		forwardBackpressure != 0, forwardBatch, forwardDeadlineUs, sharded != 0,
+		statsPeriodSec, statsSocket == "-" ? std::string{} : statsSocket });
 
+	// pause prompt comes after everything logged so far
+	utils::Logger::flush();
 	system("pause");
 	
 	soc::shutdownSocLib();
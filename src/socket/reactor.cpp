@@ -0,0 +1,98 @@
+#include "reactor.h"
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "../utils/clock.h"
+#include "../utils/log.h"
+
+#ifdef WIN32 
+#include "reactor_win_inl.h"
+#elif __linux
+#include "reactor_linux_inl.h"
+#endif
+
+namespace soc {
+
+	namespace {
+		// taken after every poll, so it has to be cheap
+		uint64_t _nowMs()
+		{
+			return utils::TscClock::nowNs() / 1000000u;
+		}
+	}
+
+	Reactor::Reactor()
+		: m_imp{ new Reactor::Impl() }
+	{
+		m_timers.init(_nowMs());
+	}
+
+	Reactor::~Reactor()
+	{
+		if (m_imp) {
+			delete m_imp;
+			m_imp = nullptr;
+		}
+	}
+
+	bool Reactor::init()
+	{
+		return m_imp->init();
+	}
+
+	bool Reactor::add(Socket* s, unsigned int events, Callback cb)
+	{
+		return m_imp->add(s->handle(), events, std::move(cb));
+	}
+
+	bool Reactor::modify(Socket* s, unsigned int events)
+	{
+		return m_imp->modify(s->handle(), events);
+	}
+
+	bool Reactor::remove(Socket* s)
+	{
+		return m_imp->remove(s->handle());
+	}
+
+	int Reactor::poll(int timeoutMs)
+	{
+		const int64_t untilTimer = m_timers.msUntilNext();
+		const int wait = untilTimer >= 0 && (timeoutMs < 0 || untilTimer < timeoutMs) ? static_cast<int>(untilTimer) : timeoutMs;
+		const int dispatched = m_imp->poll(wait);
+		if (dispatched < 0) {
+			return dispatched;
+		}
+		// wheel moves even while empty, so new timers count from now
+		return dispatched + m_timers.advance(_nowMs());
+	}
+
+	void Reactor::run()
+	{
+		m_imp->m_running.store(true, std::memory_order_release);
+		while (!m_imp->m_stopped.load(std::memory_order_acquire)) {
+			if (poll(-1) < 0) {
+				break;
+			}
+		}
+		m_imp->m_running.store(false, std::memory_order_release);
+	}
+
+	void Reactor::stop()
+	{
+		m_imp->m_stopped.store(true, std::memory_order_release);
+		m_imp->wakeup();
+	}
+
+	void Reactor::wakeup()
+	{
+		m_imp->wakeup();
+	}
+
+	bool Reactor::isRunning() const
+	{
+		return m_imp->m_running.load(std::memory_order_acquire);
+	}
+}
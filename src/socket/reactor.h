@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+
+#include "socket.h"
+#include "../utils/timerWheel.h"
+
+namespace soc {
+
+	enum ReactorEvent : unsigned int {
+		EvRead = 1u << 0,
+		EvWrite = 1u << 1,
+		EvError = 1u << 2 // hang up or socket error, always reported
+	};
+
+	// readiness based event loop (epoll + eventfd on linux)
+	// it doesn't own sockets, only watches them; registration must happen 
+	// from the thread which runs the loop (or before it is started),
+	// stop() and wakeup() are safe to call from any thread
+	// timers follow the same rule, loop sleeps no longer than until the next one
+	// and runs expired ones after socket callbacks of the same poll
+	class Reactor {
+	public:
+		using Callback = std::function<void(unsigned int events)>;
+
+	public:
+		Reactor();
+		~Reactor();
+
+		Reactor(const Reactor&) = delete;
+		Reactor& operator=(const Reactor&) = delete;
+
+		bool init();
+
+		bool add(Socket* s, unsigned int events, Callback cb);
+		bool modify(Socket* s, unsigned int events);
+		bool remove(Socket* s);
+
+		// waits up to timeoutMs (-1 forever) and dispatches callbacks of ready sockets and timers
+		// returns number of dispatched events and timers, -1 on error
+		int poll(int timeoutMs);
+
+		// 1 ms tick, time is steady clock as of the last poll
+		utils::TimerWheel& timers() { return m_timers; }
+
+		// dispatches events until stop() is called
+		void run();
+		void stop();
+		void wakeup();
+
+		bool isRunning() const;
+
+	private:
+		class Impl;
+		Impl* m_imp;
+		utils::TimerWheel m_timers;
+	};
+}
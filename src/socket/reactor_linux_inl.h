@@ -0,0 +1,216 @@
+#pragma once
+
+#ifdef __linux
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+namespace soc {
+
+	class Reactor::Impl {
+	public:
+		Impl();
+		~Impl();
+
+		bool init();
+
+		bool add(NativeHandle h, unsigned int events, Callback cb);
+		bool modify(NativeHandle h, unsigned int events);
+		bool remove(NativeHandle h);
+
+		int poll(int timeoutMs);
+		void wakeup();
+
+		struct Entry {
+			NativeHandle m_handle;
+			Callback m_cb;
+			bool m_removed;
+		};
+
+		static const int s_maxEvents = 64;
+
+		static uint32_t _toEpoll(unsigned int events);
+		static unsigned int _fromEpoll(uint32_t events);
+
+		int m_epoll;
+		int m_wakeFd;
+		std::unordered_map<NativeHandle, Entry*> m_entries;
+		// entries removed during dispatch are freed after the round
+		std::vector<Entry*> m_retired;
+		std::atomic<bool> m_running;
+		std::atomic<bool> m_stopped;
+	};
+
+	Reactor::Impl::Impl()
+		: m_epoll{ -1 }, m_wakeFd{ -1 }, m_running{ false }, m_stopped{ false }
+	{
+	}
+
+	Reactor::Impl::~Impl()
+	{
+		for (auto& e : m_entries) {
+			delete e.second;
+		}
+		for (Entry* e : m_retired) {
+			delete e;
+		}
+
+		if (m_wakeFd != -1) {
+			close(m_wakeFd);
+		}
+		if (m_epoll != -1) {
+			close(m_epoll);
+		}
+	}
+
+	bool Reactor::Impl::init()
+	{
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (m_epoll == -1) {
+			LOG_ERROR("Failed to create epoll instance. Error: %d", errno);
+			return false;
+		}
+
+		m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_wakeFd == -1) {
+			LOG_ERROR("Failed to create eventfd. Error: %d", errno);
+			return false;
+		}
+
+		// wakeup fd is recognized by null data pointer
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeFd, &ev) < 0) {
+			LOG_ERROR("Failed to register eventfd. Error: %d", errno);
+			return false;
+		}
+		return true;
+	}
+
+	bool Reactor::Impl::add(NativeHandle h, unsigned int events, Callback cb)
+	{
+		if (m_entries.count(h)) {
+			LOG_ERROR("Socket %d is already registered in reactor.", h);
+			return false;
+		}
+
+		Entry* e = new Entry{ h, std::move(cb), false };
+		epoll_event ev{};
+		ev.events = _toEpoll(events);
+		ev.data.ptr = e;
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, h, &ev) < 0) {
+			LOG_ERROR("Failed to register socket %d in reactor. Error: %d", h, errno);
+			delete e;
+			return false;
+		}
+		m_entries[h] = e;
+		return true;
+	}
+
+	bool Reactor::Impl::modify(NativeHandle h, unsigned int events)
+	{
+		auto it = m_entries.find(h);
+		if (it == m_entries.end()) {
+			return false;
+		}
+
+		epoll_event ev{};
+		ev.events = _toEpoll(events);
+		ev.data.ptr = it->second;
+		if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, h, &ev) < 0) {
+			LOG_ERROR("Failed to modify socket %d in reactor. Error: %d", h, errno);
+			return false;
+		}
+		return true;
+	}
+
+	bool Reactor::Impl::remove(NativeHandle h)
+	{
+		auto it = m_entries.find(h);
+		if (it == m_entries.end()) {
+			return false;
+		}
+
+		epoll_ctl(m_epoll, EPOLL_CTL_DEL, h, nullptr);
+		it->second->m_removed = true;
+		m_retired.push_back(it->second);
+		m_entries.erase(it);
+		return true;
+	}
+
+	int Reactor::Impl::poll(int timeoutMs)
+	{
+		epoll_event events[s_maxEvents];
+		int ready = epoll_wait(m_epoll, events, s_maxEvents, timeoutMs);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				return 0;
+			}
+			LOG_ERROR("epoll_wait failed. Error: %d", errno);
+			return -1;
+		}
+
+		int dispatched = 0;
+		for (int i = 0; i < ready; ++i) {
+			Entry* e = static_cast<Entry*>(events[i].data.ptr);
+			if (!e) {
+				uint64_t counter = 0;
+				ssize_t res = read(m_wakeFd, &counter, sizeof(counter));
+				(void)res;
+				continue;
+			}
+
+			if (e->m_removed) {
+				continue;
+			}
+			e->m_cb(_fromEpoll(events[i].events));
+			++dispatched;
+		}
+
+		for (Entry* e : m_retired) {
+			delete e;
+		}
+		m_retired.clear();
+		return dispatched;
+	}
+
+	void Reactor::Impl::wakeup()
+	{
+		uint64_t one = 1;
+		ssize_t res = write(m_wakeFd, &one, sizeof(one));
+		(void)res;
+	}
+
+	uint32_t Reactor::Impl::_toEpoll(unsigned int events)
+	{
+		uint32_t res = 0;
+		if (events & EvRead) {
+			res |= EPOLLIN;
+		}
+		if (events & EvWrite) {
+			res |= EPOLLOUT;
+		}
+		return res;
+	}
+
+	unsigned int Reactor::Impl::_fromEpoll(uint32_t events)
+	{
+		unsigned int res = 0;
+		if (events & EPOLLIN) {
+			res |= EvRead;
+		}
+		if (events & EPOLLOUT) {
+			res |= EvWrite;
+		}
+		if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+			res |= EvError;
+		}
+		return res;
+	}
+}
+
+#endif
@@ -0,0 +1,149 @@
+#pragma once
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+
+#include <WinSock2.h>
+
+namespace soc {
+
+	// there is no eventfd on windows, so the poll is sliced 
+	// and wakeup is noticed at most s_wakeupSliceMs later
+	class Reactor::Impl {
+	public:
+		Impl();
+		~Impl();
+
+		bool init();
+
+		bool add(NativeHandle h, unsigned int events, Callback cb);
+		bool modify(NativeHandle h, unsigned int events);
+		bool remove(NativeHandle h);
+
+		int poll(int timeoutMs);
+		void wakeup();
+
+		struct Entry {
+			NativeHandle m_handle;
+			unsigned int m_events;
+			Callback m_cb;
+			bool m_removed;
+		};
+
+		static const int s_wakeupSliceMs = 50;
+
+		std::unordered_map<NativeHandle, Entry*> m_entries;
+		std::vector<Entry*> m_retired;
+		std::vector<WSAPOLLFD> m_pollFds;
+		std::vector<Entry*> m_pollEntries;
+		std::atomic<bool> m_running;
+		std::atomic<bool> m_stopped;
+	};
+
+	Reactor::Impl::Impl()
+		: m_running{ false }, m_stopped{ false }
+	{
+	}
+
+	Reactor::Impl::~Impl()
+	{
+		for (auto& e : m_entries) {
+			delete e.second;
+		}
+		for (Entry* e : m_retired) {
+			delete e;
+		}
+	}
+
+	bool Reactor::Impl::init()
+	{
+		return true;
+	}
+
+	bool Reactor::Impl::add(NativeHandle h, unsigned int events, Callback cb)
+	{
+		if (m_entries.count(h)) {
+			LOG_ERROR("Socket %llu is already registered in reactor.", h);
+			return false;
+		}
+		m_entries[h] = new Entry{ h, events, std::move(cb), false };
+		return true;
+	}
+
+	bool Reactor::Impl::modify(NativeHandle h, unsigned int events)
+	{
+		auto it = m_entries.find(h);
+		if (it == m_entries.end()) {
+			return false;
+		}
+		it->second->m_events = events;
+		return true;
+	}
+
+	bool Reactor::Impl::remove(NativeHandle h)
+	{
+		auto it = m_entries.find(h);
+		if (it == m_entries.end()) {
+			return false;
+		}
+		it->second->m_removed = true;
+		m_retired.push_back(it->second);
+		m_entries.erase(it);
+		return true;
+	}
+
+	int Reactor::Impl::poll(int timeoutMs)
+	{
+		m_pollFds.clear();
+		m_pollEntries.clear();
+		for (auto& e : m_entries) {
+			WSAPOLLFD pfd{};
+			pfd.fd = static_cast<SOCKET>(e.first);
+			pfd.events = (e.second->m_events & EvRead ? POLLRDNORM : 0) | (e.second->m_events & EvWrite ? POLLWRNORM : 0);
+			m_pollFds.push_back(pfd);
+			m_pollEntries.push_back(e.second);
+		}
+
+		int slice = timeoutMs < 0 || timeoutMs > s_wakeupSliceMs ? s_wakeupSliceMs : timeoutMs;
+		int ready = 0;
+		if (m_pollFds.empty()) {
+			Sleep(slice);
+		}
+		else {
+			ready = WSAPoll(m_pollFds.data(), static_cast<ULONG>(m_pollFds.size()), slice);
+			if (ready == SOCKET_ERROR) {
+				LOG_ERROR("WSAPoll failed. Error: %d", WSAGetLastError());
+				return -1;
+			}
+		}
+
+		int dispatched = 0;
+		for (size_t i = 0; ready > 0 && i < m_pollFds.size(); ++i) {
+			SHORT rev = m_pollFds[i].revents;
+			Entry* e = m_pollEntries[i];
+			if (!rev || e->m_removed) {
+				continue;
+			}
+
+			unsigned int events = 0;
+			events |= rev & POLLRDNORM ? EvRead : 0;
+			events |= rev & POLLWRNORM ? EvWrite : 0;
+			events |= rev & (POLLERR | POLLHUP | POLLNVAL) ? EvError : 0;
+			e->m_cb(events);
+			++dispatched;
+		}
+
+		for (Entry* e : m_retired) {
+			delete e;
+		}
+		m_retired.clear();
+		return dispatched;
+	}
+
+	void Reactor::Impl::wakeup()
+	{
+		// poll returns by itself after the current slice
+	}
+}
+
+#endif
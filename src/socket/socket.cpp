@@ -1,9 +1,18 @@
 #include "socket.h"
 
+#include <atomic>
+
 namespace soc {
 	static const char* defaultIp = "127.0.0.1";
 	const int socUDPPortStart = 10100;
 	const int socTCPPortStart = 10200;
+
+	// socket threads fall back to poll when kernel lacks io_uring, so it is atomic
+#if defined(__linux) && defined(ATTO_IO_URING)
+	static std::atomic<Backend> s_backend{ Backend::IoUring };
+#else
+	static std::atomic<Backend> s_backend{ Backend::Poll };
+#endif
 }
 
 #include "../utils/log.h"
@@ -16,6 +25,23 @@ namespace soc {
 
 namespace soc {
 
+	bool setBackend(Backend backend)
+	{
+#if !defined(__linux) || !defined(ATTO_IO_URING)
+		if (backend == Backend::IoUring) {
+			LOG_ERROR("io_uring backend isn't built in.");
+			return false;
+		}
+#endif
+		s_backend.store(backend, std::memory_order_relaxed);
+		return true;
+	}
+
+	Backend getBackend()
+	{
+		return s_backend.load(std::memory_order_relaxed);
+	}
+
 	Socket::Socket()
 	:
 		m_port(8080),
@@ -48,6 +74,11 @@ namespace soc {
 		return m_imp->init(m_port, m_type, m_role);
 	}
 
+	bool Socket::setReusePort()
+	{
+		return m_imp->setReusePort();
+	}
+
 	bool Socket::connect() {
 		bool res = m_imp->connect();
 		if (res && m_type == SocketType::TCP) {
@@ -70,6 +101,11 @@ namespace soc {
 		return m_imp->send(buf, bufLength);
 	}
 
+	int Socket::sendStream(const char* buf, int bufLength, unsigned int timeoutMs /* = s_defaultTimeoutMs */)
+	{
+		return m_imp->sendStream(buf, bufLength, timeoutMs);
+	}
+
 	Socket* Socket::accept(unsigned int timeoutMs)
 	{
 		Socket::Impl* res = m_imp->accept(timeoutMs);
@@ -93,9 +129,29 @@ namespace soc {
 		return res;
 	}
 
-	int Socket::receive(char* outBuf, int bufLength)
+	int Socket::receive(char* outBuf, int bufLength, unsigned int timeoutMs /* = s_defaultTimeoutMs */)
+	{
+		return m_imp->receive(outBuf, bufLength, timeoutMs);
+	}
+
+	int Socket::receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs /* = s_defaultTimeoutMs */)
+	{
+		return m_imp->receiveBatch(dgrams, count, timeoutMs);
+	}
+
+	int Socket::sendBatch(Datagram* dgrams, int count)
+	{
+		return m_imp->sendBatch(dgrams, count);
+	}
+
+	NativeHandle Socket::handle() const
+	{
+		return m_imp->handle();
+	}
+
+	bool Socket::isClosed() const
 	{
-		return m_imp->receive(outBuf, bufLength);
+		return m_imp->m_closed;
 	}
 
 	bool Socket::listen()
@@ -11,9 +11,32 @@ namespace soc {
 		Listener
 	};
 
+#ifdef WIN32
+	using NativeHandle = unsigned long long; // SOCKET
+#else
+	using NativeHandle = int;
+#endif
+
 	extern const int socUDPPortStart; // 10100
 	extern const int socTCPPortStart; // 10200
 
+	// single datagram slot for batched send/receive
+	struct Datagram {
+		char* m_buf;
+		int m_length; // buffer capacity on receive, payload size on send
+		int m_received; // bytes received, filled by receiveBatch
+	};
+
+	enum class Backend : char {
+		Poll, // readiness + plain syscalls, available everywhere
+		IoUring // linux only, needs build with ATTO_IO_URING
+	};
+
+	// selects backend for sockets initialized afterwards
+	// returns false if backend isn't built in, IoUring falls back to Poll at runtime if kernel lacks it
+	bool setBackend(Backend backend);
+	Backend getBackend();
+
 	bool initSocLib();
 	void shutdownSocLib();
 
@@ -23,6 +46,9 @@ namespace soc {
 		~Socket();
 
 		bool init();
+		// lets several sockets bind the same port, kernel spreads flows between them
+		// has to be called after init() and before bind()
+		bool setReusePort();
 		bool connect();
 		bool shutdown();
 		
@@ -31,7 +57,27 @@ namespace soc {
 		bool listen();
 
 		int send(char* buf, int bufLength);
-		int receive(char* outBuf, int bufLength);
+		// writes whole buffer into a stream socket with as few syscalls as possible,
+		// waits up to timeoutMs for send buffer space whenever it is full
+		// returns number of bytes written, less than bufLength only on error or timeout
+		int sendStream(const char* buf, int bufLength, unsigned int timeoutMs = s_defaultTimeoutMs);
+
+		// waits up to timeoutMs for a datagram/data, 0 means just try once
+		// returns number of bytes received, 0 if nothing arrived or on error
+		int receive(char* outBuf, int bufLength, unsigned int timeoutMs = s_defaultTimeoutMs);
+
+		// moves up to count datagrams with as few syscalls as possible (recvmmsg/sendmmsg)
+		// receiveBatch waits up to timeoutMs for the first datagram only
+		// both return number of datagrams processed, 0 if nothing was done or on error
+		int receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs = s_defaultTimeoutMs);
+		int sendBatch(Datagram* dgrams, int count);
+
+		NativeHandle handle() const;
+		// stream peer has closed the connection or it failed, known once receive returned 0
+		bool isClosed() const;
+
+		static const unsigned int s_defaultTimeoutMs = 5000;
+		static const int s_maxBatchSize = 64;
 	private:
 		Socket();
 		class Impl;
@@ -12,8 +12,9 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 
-#include "../utils/timer.h"
+#include "socket_uring_inl.h"
 
 #define INVALID_SOCKET -1
 
@@ -35,6 +36,7 @@ static bool s_winSockInitialized = false;
 		~Impl();
 
 		bool init(int port, SocketType type, SocketRole role);
+		bool setReusePort();
 		
 		bool connect();
 		bool shutdown(SocketRole role);
@@ -43,27 +45,51 @@ static bool s_winSockInitialized = false;
 		bool listen();
 		Socket::Impl* accept(unsigned int timeoutMs);
 
-		int receive(char* buf, int bufLength);
+		int receive(char* buf, int bufLength, unsigned int timeoutMs);
 		int send(char* buf, int bufLength);
+		int sendStream(const char* buf, int bufLength, unsigned int timeoutMs);
 
+		int receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs);
+		int sendBatch(Datagram* dgrams, int count);
 
-		static const unsigned int s_defaultTimeoutMs = 5000;
+		// blocks in the kernel until the socket is ready for events or timeout expires
+		// returns false on timeout or error
+		bool _wait(short events, unsigned int timeoutMs);
+		NativeHandle handle() const;
+
+		// io_uring engine is created when IoUring backend is selected and kernel supports it
+		bool _initUring(bool isStream);
 
 		int m_socket;
-		utils::Timer m_timer;
 		sockaddr_in m_sockaddr;
 		int m_addrlen;
 		bool m_isBlocking;
+		bool m_isStream;
+		bool m_closed;
+#ifdef ATTO_IO_URING
+		UringIO* m_uring;
+#endif
 	};
 
 	Socket::Impl::Impl() {
 		m_isBlocking = true;
+		m_isStream = false;
+		m_closed = false;
 		m_socket = INVALID_SOCKET;
 		m_addrlen = 0;
+#ifdef ATTO_IO_URING
+		m_uring = nullptr;
+#endif
 	}
 
 	Socket::Impl::~Impl()
 	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			delete m_uring;
+			m_uring = nullptr;
+		}
+#endif
 		if (m_socket != INVALID_SOCKET) {
 			close(m_socket);
 		}
@@ -72,6 +98,7 @@ static bool s_winSockInitialized = false;
 	bool Socket::Impl::init(int port, SocketType type, SocketRole role)
 	{
         int socType = type == SocketType::TCP ? SOCK_STREAM : SOCK_DGRAM;
+		m_isStream = type == SocketType::TCP;
         m_socket = socket(AF_INET, socType, 0);
         if (m_socket == INVALID_SOCKET) {
 			LOG_ERROR("Failed to create socket. Error: %d", errno);
@@ -98,35 +125,47 @@ static bool s_winSockInitialized = false;
             }
 		}
 
+		// tcp listener only accepts, there is nothing to drive through the ring
+		if (!(type == SocketType::TCP && role == SocketRole::Listener)) {
+			_initUring(type == SocketType::TCP);
+		}
+		return true;
+	}
+
+	bool Socket::Impl::setReusePort()
+	{
+		int enable = 1;
+		if (setsockopt(m_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+			LOG_ERROR("Failed to set SO_REUSEPORT. Error: %d", errno);
+			return false;
+		}
 		return true;
 	}
 
 	bool Socket::Impl::connect()
 	{
-		int result = 0;
-		int lastError = 0;
-		m_timer.reset();
-		do {
-			result = ::connect(m_socket, 
-            reinterpret_cast<sockaddr*>(&m_sockaddr), sizeof(sockaddr));
-			if (result == 0) {
-				return true;
-			}
+		int result = ::connect(m_socket,
+			reinterpret_cast<sockaddr*>(&m_sockaddr), sizeof(sockaddr));
+		if (result == 0) {
+			return true;
+		}
 
-			if (result < 0) {
-				lastError = errno;
-				if (lastError != EINPROGRESS && lastError != EALREADY) {
-					LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
-					return false;
-				}
+		int lastError = errno;
+		if (lastError != EINPROGRESS && lastError != EALREADY) {
+			LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
+			return false;
+		}
 
-				if (m_timer.hasPassed<utils::millis>(5000)) {
-					LOG_ERROR("Failed to connect, no response from server.");
-					return false;
-				}
-			}
-		} while (lastError == EINPROGRESS || lastError == EALREADY);
+		if (!_wait(POLLOUT, s_defaultTimeoutMs)) {
+			LOG_ERROR("Failed to connect, no response from server.");
+			return false;
+		}
 
+		socklen_t len = sizeof(lastError);
+		if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &lastError, &len) < 0 || lastError != 0) {
+			LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
+			return false;
+		}
 		return true;
 	}
 
@@ -147,6 +186,12 @@ static bool s_winSockInitialized = false;
 			LOG_ERROR("Bind failed. Error: %d", errno);
 			return false;
 		}
+#ifdef ATTO_IO_URING
+		// armed right away, so ring fd reports readiness before first receive call
+		if (m_uring) {
+			m_uring->armReceive();
+		}
+#endif
 		return true;
 	}
 
@@ -162,28 +207,21 @@ static bool s_winSockInitialized = false;
 
 	Socket::Impl* Socket::Impl::accept(unsigned int timeoutMs)
 	{
-		int lastError = 0;
-		int result = INVALID_SOCKET;
-		m_timer.reset();
-		do {
+		int result = ::accept(m_socket, nullptr, nullptr);
+		if (result == INVALID_SOCKET && errno == EWOULDBLOCK && _wait(POLLIN, timeoutMs)) {
 			result = ::accept(m_socket, nullptr, nullptr);
-			if (result == INVALID_SOCKET) {
-				lastError = errno;
-				if (lastError != EWOULDBLOCK) {
-					LOG_ERROR("Failed to accept new connection. Error: %d", lastError);
-					return nullptr;
-				}
-				if (m_timer.hasPassed<utils::millis>(timeoutMs)) {
-					return nullptr;
-				}
-			}
-			else {
-				break;
+		}
+
+		if (result == INVALID_SOCKET) {
+			if (errno != EWOULDBLOCK) {
+				LOG_ERROR("Failed to accept new connection. Error: %d", errno);
 			}
-		} while (lastError == EWOULDBLOCK);
+			return nullptr;
+		}
 
 		Socket::Impl* mySocRes = new Socket::Impl();
 		mySocRes->m_socket = result;
+		mySocRes->m_isStream = true;
 		
 		if (!m_isBlocking) {
             int flags = fcntl(mySocRes->m_socket, F_GETFL, 0);
@@ -192,37 +230,54 @@ static bool s_winSockInitialized = false;
                 int setBlockRes = fcntl(mySocRes->m_socket, F_SETFL, flags);        
             }
 		}
+
+#ifdef ATTO_IO_URING
+		if (mySocRes->_initUring(true)) {
+			mySocRes->m_uring->armReceive();
+		}
+#endif
 		return mySocRes;
 	}
 
-	int Socket::Impl::receive(char* buf, int bufLength)
+	int Socket::Impl::receive(char* buf, int bufLength, unsigned int timeoutMs)
 	{
-		int result = 0;
-		int lastError = 0;
-		m_timer.reset();
-		do {
-			result = ::recvfrom(m_socket, buf, bufLength, 0, nullptr, nullptr);
-			if (result < 0) {
-				lastError = errno;
-				if (lastError != EWOULDBLOCK) {
-					LOG_ERROR("Failed to receive packet. Error: %d\n", errno);
-					return 0;
-				}
-				if (m_timer.hasPassed<utils::millis>(s_defaultTimeoutMs)) {
-					return 0;
-				}
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			Datagram d{ buf, bufLength, 0 };
+			if (m_uring->receiveBatch(&d, 1, timeoutMs) == 1) {
+				return d.m_received;
 			}
-			else {
-				break;
+			m_closed = m_uring->isClosed();
+			return 0;
+		}
+#endif
+		int result = ::recvfrom(m_socket, buf, bufLength, 0, nullptr, nullptr);
+		if (result < 0 && errno == EWOULDBLOCK && timeoutMs > 0 && _wait(POLLIN, timeoutMs)) {
+			result = ::recvfrom(m_socket, buf, bufLength, 0, nullptr, nullptr);
+		}
+
+		if (result < 0) {
+			if (errno != EWOULDBLOCK) {
+				LOG_ERROR("Failed to receive packet. Error: %d\n", errno);
+				m_closed = m_isStream;
 			}
-			
-		} while (lastError == EWOULDBLOCK);
-		
+			return 0;
+		}
+		// stream eof
+		if (result == 0 && m_isStream && bufLength > 0) {
+			m_closed = true;
+		}
 		return result;
 	}
 
 	int Socket::Impl::send(char* buf, int bufLength)
 	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			Datagram d{ buf, bufLength, 0 };
+			return m_uring->sendBatch(&d, 1, &m_sockaddr) == 1 ? bufLength : 0;
+		}
+#endif
 		int result = ::sendto(m_socket, buf, bufLength, 0, reinterpret_cast<sockaddr*>(&m_sockaddr), sizeof(sockaddr));
 		if (result < 0) {
 			LOG_ERROR("Failed to send packet. Error: %d\n", errno);
@@ -230,6 +285,148 @@ static bool s_winSockInitialized = false;
 		}
 		return result;
 	}
+
+	int Socket::Impl::sendStream(const char* buf, int bufLength, unsigned int timeoutMs)
+	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			// ring send finishes the whole buffer or fails, bytes of a failed one don't count
+			Datagram d{ const_cast<char*>(buf), bufLength, 0 };
+			return m_uring->sendBatch(&d, 1, nullptr, timeoutMs) == 1 ? bufLength : 0;
+		}
+#endif
+		int written = 0;
+		while (written < bufLength) {
+			ssize_t result = ::send(m_socket, buf + written, bufLength - written, MSG_NOSIGNAL);
+			if (result > 0) {
+				written += static_cast<int>(result);
+				continue;
+			}
+			if (result < 0 && (errno == EWOULDBLOCK || errno == EINTR)) {
+				if (errno == EINTR || _wait(POLLOUT, timeoutMs)) {
+					continue;
+				}
+				LOG_ERROR("Failed to send data, send buffer stays full.");
+				break;
+			}
+			LOG_ERROR("Failed to send data. Error: %d\n", errno);
+			break;
+		}
+		return written;
+	}
+
+	int Socket::Impl::receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs)
+	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			return m_uring->receiveBatch(dgrams, count, timeoutMs);
+		}
+#endif
+		count = count > s_maxBatchSize ? s_maxBatchSize : count;
+		mmsghdr msgs[s_maxBatchSize];
+		iovec iovs[s_maxBatchSize];
+		for (int i = 0; i < count; ++i) {
+			iovs[i].iov_base = dgrams[i].m_buf;
+			iovs[i].iov_len = dgrams[i].m_length;
+			memset(&msgs[i], 0, sizeof(mmsghdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int result = ::recvmmsg(m_socket, msgs, count, MSG_WAITFORONE, nullptr);
+		if (result < 0 && errno == EWOULDBLOCK && timeoutMs > 0 && _wait(POLLIN, timeoutMs)) {
+			result = ::recvmmsg(m_socket, msgs, count, MSG_WAITFORONE, nullptr);
+		}
+
+		if (result < 0) {
+			if (errno != EWOULDBLOCK) {
+				LOG_ERROR("Failed to receive packets. Error: %d\n", errno);
+			}
+			return 0;
+		}
+
+		for (int i = 0; i < result; ++i) {
+			dgrams[i].m_received = static_cast<int>(msgs[i].msg_len);
+		}
+		return result;
+	}
+
+	int Socket::Impl::sendBatch(Datagram* dgrams, int count)
+	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			return m_uring->sendBatch(dgrams, count, &m_sockaddr);
+		}
+#endif
+		count = count > s_maxBatchSize ? s_maxBatchSize : count;
+		mmsghdr msgs[s_maxBatchSize];
+		iovec iovs[s_maxBatchSize];
+		for (int i = 0; i < count; ++i) {
+			iovs[i].iov_base = dgrams[i].m_buf;
+			iovs[i].iov_len = dgrams[i].m_length;
+			memset(&msgs[i], 0, sizeof(mmsghdr));
+			msgs[i].msg_hdr.msg_name = &m_sockaddr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int result = ::sendmmsg(m_socket, msgs, count, 0);
+		if (result < 0) {
+			LOG_ERROR("Failed to send packets. Error: %d\n", errno);
+			return 0;
+		}
+		return result;
+	}
+
+	bool Socket::Impl::_wait(short events, unsigned int timeoutMs)
+	{
+		pollfd pfd{};
+		pfd.fd = m_socket;
+		pfd.events = events;
+
+		int result = 0;
+		do {
+			result = ::poll(&pfd, 1, static_cast<int>(timeoutMs));
+		} while (result < 0 && errno == EINTR);
+
+		if (result < 0) {
+			LOG_ERROR("Failed to wait on socket. Error: %d", errno);
+			return false;
+		}
+		return result > 0;
+	}
+
+	NativeHandle Socket::Impl::handle() const
+	{
+#ifdef ATTO_IO_URING
+		if (m_uring) {
+			return m_uring->ringFd();
+		}
+#endif
+		return m_socket;
+	}
+
+	bool Socket::Impl::_initUring(bool isStream)
+	{
+#ifdef ATTO_IO_URING
+		if (s_backend.load(std::memory_order_relaxed) != Backend::IoUring) {
+			return false;
+		}
+
+		m_uring = new UringIO();
+		if (!m_uring->init(m_socket, isStream)) {
+			LOG_ERROR("io_uring is not available (error: %d), falling back to poll backend.", errno);
+			delete m_uring;
+			m_uring = nullptr;
+			s_backend.store(Backend::Poll, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
 }
 
 #undef INVALID_SOCKET
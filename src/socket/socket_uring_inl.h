@@ -0,0 +1,538 @@
+#pragma once
+
+#if defined(__linux) && defined(ATTO_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+
+namespace soc {
+
+	// io_uring engine owned by a linux Socket::Impl, no liburing, raw syscalls only
+	// - receive: one multishot recv per socket, kernel picks buffers from a provided buffer ring
+	// - send: all datagrams of a batch are submitted with a single io_uring_enter,
+	//   stream sends are linked and each may carry a linked timeout
+	// ring fd becomes readable when completions are available, so it is what reactor watches
+	class UringIO {
+	public:
+		UringIO();
+		~UringIO();
+
+		UringIO(const UringIO&) = delete;
+		UringIO& operator=(const UringIO&) = delete;
+
+		bool init(int socket, bool isStream);
+		int ringFd() const { return m_ringFd; }
+
+		// posts multishot recv, it stays armed until socket is closed or buffers run out
+		bool armReceive();
+
+		int receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs);
+		// timeoutMs (streams only) bounds how long each send may wait for socket buffer space
+		int sendBatch(Datagram* dgrams, int count, sockaddr_in* addr, unsigned int timeoutMs = 0);
+
+		// stream reached eof or failed and everything received before was handed out
+		bool isClosed() const { return m_recvClosed && m_readyHead == m_readyTail; }
+
+		static const unsigned int s_ringEntries = 64;
+		static const unsigned int s_bufCount = 256; // power of two
+		// every recv completion holds a buffer, so cq bigger than buffers + sends never overflows
+		static const unsigned int s_cqEntries = s_bufCount * 2;
+		static const unsigned int s_bufSize = 2048;
+		static const unsigned short s_bufGroup = 0;
+		static const __u64 s_recvTag = ~0ull;
+		static const __u64 s_probeTag = ~0ull - 1;
+		static const __u64 s_timeoutTag = ~0ull - 2;
+
+	private:
+		struct Completion {
+			unsigned short m_bid;
+			int m_length;
+			int m_offset;
+		};
+
+		io_uring_sqe* _getSqe();
+		unsigned int _sqFree() const;
+		int _submit(unsigned int toSubmit, unsigned int minComplete);
+		bool _hasMultishotRecv();
+		// submits as many datagrams as sq has room for and waits for them, queued is their number
+		int _sendChunk(Datagram* dgrams, int count, sockaddr_in* addr, unsigned int timeoutMs, int* queued);
+		// moves recv completions to m_ready, returns results of send completions via sendRes
+		void _reap(int* sendRes, int sendCount, int* sendDone);
+		bool _waitCompletions(unsigned int timeoutMs);
+		void _recycle(unsigned short bid);
+
+	private:
+		int m_socket;
+		int m_ringFd;
+		bool m_isStream;
+		bool m_recvArmed;
+		bool m_recvClosed; // stream reached eof or failed, recv isn't rearmed
+
+		void* m_sqRing;
+		void* m_cqRing;
+		size_t m_sqRingSize;
+		size_t m_cqRingSize;
+		io_uring_sqe* m_sqes;
+		size_t m_sqesSize;
+
+		unsigned* m_sqHead;
+		unsigned* m_sqTail;
+		unsigned* m_sqMask;
+		unsigned* m_sqArray;
+		unsigned* m_sqFlags;
+		unsigned* m_cqHead;
+		unsigned* m_cqTail;
+		unsigned* m_cqMask;
+		io_uring_cqe* m_cqes;
+
+		// io_uring_buf_ring is declared with a flex array which shifts bufs in C++,
+		// so ring is addressed manually: tail overlays resv field of the first entry
+		io_uring_buf* m_bufRing;
+		unsigned short* m_bufRingTail;
+		size_t m_bufRingSize;
+		char* m_bufPool;
+
+		// recv completions harvested but not handed to a caller yet
+		Completion m_ready[s_bufCount];
+		unsigned int m_readyHead;
+		unsigned int m_readyTail;
+	};
+
+	UringIO::UringIO()
+		:
+		m_socket{ -1 }, m_ringFd{ -1 }, m_isStream{ false }, m_recvArmed{ false }, m_recvClosed{ false },
+		m_sqRing{ MAP_FAILED }, m_cqRing{ MAP_FAILED }, m_sqRingSize{ 0 }, m_cqRingSize{ 0 },
+		m_sqes{ nullptr }, m_sqesSize{ 0 },
+		m_sqHead{ nullptr }, m_sqTail{ nullptr }, m_sqMask{ nullptr }, m_sqArray{ nullptr }, m_sqFlags{ nullptr },
+		m_cqHead{ nullptr }, m_cqTail{ nullptr }, m_cqMask{ nullptr }, m_cqes{ nullptr },
+		m_bufRing{ nullptr }, m_bufRingTail{ nullptr }, m_bufRingSize{ 0 }, m_bufPool{ nullptr },
+		m_readyHead{ 0 }, m_readyTail{ 0 }
+	{
+	}
+
+	UringIO::~UringIO()
+	{
+		// closing the ring cancels armed multishot recv
+		if (m_ringFd != -1) {
+			close(m_ringFd);
+		}
+		if (m_bufRing) {
+			munmap(m_bufRing, m_bufRingSize);
+		}
+		if (m_bufPool) {
+			delete[] m_bufPool;
+		}
+		if (m_sqes) {
+			munmap(m_sqes, m_sqesSize);
+		}
+		if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+			munmap(m_cqRing, m_cqRingSize);
+		}
+		if (m_sqRing != MAP_FAILED) {
+			munmap(m_sqRing, m_sqRingSize);
+		}
+	}
+
+	bool UringIO::init(int socket, bool isStream)
+	{
+		m_socket = socket;
+		m_isStream = isStream;
+
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = s_cqEntries;
+		m_ringFd = static_cast<int>(syscall(__NR_io_uring_setup, s_ringEntries, &params));
+		if (m_ringFd < 0) {
+			m_ringFd = -1;
+			return false;
+		}
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap) {
+			m_sqRingSize = m_cqRingSize = m_sqRingSize > m_cqRingSize ? m_sqRingSize : m_cqRingSize;
+		}
+
+		m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+		if (m_sqRing == MAP_FAILED) {
+			return false;
+		}
+		m_cqRing = singleMmap ? m_sqRing
+			: mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+		if (m_cqRing == MAP_FAILED) {
+			return false;
+		}
+
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			return false;
+		}
+		m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+		char* sq = static_cast<char*>(m_sqRing);
+		m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		m_sqFlags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+
+		char* cq = static_cast<char*>(m_cqRing);
+		m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		// provided buffer ring, has to be page aligned
+		m_bufRingSize = s_bufCount * sizeof(io_uring_buf);
+		void* bufRing = mmap(nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (bufRing == MAP_FAILED) {
+			return false;
+		}
+		m_bufRing = static_cast<io_uring_buf*>(bufRing);
+		m_bufRingTail = &m_bufRing[0].resv;
+
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<__u64>(m_bufRing);
+		reg.ring_entries = s_bufCount;
+		reg.bgid = s_bufGroup;
+		if (syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+			return false;
+		}
+
+		m_bufPool = new char[s_bufCount * s_bufSize];
+		for (unsigned int i = 0; i < s_bufCount; ++i) {
+			_recycle(static_cast<unsigned short>(i));
+		}
+
+		if (!_hasMultishotRecv()) {
+			errno = EINVAL;
+			return false;
+		}
+		return true;
+	}
+
+	// multishot recv (6.0) is younger than provided buffer rings (5.19): kernel which doesn't
+	// know it fails the prep with EINVAL, one which does fails the issue on ring fd with ENOTSOCK.
+	// both complete inline, nothing else is in flight yet
+	bool UringIO::_hasMultishotRecv()
+	{
+		io_uring_sqe* sqe = _getSqe();
+		if (!sqe) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = m_ringFd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = s_bufGroup;
+		sqe->user_data = s_probeTag;
+		if (_submit(1, 1) < 0) {
+			return false;
+		}
+
+		int res = -EINVAL;
+		unsigned head = *m_cqHead;
+		unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+			if (cqe.user_data == s_probeTag) {
+				res = cqe.res;
+			}
+		}
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+		return res != -EINVAL;
+	}
+
+	bool UringIO::armReceive()
+	{
+		if (m_recvArmed) {
+			return true;
+		}
+		if (m_recvClosed) {
+			return false;
+		}
+
+		io_uring_sqe* sqe = _getSqe();
+		if (!sqe) {
+			return false;
+		}
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = m_socket;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = s_bufGroup;
+		sqe->user_data = s_recvTag;
+
+		if (_submit(1, 0) < 0) {
+			LOG_ERROR("Failed to arm multishot receive. Error: %d", errno);
+			return false;
+		}
+		m_recvArmed = true;
+		return true;
+	}
+
+	int UringIO::receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs)
+	{
+		_reap(nullptr, 0, nullptr);
+		if (m_readyHead == m_readyTail && !armReceive()) {
+			return 0;
+		}
+		if (m_readyHead == m_readyTail && timeoutMs > 0 && _waitCompletions(timeoutMs)) {
+			_reap(nullptr, 0, nullptr);
+		}
+
+		int result = 0;
+		while (result < count && m_readyHead != m_readyTail) {
+			Completion& c = m_ready[m_readyHead & (s_bufCount - 1)];
+			Datagram& d = dgrams[result];
+			int available = c.m_length - c.m_offset;
+			int toCopy = available < d.m_length ? available : d.m_length;
+			memcpy(d.m_buf, m_bufPool + c.m_bid * s_bufSize + c.m_offset, toCopy);
+			d.m_received = toCopy;
+			++result;
+
+			// streams keep the rest of the buffer for next call, datagrams are truncated like recvfrom does
+			c.m_offset += toCopy;
+			if (!m_isStream || c.m_offset == c.m_length) {
+				_recycle(c.m_bid);
+				++m_readyHead;
+			}
+		}
+
+		// recycled buffers let terminated multishot recv continue
+		armReceive();
+		return result;
+	}
+
+	int UringIO::sendBatch(Datagram* dgrams, int count, sockaddr_in* addr, unsigned int timeoutMs)
+	{
+		// batches longer than sq go in chunks, stream order holds as a chunk is waited for
+		int result = 0;
+		while (result < count) {
+			int queued = 0;
+			const int sent = _sendChunk(dgrams + result, count - result, addr, timeoutMs, &queued);
+			result += sent;
+			if (queued == 0 || sent < queued) {
+				break;
+			}
+		}
+		return result;
+	}
+
+	int UringIO::_sendChunk(Datagram* dgrams, int count, sockaddr_in* addr, unsigned int timeoutMs, int* queued)
+	{
+		count = count > static_cast<int>(s_ringEntries) ? static_cast<int>(s_ringEntries) : count;
+		msghdr hdrs[s_ringEntries];
+		iovec iovs[s_ringEntries];
+
+		// kernel copies timeout at submit, so one on stack serves every send of the chunk
+		const bool withTimeout = m_isStream && timeoutMs > 0;
+		__kernel_timespec timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_nsec = (timeoutMs % 1000) * 1000000ll;
+
+		int n = 0;
+		unsigned int sqes = 0;
+		for (; n < count; ++n) {
+			// whatever is queued goes out, caller comes back for the rest
+			if (_sqFree() < (withTimeout ? 2u : 1u)) {
+				break;
+			}
+			io_uring_sqe* sqe = _getSqe();
+			++sqes;
+			if (m_isStream) {
+				sqe->opcode = IORING_OP_SEND;
+				sqe->fd = m_socket;
+				sqe->addr = reinterpret_cast<__u64>(dgrams[n].m_buf);
+				sqe->len = dgrams[n].m_length;
+				// kernel retries a short send itself, so a linked send never follows a partial one
+				sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+				// keeps stream order, next send starts only after this one completed
+				sqe->flags = n + 1 < count || withTimeout ? IOSQE_IO_LINK : 0;
+
+				if (withTimeout) {
+					// cancels the send when socket buffer stays full, chain goes on after it
+					io_uring_sqe* linked = _getSqe();
+					++sqes;
+					linked->opcode = IORING_OP_LINK_TIMEOUT;
+					linked->fd = -1;
+					linked->addr = reinterpret_cast<__u64>(&timeout);
+					linked->len = 1;
+					linked->flags = n + 1 < count ? IOSQE_IO_LINK : 0;
+					linked->user_data = s_timeoutTag;
+				}
+			}
+			else {
+				iovs[n].iov_base = dgrams[n].m_buf;
+				iovs[n].iov_len = dgrams[n].m_length;
+				memset(&hdrs[n], 0, sizeof(msghdr));
+				hdrs[n].msg_name = addr;
+				hdrs[n].msg_namelen = sizeof(sockaddr_in);
+				hdrs[n].msg_iov = &iovs[n];
+				hdrs[n].msg_iovlen = 1;
+				sqe->opcode = IORING_OP_SENDMSG;
+				sqe->fd = m_socket;
+				sqe->addr = reinterpret_cast<__u64>(&hdrs[n]);
+				sqe->len = 1;
+			}
+			sqe->user_data = static_cast<__u64>(n);
+		}
+		*queued = n;
+		if (n == 0) {
+			LOG_ERROR("Submission queue is full, nothing was sent.");
+			return 0;
+		}
+		if (m_isStream) {
+			// link of the last queued sqe must not reach into the next chunk
+			m_sqes[(*m_sqTail - 1) & *m_sqMask].flags = 0;
+		}
+
+		int sendRes[s_ringEntries];
+		int done = 0;
+		for (int i = 0; i < n; ++i) {
+			sendRes[i] = -ECANCELED;
+		}
+		if (_submit(sqes, n) < 0) {
+			LOG_ERROR("Failed to submit send batch. Error: %d", errno);
+			return 0;
+		}
+
+		// completions of the batch have to be collected before hdrs go out of scope
+		_reap(sendRes, n, &done);
+		while (done < n) {
+			if (_submit(0, 1) < 0 && errno != EINTR) {
+				LOG_ERROR("Failed to wait for send completions. Error: %d", errno);
+				break;
+			}
+			_reap(sendRes, n, &done);
+		}
+
+		int result = 0;
+		for (int i = 0; i < n; ++i) {
+			if (sendRes[i] == -ECANCELED && withTimeout) {
+				LOG_ERROR("Failed to send data, send buffer stays full.");
+				break;
+			}
+			if (sendRes[i] < 0) {
+				LOG_ERROR("Failed to send packet. Error: %d\n", -sendRes[i]);
+				break;
+			}
+			if (m_isStream && sendRes[i] < dgrams[i].m_length) {
+				// failed or timed out part way, the rest of the stream can't follow
+				LOG_ERROR("Failed to send data, %d of %d bytes written.", sendRes[i], dgrams[i].m_length);
+				break;
+			}
+			++result;
+		}
+		return result;
+	}
+
+	io_uring_sqe* UringIO::_getSqe()
+	{
+		unsigned tail = *m_sqTail;
+		unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+		if (tail - head >= s_ringEntries) {
+			return nullptr;
+		}
+		unsigned idx = tail & *m_sqMask;
+		io_uring_sqe* sqe = &m_sqes[idx];
+		memset(sqe, 0, sizeof(io_uring_sqe));
+		m_sqArray[idx] = idx;
+		__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+		return sqe;
+	}
+
+	unsigned int UringIO::_sqFree() const
+	{
+		return s_ringEntries - (*m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE));
+	}
+
+	int UringIO::_submit(unsigned int toSubmit, unsigned int minComplete)
+	{
+		unsigned int flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+		return static_cast<int>(syscall(__NR_io_uring_enter, m_ringFd, toSubmit, minComplete, flags, nullptr, _NSIG / 8));
+	}
+
+	void UringIO::_reap(int* sendRes, int sendCount, int* sendDone)
+	{
+		// overflowed completions wait in kernel until somebody enters with GETEVENTS,
+		// they hold recv buffers, so without this receive stalls once all buffers are there
+		if (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+			syscall(__NR_io_uring_enter, m_ringFd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, _NSIG / 8);
+		}
+
+		unsigned head = *m_cqHead;
+		unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+			if (cqe.user_data == s_probeTag || cqe.user_data == s_timeoutTag) {
+				// init reaps the probe, a late one carries nothing; send completion
+				// already tells whether its timeout fired
+				continue;
+			}
+			if (cqe.user_data != s_recvTag) {
+				if (sendRes && cqe.user_data < static_cast<__u64>(sendCount)) {
+					sendRes[cqe.user_data] = cqe.res;
+					++(*sendDone);
+				}
+				continue;
+			}
+
+			if (!(cqe.flags & IORING_CQE_F_MORE)) {
+				// multishot is terminated (i.e. buffers ran out), it is rearmed on next receive
+				m_recvArmed = false;
+			}
+
+			if (cqe.res <= 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) {
+				// ENOBUFS only means buffers ran out, datagram socket errors are transient
+				// like they are for recvfrom, recv is rearmed on next receive in both cases.
+				// stream is done on eof or any error
+				if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+					LOG_ERROR("Failed to receive packet. Error: %d\n", -cqe.res);
+					m_recvClosed = m_recvClosed || m_isStream;
+				}
+				else if (cqe.res == 0 && m_isStream) {
+					m_recvClosed = true;
+				}
+				continue;
+			}
+
+			Completion& c = m_ready[m_readyTail++ & (s_bufCount - 1)];
+			c.m_bid = static_cast<unsigned short>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			c.m_length = cqe.res;
+			c.m_offset = 0;
+		}
+		__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	bool UringIO::_waitCompletions(unsigned int timeoutMs)
+	{
+		pollfd pfd{};
+		pfd.fd = m_ringFd;
+		pfd.events = POLLIN;
+
+		int result = 0;
+		do {
+			result = ::poll(&pfd, 1, static_cast<int>(timeoutMs));
+		} while (result < 0 && errno == EINTR);
+		return result > 0;
+	}
+
+	void UringIO::_recycle(unsigned short bid)
+	{
+		unsigned short tail = *m_bufRingTail;
+		io_uring_buf& buf = m_bufRing[tail & (s_bufCount - 1)];
+		buf.addr = reinterpret_cast<__u64>(m_bufPool + bid * s_bufSize);
+		buf.len = s_bufSize;
+		buf.bid = bid;
+		__atomic_store_n(m_bufRingTail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+	}
+}
+
+#endif
@@ -9,8 +9,6 @@
 #include <WinSock2.h>
 #include <WS2tcpip.h>
 
-#include "../utils/timer.h"
-
 namespace soc {
 
 	static bool s_winSockInitialized = false;
@@ -39,6 +37,7 @@ namespace soc {
 		~Impl();
 
 		bool init(int port, SocketType type, SocketRole role);
+		bool setReusePort();
 		
 		bool connect();
 		bool shutdown(SocketRole role);
@@ -47,21 +46,31 @@ namespace soc {
 		bool listen();
 		Socket::Impl* accept(unsigned int timeoutMs);
 
-		int receive(char* buf, int bufLength);
+		int receive(char* buf, int bufLength, unsigned int timeoutMs);
 		int send(char* buf, int bufLength);
+		int sendStream(const char* buf, int bufLength, unsigned int timeoutMs);
 
+		// there is no recvmmsg/sendmmsg in winsock, one call per datagram
+		int receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs);
+		int sendBatch(Datagram* dgrams, int count);
 
-		static const unsigned int s_defaultTimeoutMs = 5000;
+		// blocks in the kernel until the socket is ready for events or timeout expires
+		// returns false on timeout or error
+		bool _wait(short events, unsigned int timeoutMs);
+		NativeHandle handle() const;
 
 		SOCKET m_socket;
-		utils::Timer m_timer;
 		sockaddr* m_sockaddr;
 		int m_addrlen;
 		bool m_isBlocking;
+		bool m_isStream;
+		bool m_closed;
 	};
 
 	Socket::Impl::Impl() {
 		m_isBlocking = true;
+		m_isStream = false;
+		m_closed = false;
 		m_socket = INVALID_SOCKET;
 		m_sockaddr = nullptr;
 		m_addrlen = 0;
@@ -86,6 +95,7 @@ namespace soc {
 		bool isSender = role == SocketRole::Sender;
 		hints.ai_family = AF_INET;
 		hints.ai_socktype = type == SocketType::TCP ? SOCK_STREAM : SOCK_DGRAM;
+		m_isStream = type == SocketType::TCP;
 		hints.ai_protocol = type == SocketType::TCP ? IPPROTO_TCP : IPPROTO_UDP;
 		hints.ai_flags = !isSender ? AI_PASSIVE : 0;
 
@@ -125,35 +135,40 @@ namespace soc {
 		return true;
 	}
 
+	bool Socket::Impl::setReusePort()
+	{
+		// SO_REUSEADDR on windows doesn't balance datagrams between sockets
+		LOG_ERROR("SO_REUSEPORT is not supported on this platform.");
+		return false;
+	}
+
 	bool Socket::Impl::connect()
 	{
-		int result = 0;
-		int lastError = 0;
-		m_timer.reset();
-		do {
-			result = ::connect(m_socket, m_sockaddr, m_addrlen);
-			if (result == 0) {
-				return true;
-			}
+		int result = ::connect(m_socket, m_sockaddr, m_addrlen);
+		if (result == 0) {
+			return true;
+		}
 
-			if (result == SOCKET_ERROR) {
-				lastError = WSAGetLastError();
-				if (lastError != WSAEWOULDBLOCK && lastError != WSAEALREADY) {
-					if (lastError == WSAEISCONN) {
-						return true;
-					}
+		int lastError = WSAGetLastError();
+		if (lastError == WSAEISCONN) {
+			return true;
+		}
 
-					LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
-					return false;
-				}
+		if (lastError != WSAEWOULDBLOCK && lastError != WSAEALREADY) {
+			LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
+			return false;
+		}
 
-				if (m_timer.hasPassed<utils::millis>(5000)) {
-					LOG_ERROR("Failed to connect, no response from server.");
-					return false;
-				}
-			}
-		} while (lastError == WSAEWOULDBLOCK || lastError == WSAEALREADY);
+		if (!_wait(POLLWRNORM, s_defaultTimeoutMs)) {
+			LOG_ERROR("Failed to connect, no response from server.");
+			return false;
+		}
 
+		int len = sizeof(lastError);
+		if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&lastError), &len) == SOCKET_ERROR || lastError != 0) {
+			LOG_ERROR("Failed to connect to the server. Error: %d", lastError);
+			return false;
+		}
 		return true;
 	}
 
@@ -189,28 +204,22 @@ namespace soc {
 
 	Socket::Impl* Socket::Impl::accept(unsigned int timeoutMs)
 	{
-		int lastError = 0;
-		SOCKET result = INVALID_SOCKET;
-		m_timer.reset();
-		do {
+		SOCKET result = ::accept(m_socket, nullptr, nullptr);
+		if (result == INVALID_SOCKET && WSAGetLastError() == WSAEWOULDBLOCK && _wait(POLLRDNORM, timeoutMs)) {
 			result = ::accept(m_socket, nullptr, nullptr);
-			if (result == INVALID_SOCKET) {
-				lastError = WSAGetLastError();
-				if (lastError != WSAEWOULDBLOCK) {
-					LOG_ERROR("Failed to accept new connection. Error: %d", lastError);
-					return nullptr;
-				}
-				if (m_timer.hasPassed<utils::millis>(timeoutMs)) {
-					return nullptr;
-				}
-			}
-			else {
-				break;
+		}
+
+		if (result == INVALID_SOCKET) {
+			int lastError = WSAGetLastError();
+			if (lastError != WSAEWOULDBLOCK) {
+				LOG_ERROR("Failed to accept new connection. Error: %d", lastError);
 			}
-		} while (lastError == WSAEWOULDBLOCK);
+			return nullptr;
+		}
 
 		Socket::Impl* mySocRes = new Socket::Impl();
 		mySocRes->m_socket = result;
+		mySocRes->m_isStream = true;
 		
 		if (!m_isBlocking) {
 			u_long mode = 1;
@@ -224,29 +233,25 @@ namespace soc {
 		return mySocRes;
 	}
 
-	int Socket::Impl::receive(char* buf, int bufLength)
+	int Socket::Impl::receive(char* buf, int bufLength, unsigned int timeoutMs)
 	{
-		int result = 0;
-		int lastError = 0;
-		m_timer.reset();
-		do {
+		int result = ::recvfrom(m_socket, buf, bufLength, 0, nullptr, nullptr);
+		if (result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK && timeoutMs > 0 && _wait(POLLRDNORM, timeoutMs)) {
 			result = ::recvfrom(m_socket, buf, bufLength, 0, nullptr, nullptr);
-			if (result == SOCKET_ERROR) {
-				lastError = WSAGetLastError();
-				if (lastError != WSAEWOULDBLOCK) {
-					LOG_ERROR("Failed to receive packet. Error: %d\n", WSAGetLastError());
-					return 0;
-				}
-				if (m_timer.hasPassed<utils::millis>(s_defaultTimeoutMs)) {
-					return 0;
-				}
-			}
-			else {
-				break;
+		}
+
+		if (result == SOCKET_ERROR) {
+			int lastError = WSAGetLastError();
+			if (lastError != WSAEWOULDBLOCK) {
+				LOG_ERROR("Failed to receive packet. Error: %d\n", lastError);
+				m_closed = m_isStream;
 			}
-			
-		} while (lastError == WSAEWOULDBLOCK);
-		
+			return 0;
+		}
+		// stream eof
+		if (result == 0 && m_isStream && bufLength > 0) {
+			m_closed = true;
+		}
 		return result;
 	}
 
@@ -259,5 +264,68 @@ namespace soc {
 		}
 		return result;
 	}
+
+	int Socket::Impl::sendStream(const char* buf, int bufLength, unsigned int timeoutMs)
+	{
+		int written = 0;
+		while (written < bufLength) {
+			int result = ::send(m_socket, buf + written, bufLength - written, 0);
+			if (result > 0) {
+				written += result;
+				continue;
+			}
+			if (result == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK) {
+				if (_wait(POLLWRNORM, timeoutMs)) {
+					continue;
+				}
+				LOG_ERROR("Failed to send data, send buffer stays full.");
+				break;
+			}
+			LOG_ERROR("Failed to send data. Error: %d\n", WSAGetLastError());
+			break;
+		}
+		return written;
+	}
+
+	int Socket::Impl::receiveBatch(Datagram* dgrams, int count, unsigned int timeoutMs)
+	{
+		int result = 0;
+		while (result < count) {
+			int received = receive(dgrams[result].m_buf, dgrams[result].m_length, result == 0 ? timeoutMs : 0);
+			if (received <= 0) {
+				break;
+			}
+			dgrams[result++].m_received = received;
+		}
+		return result;
+	}
+
+	int Socket::Impl::sendBatch(Datagram* dgrams, int count)
+	{
+		int result = 0;
+		while (result < count && send(dgrams[result].m_buf, dgrams[result].m_length) > 0) {
+			++result;
+		}
+		return result;
+	}
+
+	bool Socket::Impl::_wait(short events, unsigned int timeoutMs)
+	{
+		WSAPOLLFD pfd{};
+		pfd.fd = m_socket;
+		pfd.events = events;
+
+		int result = WSAPoll(&pfd, 1, static_cast<INT>(timeoutMs));
+		if (result == SOCKET_ERROR) {
+			LOG_ERROR("Failed to wait on socket. Error: %d", WSAGetLastError());
+			return false;
+		}
+		return result > 0;
+	}
+
+	NativeHandle Socket::Impl::handle() const
+	{
+		return static_cast<NativeHandle>(m_socket);
+	}
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "mappedFile.h"
+
+#include "../utils/log.h"
+
+#ifdef WIN32
+#include "mappedFile_win_inl.h"
+#elif __linux
+#include "mappedFile_linux_inl.h"
+#endif
+
+namespace storage {
+
+	MappedFile::MappedFile()
+		: m_imp{ new MappedFile::Impl() }
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_imp) {
+			m_imp->close();
+			delete m_imp;
+			m_imp = nullptr;
+		}
+	}
+
+	bool MappedFile::create(const std::string& path, uint64_t size)
+	{
+		if (!m_imp->create(path, size)) {
+			return false;
+		}
+		m_path = path;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		m_imp->close();
+	}
+
+	bool MappedFile::flush(uint64_t offset, uint64_t length)
+	{
+		return m_imp->flush(offset, length);
+	}
+
+	char* MappedFile::data() const
+	{
+		return m_imp->m_data;
+	}
+
+	uint64_t MappedFile::size() const
+	{
+		return m_imp->m_size;
+	}
+
+	const std::string& MappedFile::path() const
+	{
+		return m_path;
+	}
+}
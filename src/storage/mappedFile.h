@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace storage {
+
+	// creates directory if it doesn't exist
+	bool makeDir(const std::string& path);
+
+	// file of fixed size mapped into memory for reading and writing
+	class MappedFile {
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// creates new file of given size and maps it, fails if file already exists
+		bool create(const std::string& path, uint64_t size);
+		void close();
+
+		// starts write back of [offset, offset + length) to disk, doesn't wait for it
+		bool flush(uint64_t offset, uint64_t length);
+
+		char* data() const;
+		uint64_t size() const;
+		const std::string& path() const;
+
+	private:
+		class Impl;
+		Impl* m_imp;
+		std::string m_path;
+	};
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#ifdef __linux
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+namespace storage {
+
+	bool makeDir(const std::string& path)
+	{
+		if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+			LOG_ERROR("Failed to create directory %s, errno: %d", path.c_str(), errno);
+			return false;
+		}
+		return true;
+	}
+
+	class MappedFile::Impl {
+	public:
+		Impl();
+
+		bool create(const std::string& path, uint64_t size);
+		void close();
+		bool flush(uint64_t offset, uint64_t length);
+
+		int m_fd;
+		char* m_data;
+		uint64_t m_size;
+	};
+
+	MappedFile::Impl::Impl()
+		: m_fd{ -1 }, m_data{ nullptr }, m_size{ 0u }
+	{
+	}
+
+	bool MappedFile::Impl::create(const std::string& path, uint64_t size)
+	{
+		m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (m_fd < 0) {
+			if (errno != EEXIST) {
+				LOG_ERROR("Failed to create file %s, errno: %d", path.c_str(), errno);
+			}
+			return false;
+		}
+
+		// file stays sparse, blocks are allocated as pages are written
+		if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0) {
+			LOG_ERROR("Failed to resize file %s, errno: %d", path.c_str(), errno);
+			close();
+			return false;
+		}
+
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (p == MAP_FAILED) {
+			LOG_ERROR("Failed to map file %s, errno: %d", path.c_str(), errno);
+			close();
+			return false;
+		}
+		m_data = static_cast<char*>(p);
+		m_size = size;
+		return true;
+	}
+
+	void MappedFile::Impl::close()
+	{
+		if (m_data) {
+			::munmap(m_data, m_size);
+			m_data = nullptr;
+			m_size = 0;
+		}
+		if (m_fd >= 0) {
+			::close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+	bool MappedFile::Impl::flush(uint64_t offset, uint64_t length)
+	{
+		// msync wants page aligned address
+		static const uint64_t s_pageMask = 4095;
+		const uint64_t begin = offset & ~s_pageMask;
+		if (::msync(m_data + begin, offset + length - begin, MS_ASYNC) != 0) {
+			LOG_ERROR("msync failed, errno: %d", errno);
+			return false;
+		}
+		return true;
+	}
+}
+
+#endif
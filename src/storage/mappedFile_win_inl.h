@@ -0,0 +1,96 @@
+#pragma once
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+namespace storage {
+
+	bool makeDir(const std::string& path)
+	{
+		if (!CreateDirectoryA(path.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+			LOG_ERROR("Failed to create directory %s, error: %lu", path.c_str(), GetLastError());
+			return false;
+		}
+		return true;
+	}
+
+	class MappedFile::Impl {
+	public:
+		Impl();
+
+		bool create(const std::string& path, uint64_t size);
+		void close();
+		bool flush(uint64_t offset, uint64_t length);
+
+		HANDLE m_file;
+		HANDLE m_mapping;
+		char* m_data;
+		uint64_t m_size;
+	};
+
+	MappedFile::Impl::Impl()
+		: m_file{ INVALID_HANDLE_VALUE }, m_mapping{ nullptr }, m_data{ nullptr }, m_size{ 0u }
+	{
+	}
+
+	bool MappedFile::Impl::create(const std::string& path, uint64_t size)
+	{
+		m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+			CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) {
+			if (GetLastError() != ERROR_FILE_EXISTS) {
+				LOG_ERROR("Failed to create file %s, error: %lu", path.c_str(), GetLastError());
+			}
+			return false;
+		}
+
+		// mapping of given size extends the file
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xffffffff), nullptr);
+		if (!m_mapping) {
+			LOG_ERROR("Failed to create mapping for %s, error: %lu", path.c_str(), GetLastError());
+			close();
+			return false;
+		}
+
+		m_data = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(size)));
+		if (!m_data) {
+			LOG_ERROR("Failed to map file %s, error: %lu", path.c_str(), GetLastError());
+			close();
+			return false;
+		}
+		m_size = size;
+		return true;
+	}
+
+	void MappedFile::Impl::close()
+	{
+		if (m_data) {
+			UnmapViewOfFile(m_data);
+			m_data = nullptr;
+			m_size = 0;
+		}
+		if (m_mapping) {
+			CloseHandle(m_mapping);
+			m_mapping = nullptr;
+		}
+		if (m_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	bool MappedFile::Impl::flush(uint64_t offset, uint64_t length)
+	{
+		// FlushViewOfFile only starts the write, like MS_ASYNC
+		if (!FlushViewOfFile(m_data + offset, static_cast<SIZE_T>(length))) {
+			LOG_ERROR("FlushViewOfFile failed, error: %lu", GetLastError());
+			return false;
+		}
+		return true;
+	}
+}
+
+#endif
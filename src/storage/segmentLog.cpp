@@ -0,0 +1,193 @@
+#include "segmentLog.h"
+
+#include <cstdio>
+#include <cstring> // memcpy
+#include <functional>
+
+#include "mappedFile.h"
+#include "../containers/hashTable.h"
+#include "../utils/log.h"
+
+namespace storage {
+
+	namespace {
+		const char s_magic[8] = { 'A', 'T', 'T', 'O', 'S', 'E', 'G', '1' };
+
+		const int s_versionOffset = 8;
+		const int s_recordSizeOffset = 12;
+		const int s_countOffset = 16;
+		const int s_minIdOffset = 24;
+		const int s_maxIdOffset = 32;
+	}
+
+	struct SegmentLog::Segment {
+		struct IndexEntry {
+			data::MsgId m_id;
+			uint32_t m_record;
+		};
+
+		struct IndexKey {
+			inline data::MsgId operator()(const IndexEntry& e) const noexcept
+			{
+				return e.m_id;
+			}
+		};
+
+		using Index = cont::HashTable<IndexEntry, data::MsgId, data::MessageHasher, IndexKey, std::equal_to<data::MsgId>>;
+
+		MappedFile m_file;
+		uint32_t m_count;
+		uint32_t m_capacity;
+		data::MsgId m_minId;
+		data::MsgId m_maxId;
+		Index m_index;
+
+		inline char* _record(uint32_t idx) const
+		{
+			return m_file.data() + s_headerSize + static_cast<uint64_t>(idx) * data::wire::s_messageSize;
+		}
+
+		void _writeHeader()
+		{
+			using namespace data::wire;
+			char* h = m_file.data();
+			store<uint64_t>(h + s_countOffset, m_count);
+			store<uint64_t>(h + s_minIdOffset, m_minId);
+			store<uint64_t>(h + s_maxIdOffset, m_maxId);
+		}
+	};
+
+	SegmentLog::SegmentLog()
+		:
+		m_segmentSize{ s_defaultSegmentSize },
+		m_nextFileIdx{ 0 },
+		m_messageCount{ 0u }
+	{
+	}
+
+	SegmentLog::~SegmentLog()
+	{
+	}
+
+	bool SegmentLog::init(const std::string& dir, uint64_t segmentSize)
+	{
+		if (segmentSize < s_headerSize + data::wire::s_messageSize) {
+			LOG_ERROR("Segment size %llu is too small.", static_cast<unsigned long long>(segmentSize));
+			return false;
+		}
+		m_dir = dir;
+		m_segmentSize = segmentSize;
+		return makeDir(m_dir);
+	}
+
+	bool SegmentLog::append(const data::message* msgs, int count)
+	{
+		// writer is the only one who changes segment list, so reading its back is safe without lock
+		Segment* seg = m_segments.empty() ? nullptr : m_segments.back().get();
+		while (count > 0) {
+			if (!seg || seg->m_count == seg->m_capacity) {
+				seg = _newSegment();
+				if (!seg) {
+					return false;
+				}
+			}
+
+			const uint32_t first = seg->m_count;
+			const uint32_t free = seg->m_capacity - first;
+			const uint32_t n = static_cast<uint32_t>(count) < free ? static_cast<uint32_t>(count) : free;
+			for (uint32_t i = 0; i < n; ++i) {
+				data::SerialiseMessage(seg->_record(first + i), &msgs[i]);
+			}
+
+			{
+				sync::lock_guard lock{ m_lock };
+				for (uint32_t i = 0; i < n; ++i) {
+					const data::MsgId id = msgs[i].MessageId;
+					seg->m_index.insert({ id, first + i });
+					seg->m_minId = id < seg->m_minId ? id : seg->m_minId;
+					seg->m_maxId = id > seg->m_maxId ? id : seg->m_maxId;
+				}
+				seg->m_count += n;
+				m_messageCount += n;
+			}
+
+			seg->_writeHeader();
+			const uint64_t begin = s_headerSize + static_cast<uint64_t>(first) * data::wire::s_messageSize;
+			seg->m_file.flush(0, s_headerSize);
+			seg->m_file.flush(begin, static_cast<uint64_t>(n) * data::wire::s_messageSize);
+
+			msgs += n;
+			count -= static_cast<int>(n);
+		}
+		return true;
+	}
+
+	bool SegmentLog::get(data::MsgId id, data::message* out)
+	{
+		sync::lock_guard lock{ m_lock };
+		for (auto it = m_segments.rbegin(); it != m_segments.rend(); ++it) {
+			Segment& seg = **it;
+			if (seg.m_count == 0 || id < seg.m_minId || id > seg.m_maxId) {
+				continue;
+			}
+			Segment::IndexEntry* e = seg.m_index.get(id);
+			if (e) {
+				data::DeserialiseMessage(seg._record(e->m_record), out);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int SegmentLog::segmentCount()
+	{
+		sync::lock_guard lock{ m_lock };
+		return static_cast<int>(m_segments.size());
+	}
+
+	uint64_t SegmentLog::messageCount()
+	{
+		sync::lock_guard lock{ m_lock };
+		return m_messageCount;
+	}
+
+	SegmentLog::Segment* SegmentLog::_newSegment()
+	{
+		std::unique_ptr<Segment> seg{ new Segment() };
+		const uint64_t capacity = (m_segmentSize - s_headerSize) / data::wire::s_messageSize;
+		seg->m_capacity = static_cast<uint32_t>(capacity < 0xffffffffull ? capacity : 0xffffffffull);
+		seg->m_count = 0;
+		seg->m_minId = ~0ull;
+		seg->m_maxId = 0;
+
+		// files of earlier runs are kept, numbering continues after them
+		char name[32];
+		bool created = false;
+		while (!created && m_nextFileIdx < 1000000) {
+			snprintf(name, sizeof(name), "/segment_%06d.log", m_nextFileIdx++);
+			created = seg->m_file.create(m_dir + name, m_segmentSize);
+		}
+		if (!created) {
+			LOG_ERROR("Failed to create new segment in %s.", m_dir.c_str());
+			return nullptr;
+		}
+
+		// index grows with segment, it starts small since last segment is usually not full
+		const uint64_t indexSize = seg->m_capacity + seg->m_capacity / 4;
+		if (!seg->m_index.init(1024, static_cast<int>(indexSize < (1u << 30) ? indexSize : (1u << 30)))) {
+			LOG_ERROR("Failed to create index for segment %s.", seg->m_file.path().c_str());
+			return nullptr;
+		}
+
+		char* h = seg->m_file.data();
+		memcpy(h, s_magic, sizeof(s_magic));
+		data::wire::store<uint32_t>(h + s_versionOffset, s_version);
+		data::wire::store<uint32_t>(h + s_recordSizeOffset, data::wire::s_messageSize);
+		seg->_writeHeader();
+		LOG_INFO("New segment %s, %u messages.", seg->m_file.path().c_str(), seg->m_capacity);
+
+		sync::lock_guard lock{ m_lock };
+		m_segments.push_back(std::move(seg));
+		return m_segments.back().get();
+	}
+}
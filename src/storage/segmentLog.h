@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../logic/message.h"
+#include "../utils/spinlock.h"
+
+namespace storage {
+
+	// append only log of messages split into fixed size memory mapped segment files
+	// segment layout: | header (s_headerSize) | records in wire format, wire::s_messageSize each |
+	// header: magic u64 | version u32 | record size u32 | count u64 | min id u64 | max id u64
+	// every segment keeps in memory index id -> record, so lookups don't scan files.
+	// one thread appends, any thread may look up
+	class SegmentLog {
+	public:
+		static const uint64_t s_defaultSegmentSize = 64ull << 20;
+		static const int s_headerSize = 64;
+		static const uint32_t s_version = 1;
+
+	public:
+		SegmentLog();
+		~SegmentLog();
+
+		SegmentLog(const SegmentLog&) = delete;
+		SegmentLog& operator=(const SegmentLog&) = delete;
+
+		// segments are created in dir as segment_<n>.log, existing files are never overwritten
+		bool init(const std::string& dir, uint64_t segmentSize = s_defaultSegmentSize);
+
+		// returns false if new segment can't be created, messages which didn't fit are lost
+		bool append(const data::message* msgs, int count);
+
+		// newest segment wins if id was written more than once
+		bool get(data::MsgId id, data::message* out);
+
+		int segmentCount();
+		uint64_t messageCount();
+
+	private:
+		struct Segment;
+
+		Segment* _newSegment();
+
+	private:
+		std::string m_dir;
+		uint64_t m_segmentSize;
+		int m_nextFileIdx;
+		// guards segment list and indexes, record bytes are written before they are indexed
+		sync::spinlock m_lock;
+		std::vector<std::unique_ptr<Segment>> m_segments;
+		uint64_t m_messageCount;
+	};
+}
@@ -79,6 +79,11 @@ namespace math {
 		return min + (max - min) * res;
 	}
 
+	void SetRandomSeed(unsigned int seed)
+	{
+		g_random.SetRandomSeed(seed);
+	}
+
 	GCCRandom::GCCRandom(void)
 	{
 		rseed = 1;
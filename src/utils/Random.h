@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace math {
 
 	/*
@@ -26,4 +28,49 @@ namespace math {
 	 * Return random float in range [min, max)
 	*/
 	float RandomF(float min, float max);
+
+	/*
+	 * Seed shared generator, it is seeded with time by default
+	*/
+	void SetRandomSeed(unsigned int seed);
+
+	/*
+	 * Generator with own state (xorshift64*), for one thread,
+	 * same seed gives the same sequence
+	*/
+	class FastRandom
+	{
+	public:
+		explicit FastRandom(uint64_t seed = 1) { SetSeed(seed); }
+
+		void SetSeed(uint64_t seed)
+		{
+			// splitmix step, so close seeds give unrelated sequences and state is never 0
+			uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			m_state = (z ^ (z >> 31)) | 1u;
+		}
+
+		uint64_t Next()
+		{
+			m_state ^= m_state >> 12;
+			m_state ^= m_state << 25;
+			m_state ^= m_state >> 27;
+			return m_state * 0x2545f4914f6cdd1dull;
+		}
+
+		/*
+		 * Return random unsigned interger in range [0, x)
+		*/
+		uint32_t Random(uint32_t x) { return x ? static_cast<uint32_t>((Next() >> 32) % x) : 0u; }
+
+		/*
+		 * Return random double in range [0.0, 1.0)
+		*/
+		double RandomD() { return static_cast<double>(Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	private:
+		uint64_t m_state;
+	};
 }
\ No newline at end of file
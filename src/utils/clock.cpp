@@ -0,0 +1,125 @@
+#include "clock.h"
+
+#include <thread>
+
+#include "thread.h"
+
+double utils::TscClock::s_nsPerTick = 0.0;
+uint64_t utils::TscClock::s_baseTicks = 0;
+uint64_t utils::TscClock::s_baseNs = 0;
+
+const int utils::CoarseClock::s_tickUs;
+std::atomic<uint64_t> utils::CoarseClock::s_now{ 0 };
+
+namespace {
+#ifdef ATTO_HAS_TSC
+	void _cpuid(int leaf, int* regs)
+	{
+#ifdef _MSC_VER
+		__cpuid(regs, leaf);
+#else
+		__asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(0));
+#endif
+	}
+
+	// counter runs at constant rate in every power state and is synchronised between cores
+	bool _hasInvariantTsc()
+	{
+		int regs[4];
+		_cpuid(static_cast<int>(0x80000000), regs);
+		if (static_cast<unsigned int>(regs[0]) < 0x80000007u) {
+			return false;
+		}
+		_cpuid(static_cast<int>(0x80000007), regs);
+		return (regs[3] & (1 << 8)) != 0;
+	}
+
+	// steady clock stamp and tick count of the same moment: ticks are read around the clock
+	// call and the tightest of a few tries is taken, so vDSO cost doesn't skew calibration
+	void _stampPair(uint64_t* ns, uint64_t* ticks)
+	{
+		uint64_t best = UINT64_MAX;
+		for (int i = 0; i < 8; ++i) {
+			const uint64_t before = __rdtsc();
+			const uint64_t now = utils::SteadyClock::nowNs();
+			const uint64_t after = __rdtsc();
+			if (after - before < best) {
+				best = after - before;
+				*ns = now;
+				*ticks = before + (after - before) / 2;
+			}
+		}
+	}
+#endif
+
+	// runs at startup, so clock works before main
+	const bool s_calibrated = utils::TscClock::calibrate(2000);
+}
+
+bool utils::TscClock::calibrate(int calibrationUs)
+{
+#ifdef ATTO_HAS_TSC
+	if (!_hasInvariantTsc()) {
+		return false;
+	}
+	uint64_t ns0 = 0;
+	uint64_t ticks0 = 0;
+	_stampPair(&ns0, &ticks0);
+	while (SteadyClock::nowNs() - ns0 < static_cast<uint64_t>(calibrationUs) * 1000u) {
+	}
+	uint64_t ns1 = 0;
+	uint64_t ticks1 = 0;
+	_stampPair(&ns1, &ticks1);
+	if (ticks1 <= ticks0) {
+		return false;
+	}
+	s_baseTicks = ticks1;
+	s_baseNs = ns1;
+	s_nsPerTick = static_cast<double>(ns1 - ns0) / static_cast<double>(ticks1 - ticks0);
+	return true;
+#else
+	(void)calibrationUs;
+	return false;
+#endif
+}
+
+namespace utils {
+
+	// owns thread which keeps CoarseClock up to date, stops it at exit
+	class ClockTicker {
+	public:
+		ClockTicker()
+			:
+			m_stopped{ false }
+		{
+			CoarseClock::s_now.store(SteadyClock::nowNs(), std::memory_order_relaxed);
+			m_thread = std::thread{ [this]() { _run(); } };
+		}
+
+		~ClockTicker()
+		{
+			m_stopped.store(true, std::memory_order_relaxed);
+			m_thread.join();
+		}
+
+	private:
+		void _run()
+		{
+			setCurrentThreadName("atto-clock");
+			while (!m_stopped.load(std::memory_order_relaxed)) {
+				std::this_thread::sleep_for(std::chrono::microseconds(CoarseClock::s_tickUs));
+				CoarseClock::s_now.store(SteadyClock::nowNs(), std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		std::atomic<bool> m_stopped;
+		std::thread m_thread;
+	};
+}
+
+void utils::CoarseClock::start()
+{
+	static ClockTicker s_ticker;
+	(void)s_ticker;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ATTO_HAS_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace utils {
+
+	// every clock here has static nowNs(), ns on steady clock timeline
+
+	// steady clock is system wide (CLOCK_MONOTONIC, QPC), so stamps of two processes
+	// on one host may be subtracted
+	struct SteadyClock {
+		static uint64_t nowNs()
+		{
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+	};
+
+	inline uint64_t monotonicNs()
+	{
+		return SteadyClock::nowNs();
+	}
+
+	// reads time stamp counter, no vDSO call. it is calibrated against steady clock before main,
+	// so values are comparable with SteadyClock up to drift of the calibration (ppm range).
+	// without invariant TSC (or on other cpus) it falls back to steady clock
+	class TscClock {
+	public:
+		static uint64_t nowNs()
+		{
+#ifdef ATTO_HAS_TSC
+			if (s_nsPerTick > 0.0) {
+				return s_baseNs + static_cast<uint64_t>(static_cast<double>(__rdtsc() - s_baseTicks) * s_nsPerTick);
+			}
+#endif
+			return SteadyClock::nowNs();
+		}
+
+		static bool usesTsc() { return s_nsPerTick > 0.0; }
+		static double ticksPerNs() { return s_nsPerTick > 0.0 ? 1.0 / s_nsPerTick : 0.0; }
+
+		// measures tick rate for about calibrationUs, done once at startup
+		static bool calibrate(int calibrationUs);
+
+	private:
+		static double s_nsPerTick;
+		static uint64_t s_baseTicks;
+		static uint64_t s_baseNs;
+	};
+
+	// last value the ticker thread stored, at most s_tickUs old, reading it is one load from
+	// a line only the ticker writes. until start() it reads steady clock
+	class CoarseClock {
+	public:
+		static const int s_tickUs = 1000;
+
+		static uint64_t nowNs()
+		{
+			const uint64_t now = s_now.load(std::memory_order_relaxed);
+			return now ? now : SteadyClock::nowNs();
+		}
+
+		// starts ticker thread once, it runs until process exits
+		static void start();
+
+	private:
+		friend class ClockTicker;
+		static std::atomic<uint64_t> s_now;
+	};
+}
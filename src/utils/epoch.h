@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+#include "spinlock.h"
+
+namespace sync {
+
+	// epoch based reclamation
+	// readers enter the domain (EpochGuard) and may keep pointers to shared objects until they leave.
+	// writer unlinks an object first and then retires it, deleter runs in collect() once every reader
+	// which was inside at the time of retire has left. readers never block writers and vice versa
+	class EpochDomain {
+	public:
+		using Deleter = void(*)(void*);
+
+		static const int s_maxThreads = 128;
+
+	public:
+		EpochDomain()
+			:
+			m_epoch{ 1u },
+			m_overflow{ 0 },
+			m_pending{ 0 }
+		{
+			for (int i = 0; i < s_maxThreads; ++i) {
+				m_slots[i].m_epoch.store(0, std::memory_order_relaxed);
+				m_slots[i].m_nest = 0;
+			}
+		}
+
+		// nobody may be inside at this point, so everything pending is reclaimed
+		~EpochDomain()
+		{
+			for (Retired& r : m_retired) {
+				r.m_deleter(r.m_ptr);
+			}
+		}
+
+		EpochDomain(const EpochDomain&) = delete;
+		EpochDomain& operator=(const EpochDomain&) = delete;
+
+		// guards may nest, only the outermost publishes epoch
+		void enter()
+		{
+			const int idx = _threadSlot();
+			if (idx < 0) {
+				// more threads than slots, such readers just hold off all reclamation
+				m_overflow.fetch_add(1, std::memory_order_seq_cst);
+				return;
+			}
+			Slot& s = m_slots[idx];
+			if (s.m_nest++ == 0) {
+				s.m_epoch.store(m_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				// epoch has to be visible before any shared pointer is read
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+
+		void leave()
+		{
+			const int idx = _threadSlot();
+			if (idx < 0) {
+				m_overflow.fetch_sub(1, std::memory_order_release);
+				return;
+			}
+			Slot& s = m_slots[idx];
+			if (--s.m_nest == 0) {
+				s.m_epoch.store(0, std::memory_order_release);
+			}
+		}
+
+		// object must be unreachable for new readers already
+		void retire(void* ptr, Deleter deleter)
+		{
+			const uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+			sync::lock_guard lock{ m_retiredLock };
+			m_retired.push_back({ ptr, deleter, epoch });
+			m_pending.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// runs deleters of objects no reader can see any more, returns number of them
+		int collect()
+		{
+			if (m_pending.load(std::memory_order_relaxed) == 0) {
+				return 0;
+			}
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_overflow.load(std::memory_order_acquire) > 0) {
+				return 0;
+			}
+			uint64_t oldest = ~0ull;
+			for (int i = 0; i < s_maxThreads; ++i) {
+				const uint64_t e = m_slots[i].m_epoch.load(std::memory_order_acquire);
+				if (e != 0 && e < oldest) {
+					oldest = e;
+				}
+			}
+
+			// reader which entered in epoch e may see everything retired in epoch >= e
+			std::vector<Retired> ready;
+			{
+				sync::lock_guard lock{ m_retiredLock };
+				size_t kept = 0;
+				for (size_t i = 0; i < m_retired.size(); ++i) {
+					if (m_retired[i].m_epoch < oldest) {
+						ready.push_back(m_retired[i]);
+					}
+					else {
+						m_retired[kept++] = m_retired[i];
+					}
+				}
+				m_retired.resize(kept);
+				m_pending.fetch_sub(static_cast<int>(ready.size()), std::memory_order_relaxed);
+			}
+
+			for (Retired& r : ready) {
+				r.m_deleter(r.m_ptr);
+			}
+			return static_cast<int>(ready.size());
+		}
+
+		int pending() const { return m_pending.load(std::memory_order_relaxed); }
+
+	private:
+		struct Retired {
+			void* m_ptr;
+			Deleter m_deleter;
+			uint64_t m_epoch;
+		};
+
+		// slot per thread, padded to a cache line so readers don't share lines
+		struct Slot {
+			std::atomic<uint64_t> m_epoch;
+			int m_nest;
+			char m_pad[64 - sizeof(std::atomic<uint64_t>) - sizeof(int)];
+		};
+
+		// thread gets a process wide slot index on first use and gives it back on exit,
+		// all domains share the index, -1 if all are taken
+		struct ThreadSlot {
+			int m_idx;
+
+			ThreadSlot()
+				: m_idx{ -1 }
+			{
+				std::atomic<bool>* used = _slotTable();
+				for (int i = 0; i < s_maxThreads; ++i) {
+					bool expected = false;
+					if (!used[i].load(std::memory_order_relaxed)
+						&& used[i].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+						m_idx = i;
+						return;
+					}
+				}
+			}
+
+			~ThreadSlot()
+			{
+				if (m_idx >= 0) {
+					_slotTable()[m_idx].store(false, std::memory_order_release);
+				}
+			}
+		};
+
+		static std::atomic<bool>* _slotTable()
+		{
+			static std::atomic<bool> s_used[s_maxThreads] = {};
+			return s_used;
+		}
+
+		static int _threadSlot()
+		{
+			thread_local ThreadSlot t_slot;
+			return t_slot.m_idx;
+		}
+
+	private:
+		std::atomic<uint64_t> m_epoch;
+		std::atomic<int> m_overflow;
+		std::atomic<int> m_pending;
+		Slot m_slots[s_maxThreads];
+		spinlock m_retiredLock;
+		std::vector<Retired> m_retired;
+	};
+
+	// keeps calling thread inside the domain, pointers read under it stay valid until it is destroyed
+	class EpochGuard
+	{
+		EpochDomain& m_domain;
+
+	public:
+		explicit EpochGuard(EpochDomain& domain)
+			: m_domain{ domain }
+		{
+			m_domain.enter();
+		}
+
+		~EpochGuard() {
+			m_domain.leave();
+		}
+
+		EpochGuard(const EpochGuard&) = delete;
+		EpochGuard& operator=(const EpochGuard&) = delete;
+	};
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#ifdef __linux
+#include "futex.h"
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace sync {
+
+	// lets a thread sleep until some condition (e.g. queue is not empty) may have changed
+	// waiter:
+	//   key = prepareWait(); if (condition) cancelWait(); else wait(key, timeout);
+	// notifier changes the condition and calls notify(), which is a fence and a load
+	// while nobody sleeps, so hot producers don't pay for a syscall
+	// linux sleeps on a futex, other platforms on a condition variable
+	class EventCount
+	{
+	public:
+		EventCount()
+			:
+			m_seq{ 0u },
+			m_waiters{ 0 }
+		{}
+
+		EventCount(const EventCount&) = delete;
+		EventCount& operator=(const EventCount&) = delete;
+
+		uint32_t prepareWait()
+		{
+			// RMW orders the waiter count before the condition check which follows
+			m_waiters.fetch_add(1, std::memory_order_seq_cst);
+			return m_seq.load(std::memory_order_seq_cst);
+		}
+
+		void cancelWait()
+		{
+			m_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// returns false on timeout, may return early (spurious wake)
+		template <typename Duration>
+		bool wait(uint32_t key, Duration timeout)
+		{
+			bool woken = true;
+#ifdef __linux
+			if (m_seq.load(std::memory_order_acquire) == key) {
+				woken = utils::futexWait(&m_seq, key, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+			}
+#else
+			std::unique_lock<std::mutex> lock{ m_lock };
+			woken = m_cv.wait_for(lock, timeout, [this, key]() { return m_seq.load(std::memory_order_acquire) != key; });
+#endif
+			m_waiters.fetch_sub(1, std::memory_order_relaxed);
+			return woken;
+		}
+
+		void notify()
+		{
+			// pairs with prepareWait: either waiter sees the new condition or we see the waiter
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (m_waiters.load(std::memory_order_relaxed) == 0) {
+				return;
+			}
+#ifdef __linux
+			m_seq.fetch_add(1, std::memory_order_release);
+			utils::futexWakeAll(&m_seq);
+#else
+			{
+				std::lock_guard<std::mutex> lock{ m_lock };
+				m_seq.fetch_add(1, std::memory_order_release);
+			}
+			m_cv.notify_all();
+#endif
+		}
+
+	private:
+		std::atomic<uint32_t> m_seq;
+		std::atomic<int> m_waiters;
+#ifndef __linux
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+#endif
+	};
+}
@@ -0,0 +1,25 @@
+#include "futex.h"
+
+#ifdef __linux
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace utils {
+	bool futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int64_t timeoutNs)
+	{
+		timespec ts{ static_cast<time_t>(timeoutNs / 1000000000), static_cast<long>(timeoutNs % 1000000000) };
+		// EAGAIN means value has changed already, EINTR is a spurious wake
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0) == 0
+			|| errno != ETIMEDOUT;
+	}
+
+	void futexWakeAll(std::atomic<uint32_t>* addr)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+	}
+}
+#endif
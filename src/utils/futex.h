@@ -0,0 +1,13 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// syscall wrappers live in futex.cpp: unistd.h declares ::sync(), which clashes with namespace sync
+namespace utils {
+#ifdef __linux
+	// sleeps while *addr == expected, returns false on timeout
+	bool futexWait(std::atomic<uint32_t>* addr, uint32_t expected, int64_t timeoutNs);
+	void futexWakeAll(std::atomic<uint32_t>* addr);
+#endif
+}
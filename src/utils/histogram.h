@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace utils {
+
+	// log-linear (HDR style) histogram of non negative values, e.g. latencies in ns
+	// - values below 2^s_subBits have a bucket each
+	// - every further power of two range is split into 2^(s_subBits - 1) equal buckets,
+	//   so relative error stays below 1 / 2^(s_subBits - 1) (~1.6%) over the whole u64 range
+	// record is a few instructions and never allocates, one writer per histogram,
+	// per thread histograms are merged for reporting
+	class Histogram
+	{
+	public:
+		static const int s_subBits = 7;
+		static const int s_subCount = 1 << s_subBits;
+		static const int s_halfCount = s_subCount / 2;
+		static const int s_bucketCount = (64 - s_subBits + 1) * s_halfCount + s_halfCount;
+
+	public:
+		Histogram()
+		{
+			reset();
+		}
+
+		void reset()
+		{
+			memset(m_buckets, 0, sizeof(m_buckets));
+			m_count = 0;
+			m_sum = 0;
+			m_min = UINT64_MAX;
+			m_max = 0;
+		}
+
+		void record(uint64_t v)
+		{
+			m_buckets[_index(v)]++;
+			m_count++;
+			m_sum += v;
+			m_min = v < m_min ? v : m_min;
+			m_max = v > m_max ? v : m_max;
+		}
+
+		void merge(const Histogram& other)
+		{
+			for (int i = 0; i < s_bucketCount; ++i) {
+				m_buckets[i] += other.m_buckets[i];
+			}
+			m_count += other.m_count;
+			m_sum += other.m_sum;
+			m_min = other.m_min < m_min ? other.m_min : m_min;
+			m_max = other.m_max > m_max ? other.m_max : m_max;
+		}
+
+		uint64_t count() const { return m_count; }
+		uint64_t min() const { return m_count ? m_min : 0; }
+		uint64_t max() const { return m_max; }
+		double mean() const { return m_count ? static_cast<double>(m_sum) / m_count : 0.0; }
+
+		// value at percentile p (0 - 100), middle of the bucket which holds it, never above max
+		uint64_t percentile(double p) const
+		{
+			if (m_count == 0) {
+				return 0;
+			}
+			uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(m_count) + 0.5);
+			rank = rank < 1 ? 1 : (rank > m_count ? m_count : rank);
+
+			uint64_t seen = 0;
+			for (int i = 0; i < s_bucketCount; ++i) {
+				seen += m_buckets[i];
+				if (seen >= rank) {
+					const uint64_t mid = _lowest(i) + (_width(i) >> 1);
+					return mid > m_max ? m_max : (mid < m_min ? m_min : mid);
+				}
+			}
+			return m_max;
+		}
+
+		// one line summary, values are ns and printed as us
+		std::string describe() const
+		{
+			char buf[192];
+			snprintf(buf, sizeof(buf), "n %llu, p50 %.1fus, p99 %.1fus, p99.9 %.1fus, max %.1fus",
+				static_cast<unsigned long long>(m_count), percentile(50.0) / 1e3, percentile(99.0) / 1e3,
+				percentile(99.9) / 1e3, max() / 1e3);
+			return buf;
+		}
+
+	private:
+		static int _msb(uint64_t v)
+		{
+#if defined(_MSC_VER)
+			unsigned long idx = 0;
+			_BitScanReverse64(&idx, v);
+			return static_cast<int>(idx);
+#else
+			return 63 - __builtin_clzll(v);
+#endif
+		}
+
+		// range [2^(s_subBits + g - 1), 2^(s_subBits + g)) is bucket group g,
+		// v >> g falls into [s_halfCount, s_subCount) there
+		static int _index(uint64_t v)
+		{
+			if (v < static_cast<uint64_t>(s_subCount)) {
+				return static_cast<int>(v);
+			}
+			const int g = _msb(v) - s_subBits + 1;
+			return g * s_halfCount + static_cast<int>(v >> g);
+		}
+
+		static uint64_t _lowest(int idx)
+		{
+			if (idx < s_subCount) {
+				return static_cast<uint64_t>(idx);
+			}
+			const int g = idx / s_halfCount - 1;
+			return static_cast<uint64_t>(idx - g * s_halfCount) << g;
+		}
+
+		static uint64_t _width(int idx)
+		{
+			return idx < s_subCount ? 1u : 1ull << (idx / s_halfCount - 1);
+		}
+
+	private:
+		uint64_t m_buckets[s_bucketCount];
+		uint64_t m_count;
+		uint64_t m_sum;
+		uint64_t m_min;
+		uint64_t m_max;
+	};
+}
@@ -0,0 +1,546 @@
+#include "log.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock.h"
+#include "eventCount.h"
+#include "thread.h"
+
+namespace {
+	using utils::Logger;
+	using Header = Logger::RecordHeader;
+
+	const uint32_t s_ringSize = 1u << 16;
+	// bigger records are formatted right away on calling thread
+	const uint32_t s_maxRecordSize = s_ringSize / 4;
+	// output is written in chunks of about this size
+	const size_t s_chunkSize = 1u << 16;
+	// logger thread looks at rings this often, writers wake it earlier only for errors
+	// and when their ring is half full, so a log call costs no syscall
+	const int s_pollMs = 10;
+
+	// set when logger thread is gone for good, later records are written synchronously
+	std::atomic<bool> s_shutDown{ false };
+
+	// records of one thread, single producer and logger thread as consumer.
+	// record never wraps: tail of the buffer which can't hold it is skipped, by a header with
+	// null site, or implicitly when even a header doesn't fit
+	class LogRing
+	{
+	public:
+		// new doesn't align to cache line in C++14, so ring is placed in a bigger block
+		static LogRing* create()
+		{
+			char* storage = new char[sizeof(LogRing) + 64];
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(storage);
+			LogRing* r = new (reinterpret_cast<void*>((addr + 63) & ~static_cast<uintptr_t>(63))) LogRing{};
+			r->m_storage = storage;
+			return r;
+		}
+
+		struct Deleter {
+			void operator()(LogRing* r) const
+			{
+				char* storage = r->m_storage;
+				r->~LogRing();
+				delete[] storage;
+			}
+		};
+
+		LogRing()
+			:
+			m_buf{ new char[s_ringSize] },
+			m_head{ 0 },
+			m_tail{ 0 },
+			m_closed{ false },
+			m_cachedTail{ 0 },
+			m_wokenAt{ UINT64_MAX },
+			m_pad{ 0 },
+			m_storage{ nullptr }
+		{}
+
+		LogRing(const LogRing&) = delete;
+		LogRing& operator=(const LogRing&) = delete;
+
+		// producer, nullptr while ring is full
+		char* reserve(uint32_t size)
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			const uint32_t off = static_cast<uint32_t>(head & (s_ringSize - 1));
+			const uint32_t pad = s_ringSize - off < size ? s_ringSize - off : 0u;
+			if (head + pad + size - m_cachedTail > s_ringSize) {
+				m_cachedTail = m_tail.load(std::memory_order_acquire);
+				if (head + pad + size - m_cachedTail > s_ringSize) {
+					return nullptr;
+				}
+			}
+
+			m_pad = pad;
+			if (pad >= sizeof(Header)) {
+				Header* skip = reinterpret_cast<Header*>(m_buf.get() + off);
+				skip->m_site = nullptr;
+				skip->m_size = pad;
+			}
+			return m_buf.get() + (pad ? 0u : off);
+		}
+
+		void commit(uint32_t size)
+		{
+			m_head.store(m_head.load(std::memory_order_relaxed) + m_pad + size, std::memory_order_release);
+		}
+
+		void close() { m_closed.store(true, std::memory_order_release); }
+		bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+		// consumer, next record or nullptr
+		const Header* peek()
+		{
+			const uint64_t head = m_head.load(std::memory_order_acquire);
+			uint64_t tail = m_tail.load(std::memory_order_relaxed);
+			while (tail != head) {
+				const uint32_t off = static_cast<uint32_t>(tail & (s_ringSize - 1));
+				if (s_ringSize - off < sizeof(Header)) {
+					tail += s_ringSize - off;
+					continue;
+				}
+				const Header* h = reinterpret_cast<const Header*>(m_buf.get() + off);
+				if (!h->m_site) {
+					tail += h->m_size;
+					continue;
+				}
+				m_tail.store(tail, std::memory_order_release);
+				return h;
+			}
+			m_tail.store(tail, std::memory_order_release);
+			return nullptr;
+		}
+
+		// drops record returned by peek
+		void pop(const Header* h)
+		{
+			m_tail.store(m_tail.load(std::memory_order_relaxed) + h->m_size, std::memory_order_release);
+		}
+
+		bool empty() const
+		{
+			return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+		}
+
+		// producer, true when ring got over half full and consumer didn't move since
+		// the last time, so a slow consumer is woken once and not on every record
+		bool needsWake()
+		{
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			if (head - m_cachedTail <= s_ringSize / 2) {
+				return false;
+			}
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+			if (head - m_cachedTail <= s_ringSize / 2 || m_cachedTail == m_wokenAt) {
+				return false;
+			}
+			m_wokenAt = m_cachedTail;
+			return true;
+		}
+
+	private:
+		std::unique_ptr<char[]> m_buf;
+		alignas(64) std::atomic<uint64_t> m_head;
+		alignas(64) std::atomic<uint64_t> m_tail;
+		std::atomic<bool> m_closed;
+		// producer only
+		alignas(64) uint64_t m_cachedTail;
+		uint64_t m_wokenAt;
+		uint32_t m_pad;
+		char* m_storage;
+	};
+
+	void _appendDecimal(std::string& out, uint64_t v, bool negative)
+	{
+		char buf[24];
+		char* p = buf + sizeof(buf);
+		do {
+			*--p = static_cast<char>('0' + v % 10);
+			v /= 10;
+		} while (v);
+		if (negative) {
+			*--p = '-';
+		}
+		out.append(p, buf + sizeof(buf) - p);
+	}
+
+	// printf conversion of one argument, length modifiers of fmt are replaced
+	// by the width argument was stored with
+	void _formatArg(std::string& out, const char* spec, size_t specLen, char conv, const char*& arg)
+	{
+		const Logger::ArgTag tag = static_cast<Logger::ArgTag>(*arg++);
+		char fmt[40];
+		memcpy(fmt, spec, specLen);
+		char buf[512];
+
+		if (tag == Logger::TagString) {
+			uint32_t len;
+			memcpy(&len, arg, sizeof(len));
+			const char* s = arg + sizeof(len);
+			arg += sizeof(len) + len + 1;
+			if (conv != 's') {
+				out += "(?)";
+			}
+			else if (specLen == 1) {
+				out.append(s, len);
+			}
+			else {
+				fmt[specLen] = 's';
+				fmt[specLen + 1] = '\0';
+				std::string padded(len + 64, '\0');
+				const int n = snprintf(&padded[0], padded.size(), fmt, s);
+				out.append(padded.data(), n < 0 ? 0 : (static_cast<size_t>(n) < padded.size() ? n : padded.size() - 1));
+			}
+			return;
+		}
+
+		uint64_t raw;
+		memcpy(&raw, arg, sizeof(raw));
+		arg += sizeof(raw);
+		int64_t sval = 0;
+		double dval = 0.0;
+		memcpy(&sval, &raw, sizeof(raw));
+		memcpy(&dval, &raw, sizeof(raw));
+		const bool isDouble = tag == Logger::TagDouble;
+
+		// plain %d and %u are most of what is logged, they skip snprintf
+		if (specLen == 1 && !isDouble && tag != Logger::TagPointer) {
+			if (conv == 'd' || conv == 'i') {
+				_appendDecimal(out, sval < 0 ? 0 - raw : raw, sval < 0);
+				return;
+			}
+			if (conv == 'u') {
+				_appendDecimal(out, raw, false);
+				return;
+			}
+		}
+
+		int n = -1;
+		if (strchr("diouxXc", conv)) {
+			size_t i = specLen;
+			if (conv != 'c') {
+				fmt[i++] = 'l';
+				fmt[i++] = 'l';
+			}
+			fmt[i++] = conv;
+			fmt[i] = '\0';
+			const long long v = isDouble ? static_cast<long long>(dval) : static_cast<long long>(sval);
+			n = conv == 'c' ? snprintf(buf, sizeof(buf), fmt, static_cast<int>(v)) : snprintf(buf, sizeof(buf), fmt, v);
+		}
+		else if (strchr("fFeEgGaA", conv)) {
+			fmt[specLen] = conv;
+			fmt[specLen + 1] = '\0';
+			const double v = isDouble ? dval : (tag == Logger::TagInt ? static_cast<double>(sval) : static_cast<double>(raw));
+			n = snprintf(buf, sizeof(buf), fmt, v);
+		}
+		else if (conv == 'p') {
+			fmt[specLen] = 'p';
+			fmt[specLen + 1] = '\0';
+			n = snprintf(buf, sizeof(buf), fmt, reinterpret_cast<void*>(static_cast<uintptr_t>(raw)));
+		}
+		else {
+			out += "(?)";
+			return;
+		}
+		if (n > 0) {
+			out.append(buf, static_cast<size_t>(n) < sizeof(buf) ? n : sizeof(buf) - 1);
+		}
+	}
+
+	void _format(const Header* h, std::string& out)
+	{
+		static const char* s_prefix[] = { "[DEBUG] ", "[INFO] ", "[ERROR] " };
+		out += s_prefix[static_cast<int>(h->m_site->m_level)];
+
+		const char* arg = reinterpret_cast<const char*>(h + 1);
+		uint32_t left = h->m_argCount;
+		const char* f = h->m_site->m_fmt;
+		while (*f) {
+			const char* pct = strchr(f, '%');
+			if (!pct) {
+				out += f;
+				break;
+			}
+			out.append(f, pct - f);
+			f = pct + 1;
+			if (*f == '%') {
+				out += '%';
+				++f;
+				continue;
+			}
+
+			// flags, width and precision are kept, length modifiers are dropped
+			const char* spec = pct;
+			while (*f && strchr("-+ #0", *f)) {
+				++f;
+			}
+			while ((*f >= '0' && *f <= '9') || *f == '.') {
+				++f;
+			}
+			const size_t specLen = static_cast<size_t>(f - spec);
+			while (*f && strchr("hlLqjzt", *f)) {
+				++f;
+			}
+			const char conv = *f;
+			if (!conv) {
+				break;
+			}
+			++f;
+
+			if (left == 0 || specLen > 32) {
+				out += "(?)";
+				continue;
+			}
+			--left;
+			_formatArg(out, spec, specLen, conv, arg);
+		}
+		out += '\n';
+	}
+
+	void _write(FILE* out, const std::string& text)
+	{
+		if (!text.empty()) {
+			fwrite(text.data(), 1, text.size(), out);
+			fflush(out);
+		}
+	}
+
+	// owns rings of all threads, its thread drains them until process exits
+	class LogBackend
+	{
+	public:
+		static LogBackend& instance()
+		{
+			static LogBackend s_backend;
+			return s_backend;
+		}
+
+		~LogBackend()
+		{
+			m_stopped.store(true, std::memory_order_release);
+			m_event.notify();
+			if (m_thread.joinable()) {
+				m_thread.join();
+			}
+			// threads which could still log are gone, the last records are written here
+			_drain();
+			s_shutDown.store(true, std::memory_order_release);
+		}
+
+		LogRing* attach()
+		{
+			std::lock_guard<std::mutex> lock{ m_lock };
+			m_rings.emplace_back(LogRing::create());
+			return m_rings.back().get();
+		}
+
+		void wake() { m_event.notify(); }
+
+		FILE* output() const { return m_out.load(std::memory_order_acquire); }
+		void setOutput(FILE* out) { m_out.store(out, std::memory_order_release); }
+
+		void flush()
+		{
+			// drain which is running now may have missed our records, the one after it can't
+			const uint64_t target = m_written.load(std::memory_order_acquire) + 2;
+			m_flushRequests.fetch_add(1, std::memory_order_release);
+			m_event.notify();
+			while (m_written.load(std::memory_order_acquire) < target && !m_stopped.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+				m_event.notify();
+			}
+			m_flushRequests.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+	private:
+		LogBackend()
+			:
+			m_out{ stdout },
+			m_stopped{ false },
+			m_written{ 0 },
+			m_flushRequests{ 0 }
+		{
+			m_thread = std::thread{ [this]() { _run(); } };
+		}
+
+		void _run()
+		{
+			utils::setCurrentThreadName("atto-log");
+			while (!m_stopped.load(std::memory_order_acquire)) {
+				if (_drain()) {
+					continue;
+				}
+				const uint32_t key = m_event.prepareWait();
+				if (m_stopped.load(std::memory_order_acquire) || m_flushRequests.load(std::memory_order_acquire) > 0 || _pending()) {
+					m_event.cancelWait();
+					continue;
+				}
+				m_event.wait(key, std::chrono::milliseconds(s_pollMs));
+			}
+		}
+
+		bool _pending()
+		{
+			std::lock_guard<std::mutex> lock{ m_lock };
+			for (const std::unique_ptr<LogRing, LogRing::Deleter>& r : m_rings) {
+				if (!r->empty()) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// writes what all rings hold, oldest record first, returns whether there was anything
+		bool _drain()
+		{
+			{
+				std::lock_guard<std::mutex> lock{ m_lock };
+				// rings of finished threads are released once they are empty
+				for (size_t i = 0; i < m_rings.size();) {
+					if (m_rings[i]->closed() && m_rings[i]->empty()) {
+						m_rings[i] = std::move(m_rings.back());
+						m_rings.pop_back();
+						continue;
+					}
+					++i;
+				}
+				m_snapshot.clear();
+				for (const std::unique_ptr<LogRing, LogRing::Deleter>& r : m_rings) {
+					m_snapshot.push_back(r.get());
+				}
+			}
+
+			FILE* out = output();
+			bool any = false;
+			for (;;) {
+				LogRing* oldest = nullptr;
+				const Header* first = nullptr;
+				for (LogRing* r : m_snapshot) {
+					const Header* h = r->peek();
+					if (h && (!first || h->m_timeNs < first->m_timeNs)) {
+						oldest = r;
+						first = h;
+					}
+				}
+				if (!first) {
+					break;
+				}
+				_format(first, m_text);
+				oldest->pop(first);
+				any = true;
+				if (m_text.size() >= s_chunkSize) {
+					_write(out, m_text);
+					m_text.clear();
+				}
+			}
+			_write(out, m_text);
+			m_text.clear();
+			m_written.fetch_add(1, std::memory_order_release);
+			return any;
+		}
+
+	private:
+		std::atomic<FILE*> m_out;
+		std::mutex m_lock;
+		std::vector<std::unique_ptr<LogRing, LogRing::Deleter>> m_rings;
+		// logger thread only
+		std::vector<LogRing*> m_snapshot;
+		std::string m_text;
+		std::atomic<bool> m_stopped;
+		// number of finished drains
+		std::atomic<uint64_t> m_written;
+		std::atomic<int> m_flushRequests;
+		sync::EventCount m_event;
+		std::thread m_thread;
+	};
+
+	// ring of this thread, logger frees it after thread exit once it is drained
+	struct ThreadRing {
+		LogRing* m_ring = nullptr;
+		// records which don't go to the ring
+		std::vector<char> m_scratch;
+		bool m_scratchUsed = false;
+
+		~ThreadRing()
+		{
+			if (m_ring) {
+				m_ring->close();
+				m_ring = nullptr;
+			}
+		}
+	};
+
+	thread_local ThreadRing t_ring;
+}
+
+char* utils::Logger::_reserve(uint32_t size)
+{
+	ThreadRing& tr = t_ring;
+	if (size > s_maxRecordSize || s_shutDown.load(std::memory_order_acquire)) {
+		tr.m_scratch.resize(size);
+		tr.m_scratchUsed = true;
+		return tr.m_scratch.data();
+	}
+
+	LogBackend& backend = LogBackend::instance();
+	if (!tr.m_ring) {
+		tr.m_ring = backend.attach();
+	}
+	char* rec = nullptr;
+	while (!(rec = tr.m_ring->reserve(size))) {
+		// full ring means logger is behind, records are never dropped
+		backend.wake();
+		std::this_thread::yield();
+	}
+	tr.m_scratchUsed = false;
+	return rec;
+}
+
+void utils::Logger::_commit(char* rec, const LogSite* site, uint32_t size, uint32_t argCount)
+{
+	Header* h = reinterpret_cast<Header*>(rec);
+	h->m_site = site;
+	// records of different threads are ordered by it, TSC is synchronised between cores
+	h->m_timeNs = utils::TscClock::nowNs();
+	h->m_size = size;
+	h->m_argCount = argCount;
+
+	ThreadRing& tr = t_ring;
+	if (tr.m_scratchUsed) {
+		std::string text;
+		_format(h, text);
+		_write(s_shutDown.load(std::memory_order_acquire) ? stdout : LogBackend::instance().output(), text);
+		return;
+	}
+	tr.m_ring->commit(size);
+	if (site->m_level == LogLevel::Error || tr.m_ring->needsWake()) {
+		LogBackend::instance().wake();
+	}
+}
+
+void utils::Logger::flush()
+{
+	if (!s_shutDown.load(std::memory_order_acquire)) {
+		LogBackend::instance().flush();
+	}
+}
+
+void utils::Logger::setOutput(FILE* out)
+{
+	if (s_shutDown.load(std::memory_order_acquire)) {
+		return;
+	}
+	flush();
+	LogBackend::instance().setOutput(out);
+}
@@ -1,18 +1,182 @@
 #pragma once
 
-#include <stdio.h>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
 
-#ifdef WIN32
-#define myLogFunc printf_s
+// asynchronous binary logger
+// - LOG_* copies address of its call site (level and format) and raw argument bytes into
+//   a ring of the calling thread, formatting and stdout writes happen on logger thread
+// - %s arguments are copied, so c_str() of a temporary may die right after the call
+// - levels below ATTO_LOG_LEVEL are compiled out together with their argument expressions
+// - pending records of all threads are written in time order, everything is written before exit
+
+#define ATTO_LOG_LEVEL_DEBUG 0
+#define ATTO_LOG_LEVEL_INFO 1
+#define ATTO_LOG_LEVEL_ERROR 2
+#define ATTO_LOG_LEVEL_OFF 3
+
+#ifndef ATTO_LOG_LEVEL
+	#ifdef NDEBUG
+		#define ATTO_LOG_LEVEL ATTO_LOG_LEVEL_INFO
+	#else
+		#define ATTO_LOG_LEVEL ATTO_LOG_LEVEL_DEBUG
+	#endif
+#endif
+
+namespace utils {
+
+	enum class LogLevel : uint8_t {
+		Debug,
+		Info,
+		Error
+	};
+
+	// one per LOG_* statement, its address identifies format of a record
+	struct LogSite {
+		LogLevel m_level;
+		const char* m_fmt;
+	};
+
+	class Logger
+	{
+	public:
+		// longer %s arguments are cut
+		static const uint32_t s_maxStringArg = 1024;
+
+		enum ArgTag : uint8_t {
+			TagInt,
+			TagUint,
+			TagDouble,
+			TagString,
+			TagPointer
+		};
+
+		// record is header, then per argument a tag and its value,
+		// strings are u32 length and bytes with terminating zero
+		struct RecordHeader {
+			const LogSite* m_site;
+			uint64_t m_timeNs;
+			uint32_t m_size;
+			uint32_t m_argCount;
+		};
+
+		template <typename... Args>
+		static void write(const LogSite* site, Args... args)
+		{
+			uint32_t size = sizeof(RecordHeader);
+			int sizes[] = { 0, (size += _argSize(args), 0)... };
+			(void)sizes;
+			// records stay 8 byte aligned in the ring
+			size = (size + 7u) & ~7u;
+
+			char* rec = _reserve(size);
+			char* out = rec + sizeof(RecordHeader);
+			int encoded[] = { 0, (_encode(out, args), 0)... };
+			(void)encoded;
+			// unused by records without arguments
+			(void)out;
+			_commit(rec, site, size, static_cast<uint32_t>(sizeof...(Args)));
+		}
+
+		// blocks until everything logged before the call is written
+		static void flush();
+
+		// records are written to out from now on, pending ones are flushed to the old one first
+		static void setOutput(FILE* out);
+
+	private:
+		// space in calling thread ring, waits while logger thread drains a full ring
+		static char* _reserve(uint32_t size);
+		static void _commit(char* rec, const LogSite* site, uint32_t size, uint32_t argCount);
+
+		static uint32_t _stringLength(const char* s)
+		{
+			const size_t n = s ? strlen(s) : 0;
+			return static_cast<uint32_t>(n > s_maxStringArg ? s_maxStringArg : n);
+		}
+
+		static uint32_t _argSize(const char* s) { return 1 + sizeof(uint32_t) + _stringLength(s) + 1; }
+		static uint32_t _argSize(char* s) { return _argSize(static_cast<const char*>(s)); }
+		template <typename T>
+		static uint32_t _argSize(T) { return 1 + sizeof(uint64_t); }
+
+		template <typename T>
+		static void _put(char*& out, ArgTag tag, T v)
+		{
+			*out++ = static_cast<char>(tag);
+			memcpy(out, &v, sizeof(uint64_t));
+			out += sizeof(uint64_t);
+		}
+
+		static void _encode(char*& out, const char* s)
+		{
+			const uint32_t len = _stringLength(s);
+			*out++ = static_cast<char>(TagString);
+			memcpy(out, &len, sizeof(len));
+			out += sizeof(len);
+			if (len) {
+				memcpy(out, s, len);
+			}
+			out[len] = '\0';
+			out += len + 1;
+		}
+
+		static void _encode(char*& out, char* s) { _encode(out, static_cast<const char*>(s)); }
+
+		template <typename T>
+		static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type _encode(char*& out, T v)
+		{
+			_put(out, TagInt, static_cast<int64_t>(v));
+		}
+
+		template <typename T>
+		static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type _encode(char*& out, T v)
+		{
+			_put(out, TagUint, static_cast<uint64_t>(v));
+		}
+
+		template <typename T>
+		static typename std::enable_if<std::is_floating_point<T>::value>::type _encode(char*& out, T v)
+		{
+			_put(out, TagDouble, static_cast<double>(v));
+		}
+
+		template <typename T>
+		static typename std::enable_if<std::is_enum<T>::value>::type _encode(char*& out, T v)
+		{
+			_encode(out, static_cast<typename std::underlying_type<T>::type>(v));
+		}
+
+		template <typename T>
+		static void _encode(char*& out, const T* p)
+		{
+			_put(out, TagPointer, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p)));
+		}
+	};
+}
+
+// fmt has to be a string literal, argument expressions are evaluated only if the level is compiled in
+#define ATTO_LOG(lvl, fmt, ...) do { \
+		static const ::utils::LogSite s_logSite{ lvl, fmt }; \
+		::utils::Logger::write(&s_logSite, ## __VA_ARGS__); \
+	} while (0)
+
+#if ATTO_LOG_LEVEL <= ATTO_LOG_LEVEL_DEBUG
+	#define LOG_DEBUG(fmt, ...) ATTO_LOG(::utils::LogLevel::Debug, fmt, ## __VA_ARGS__)
 #else
-#define myLogFunc printf
+	#define LOG_DEBUG(...) do {} while (0)
 #endif
 
-#ifdef NDEBUG
-	#define LOG_DEBUG(...)
-#else 
-	#define LOG_DEBUG(fmt, ...) myLogFunc ("%s " fmt "\n", "[DEBUG]" , ## __VA_ARGS__)
+#if ATTO_LOG_LEVEL <= ATTO_LOG_LEVEL_INFO
+	#define LOG_INFO(fmt, ...) ATTO_LOG(::utils::LogLevel::Info, fmt, ## __VA_ARGS__)
+#else
+	#define LOG_INFO(...) do {} while (0)
 #endif
 
-#define LOG_INFO(fmt, ...) myLogFunc ("[INFO] " fmt "\n", ## __VA_ARGS__)
-#define LOG_ERROR(fmt, ...) myLogFunc ("[ERROR] " fmt "\n", ## __VA_ARGS__)
+#if ATTO_LOG_LEVEL <= ATTO_LOG_LEVEL_ERROR
+	#define LOG_ERROR(fmt, ...) ATTO_LOG(::utils::LogLevel::Error, fmt, ## __VA_ARGS__)
+#else
+	#define LOG_ERROR(...) do {} while (0)
+#endif
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdint.h>
+
+namespace utils {
+
+	// what server measures, counters only grow, gauges hold the last value their thread set
+	enum class Metric : int {
+		PacketsReceived,
+		BytesReceived,
+		Duplicates,
+		TargetMatches,
+		HandedOver,
+		ForwardedMessages,
+		ForwardWrites,
+		ForwardQueueDepth,
+		Count
+	};
+
+	static const int s_metricCount = static_cast<int>(Metric::Count);
+
+	inline const char* metricName(Metric m)
+	{
+		static const char* s_names[s_metricCount] = {
+			"packets_received",
+			"bytes_received",
+			"duplicates",
+			"target_matches",
+			"handed_over",
+			"forwarded_messages",
+			"forward_writes",
+			"forward_queue_depth"
+		};
+		return s_names[static_cast<int>(m)];
+	}
+
+	inline bool isGauge(Metric m)
+	{
+		return m == Metric::ForwardQueueDepth;
+	}
+
+	// values of one thread, only that thread writes them, so update is a relaxed load and
+	// store without lock prefix; slot spans whole cache lines, threads never share one
+	class MetricsSlot
+	{
+	public:
+		MetricsSlot()
+		{
+			for (int i = 0; i < s_metricCount; ++i) {
+				m_values[i].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		MetricsSlot(const MetricsSlot&) = delete;
+		MetricsSlot& operator=(const MetricsSlot&) = delete;
+
+		void add(Metric m, uint64_t n)
+		{
+			std::atomic<uint64_t>& v = m_values[static_cast<int>(m)];
+			v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		void set(Metric m, uint64_t val)
+		{
+			m_values[static_cast<int>(m)].store(val, std::memory_order_relaxed);
+		}
+
+		uint64_t get(Metric m) const
+		{
+			return m_values[static_cast<int>(m)].load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<uint64_t> m_values[s_metricCount];
+		char m_pad[64 - (sizeof(std::atomic<uint64_t>) * s_metricCount) % 64];
+	};
+
+	// hands out one slot per writer thread and sums them only when somebody reads
+	class MetricsRegistry
+	{
+	public:
+		static const int s_maxSlots = 64;
+
+	public:
+		MetricsRegistry()
+			:
+			m_storage{ new char[sizeof(MetricsSlot) * s_maxSlots + 64] },
+			m_used{ 0 }
+		{
+			// new[] doesn't align to cache line in C++14
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(m_storage);
+			m_slots = reinterpret_cast<MetricsSlot*>((addr + 63) & ~static_cast<uintptr_t>(63));
+			for (int i = 0; i < s_maxSlots; ++i) {
+				new (&m_slots[i]) MetricsSlot{};
+			}
+		}
+
+		~MetricsRegistry()
+		{
+			for (int i = 0; i < s_maxSlots; ++i) {
+				m_slots[i].~MetricsSlot();
+			}
+			delete[] m_storage;
+		}
+
+		MetricsRegistry(const MetricsRegistry&) = delete;
+		MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+		// nullptr when all slots are taken
+		MetricsSlot* registerThread()
+		{
+			const int idx = m_used.fetch_add(1, std::memory_order_relaxed);
+			return idx < s_maxSlots ? &m_slots[idx] : nullptr;
+		}
+
+		uint64_t read(Metric m) const
+		{
+			const int used = m_used.load(std::memory_order_relaxed);
+			uint64_t sum = 0;
+			for (int i = 0; i < used && i < s_maxSlots; ++i) {
+				sum += m_slots[i].get(m);
+			}
+			return sum;
+		}
+
+		// values has s_metricCount entries
+		void snapshot(uint64_t* values) const
+		{
+			for (int i = 0; i < s_metricCount; ++i) {
+				values[i] = read(static_cast<Metric>(i));
+			}
+		}
+
+	private:
+		char* m_storage;
+		MetricsSlot* m_slots;
+		std::atomic<int> m_used;
+	};
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif __linux
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace utils {
+
+	inline int numberOfCores()
+	{
+		unsigned int n = std::thread::hardware_concurrency();
+		return n == 0 ? 1 : static_cast<int>(n);
+	}
+
+	// binds calling thread to a single cpu, false for a cpu this machine doesn't have
+	inline bool pinCurrentThread(int cpu)
+	{
+		if (cpu < 0 || cpu >= numberOfCores()) {
+			return false;
+		}
+#ifdef WIN32
+		return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif __linux
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// name shows up in top -H, gdb and perf, linux keeps first 15 chars
+	inline void setCurrentThreadName(const std::string& name)
+	{
+#ifdef WIN32
+		std::wstring wname{ name.begin(), name.end() };
+		SetThreadDescription(GetCurrentThread(), wname.c_str());
+#elif __linux
+		pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#else
+		(void)name;
+#endif
+	}
+
+	// parses cpu list like "0-3,8,10-11" into cores in given order,
+	// false if it is malformed or names a cpu this machine doesn't have
+	inline bool parseCpuList(const std::string& list, std::vector<int>* cpus)
+	{
+		cpus->clear();
+		size_t pos = 0;
+		while (pos < list.size()) {
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos) {
+				end = list.size();
+			}
+			const std::string range = list.substr(pos, end - pos);
+			pos = end + 1;
+
+			int first = 0;
+			int last = 0;
+			const size_t dash = range.find('-');
+			char* tail = nullptr;
+			first = static_cast<int>(strtol(range.c_str(), &tail, 10));
+			if (tail == range.c_str() || first < 0) {
+				return false;
+			}
+			last = first;
+			if (dash != std::string::npos) {
+				const char* lastStr = range.c_str() + dash + 1;
+				last = static_cast<int>(strtol(lastStr, &tail, 10));
+				if (tail == lastStr || last < first) {
+					return false;
+				}
+			}
+			if (last >= numberOfCores()) {
+				return false;
+			}
+			for (int cpu = first; cpu <= last; ++cpu) {
+				cpus->push_back(cpu);
+			}
+		}
+		return !cpus->empty();
+	}
+}
@@ -0,0 +1,121 @@
+#include "threadGroup.h"
+
+#include <csignal>
+
+#include "log.h"
+#include "thread.h"
+
+namespace {
+	volatile std::sig_atomic_t s_stopSignalled = 0;
+
+	void onStopSignal(int)
+	{
+		s_stopSignalled = 1;
+	}
+}
+
+namespace utils {
+
+	ThreadGroup::ThreadGroup()
+		:
+		m_arrived{ 0 },
+		m_failed{ 0 },
+		m_released{ false },
+		m_running{ false }
+	{}
+
+	ThreadGroup::~ThreadGroup()
+	{
+		stop();
+	}
+
+	void ThreadGroup::setCpus(const std::vector<int>& cpus)
+	{
+		// cpu which isn't there leaves its worker unpinned instead of landing on another one
+		m_cpus = cpus;
+		for (int& cpu : m_cpus) {
+			if (cpu >= numberOfCores()) {
+				LOG_ERROR("There is no cpu %d (cpus 0-%d), worker isn't pinned.", cpu, numberOfCores() - 1);
+				cpu = -1;
+			}
+		}
+	}
+
+	void ThreadGroup::spawn(const std::string& name, Prepare prepare, Body body, Wake wake)
+	{
+		const int idx = size();
+		m_workers.emplace_back(new Worker{ name, idx < static_cast<int>(m_cpus.size()) ? m_cpus[idx] : -1, std::move(wake), {} });
+		Worker* w = m_workers.back().get();
+		w->m_thread = std::thread([this, w, prepare, body]() { _run(w, prepare, body); });
+	}
+
+	bool ThreadGroup::start()
+	{
+		{
+			std::unique_lock<std::mutex> lock{ m_lock };
+			m_cv.wait(lock, [this]() { return m_arrived == size(); });
+			m_running.store(m_failed == 0, std::memory_order_release);
+			m_released = true;
+		}
+		m_cv.notify_all();
+
+		if (!running()) {
+			LOG_ERROR("%d of %d workers failed to start.", m_failed, size());
+			stop();
+			return false;
+		}
+		return true;
+	}
+
+	void ThreadGroup::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_lock };
+			m_running.store(false, std::memory_order_release);
+			m_released = true;
+		}
+		m_cv.notify_all();
+
+		for (auto& w : m_workers) {
+			if (!w->m_thread.joinable()) {
+				continue;
+			}
+			if (w->m_wake) {
+				w->m_wake();
+			}
+			w->m_thread.join();
+		}
+	}
+
+	void ThreadGroup::_run(Worker* w, const Prepare& prepare, const Body& body)
+	{
+		if (w->m_cpu >= 0 && !pinCurrentThread(w->m_cpu)) {
+			LOG_ERROR("Failed to pin %s to cpu %d.", w->m_name.c_str(), w->m_cpu);
+		}
+		setCurrentThreadName(w->m_name);
+
+		const bool ok = !prepare || prepare();
+		{
+			std::unique_lock<std::mutex> lock{ m_lock };
+			++m_arrived;
+			m_failed += ok ? 0 : 1;
+			m_cv.notify_all();
+			m_cv.wait(lock, [this]() { return m_released; });
+		}
+
+		if (ok && running()) {
+			body();
+		}
+	}
+
+	void installStopSignals()
+	{
+		std::signal(SIGINT, onStopSignal);
+		std::signal(SIGTERM, onStopSignal);
+	}
+
+	bool stopSignalled()
+	{
+		return s_stopSignalled != 0;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+	// owns worker threads of one app
+	// - spawn() creates the thread right away, it pins itself to the next core of cpu list,
+	//   sets its name, runs prepare (socket setup etc.) and waits on the start barrier
+	// - start() waits until every worker is prepared and lets all bodies go at once
+	// - stop() calls wake of every worker, so it leaves blocking call (reactor, queue wait),
+	//   and joins it; workers go in spawn order, so producers finish before their consumers
+	// bodies run until running() turns false or their input is stopped
+	class ThreadGroup
+	{
+	public:
+		using Prepare = std::function<bool()>;
+		using Body = std::function<void()>;
+		using Wake = std::function<void()>;
+
+	public:
+		ThreadGroup();
+		~ThreadGroup();
+
+		ThreadGroup(const ThreadGroup&) = delete;
+		ThreadGroup& operator=(const ThreadGroup&) = delete;
+
+		// worker i is pinned to cpus[i], workers past the end of list or with a cpu
+		// this machine doesn't have aren't pinned
+		void setCpus(const std::vector<int>& cpus);
+
+		void spawn(const std::string& name, Prepare prepare, Body body, Wake wake);
+
+		// false if some prepare failed, workers are stopped then
+		bool start();
+		void stop();
+
+		bool running() const { return m_running.load(std::memory_order_acquire); }
+		int size() const { return static_cast<int>(m_workers.size()); }
+
+	private:
+		struct Worker {
+			std::string m_name;
+			int m_cpu;
+			Wake m_wake;
+			std::thread m_thread;
+		};
+
+		void _run(Worker* w, const Prepare& prepare, const Body& body);
+
+	private:
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::vector<int> m_cpus;
+		// start barrier
+		std::mutex m_lock;
+		std::condition_variable m_cv;
+		int m_arrived;
+		int m_failed;
+		bool m_released;
+		std::atomic<bool> m_running;
+	};
+
+	// SIGINT and SIGTERM only raise a flag, main thread polls it and stops workers
+	void installStopSignals();
+	bool stopSignalled();
+}
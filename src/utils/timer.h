@@ -1,37 +1,46 @@
 #pragma once
 
 #include <chrono>
+#include <stdint.h>
+
+#include "clock.h"
 
 namespace utils {
 
 	using millis = std::chrono::milliseconds;
 	using secs = std::chrono::seconds;
 
-	class Timer {
-	public:
-
-		using TimePoint = std::chrono::time_point<std::chrono::system_clock>;
-	
+	// time since construction or reset() on ClockType (see clock.h)
+	template <typename ClockType>
+	class BasicTimer {
 	public:
-		Timer()
+		BasicTimer()
 		{
-			m_timestamp = std::chrono::system_clock::now();
+			m_timestamp = ClockType::nowNs();
 		}
-		~Timer() {}
 
 		void reset()
 		{
-			m_timestamp = std::chrono::system_clock::now();
+			m_timestamp = ClockType::nowNs();
+		}
+
+		uint64_t elapsedNs() const
+		{
+			const uint64_t now = ClockType::nowNs();
+			return now > m_timestamp ? now - m_timestamp : 0u;
 		}
 
 		template <typename Dur = millis>
-		bool hasPassed(unsigned int timePassed)
+		bool hasPassed(unsigned int timePassed) const
 		{
-			auto now = std::chrono::system_clock::now();
-			return std::chrono::duration_cast<Dur>(now - m_timestamp).count() > timePassed;
+			return std::chrono::duration_cast<Dur>(std::chrono::nanoseconds(elapsedNs())).count() > static_cast<long long>(timePassed);
 		}
 
 	private:
-		TimePoint m_timestamp;
+		uint64_t m_timestamp;
 	};
-}
\ No newline at end of file
+
+	using Timer = BasicTimer<SteadyClock>;
+	using TscTimer = BasicTimer<TscClock>;
+	using CoarseTimer = BasicTimer<CoarseClock>;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+namespace utils {
+
+	// hashed hierarchical timer wheel, owned and advanced by one thread (e.g. a reactor loop)
+	// - s_levels wheels of s_slots slots, level l slot spans s_slots^l ticks, so
+	//   range is s_slots^s_levels ticks (~4.6 hours with 1 ms tick), later timers are
+	//   parked at the top level and placed again when it turns
+	// - schedule and cancel are O(1): timers are intrusive list nodes in a pool, id carries
+	//   node index and its generation, so cancel of a fired or reused id is a no-op
+	// - advance() moves time tick by tick, timers of a slot run when it is reached,
+	//   higher level slot is spread over lower levels when lower wheel wraps
+	// callbacks run inside advance() and may schedule and cancel timers
+	class TimerWheel
+	{
+	public:
+		using Callback = std::function<void()>;
+		// 0 is never a valid id
+		using TimerId = uint64_t;
+
+		static const int s_slotBits = 6;
+		static const int s_slots = 1 << s_slotBits;
+		static const int s_levels = 4;
+
+	public:
+		explicit TimerWheel(uint64_t tickMs = 1)
+			:
+			m_tickMs{ tickMs ? tickMs : 1u },
+			m_nowTick{ 0 },
+			m_free{ s_nil },
+			m_size{ 0 }
+		{
+			for (int i = 0; i < s_levels * s_slots; ++i) {
+				m_heads[i] = s_nil;
+			}
+		}
+
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+
+		// sets current time without running anything, for wheel which is still empty
+		void init(uint64_t nowMs) { m_nowTick = nowMs / m_tickMs; }
+
+		// time of the last advance, callers may use it as a cheap "now"
+		uint64_t nowMs() const { return m_nowTick * m_tickMs; }
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+
+		// runs cb delayMs after the last advance, at least one tick later
+		TimerId schedule(uint64_t delayMs, Callback cb)
+		{
+			uint32_t idx = m_free;
+			if (idx == s_nil) {
+				idx = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.emplace_back();
+			}
+			else {
+				m_free = m_nodes[idx].m_next;
+			}
+
+			Node& n = m_nodes[idx];
+			const uint64_t ticks = (delayMs + m_tickMs - 1) / m_tickMs;
+			n.m_expiry = m_nowTick + (ticks ? ticks : 1u);
+			n.m_cb = std::move(cb);
+			n.m_active = true;
+			_link(idx);
+			m_size++;
+			return (static_cast<uint64_t>(n.m_gen) << 32) | (static_cast<uint64_t>(idx) + 1);
+		}
+
+		// false if timer already ran or was cancelled
+		bool cancel(TimerId id)
+		{
+			const uint32_t idx = static_cast<uint32_t>(id & 0xffffffffu) - 1;
+			if (id == 0 || idx >= m_nodes.size()) {
+				return false;
+			}
+			Node& n = m_nodes[idx];
+			if (!n.m_active || n.m_gen != static_cast<uint32_t>(id >> 32)) {
+				return false;
+			}
+			_unlink(idx);
+			_release(idx);
+			return true;
+		}
+
+		// runs every timer which expired by nowMs, returns their number
+		int advance(uint64_t nowMs)
+		{
+			const uint64_t target = nowMs / m_tickMs;
+			if (m_size == 0) {
+				m_nowTick = target > m_nowTick ? target : m_nowTick;
+				return 0;
+			}
+
+			int fired = 0;
+			while (m_nowTick < target && m_size > 0) {
+				m_nowTick++;
+				// higher levels first, so timers they spread over level below are cascaded too
+				for (int level = s_levels - 1; level > 0; --level) {
+					if ((m_nowTick & ((1ull << (s_slotBits * level)) - 1)) == 0) {
+						_cascade(level, static_cast<int>((m_nowTick >> (s_slotBits * level)) & (s_slots - 1)));
+					}
+				}
+				fired += _expire(static_cast<int>(m_nowTick & (s_slots - 1)));
+			}
+			m_nowTick = target > m_nowTick ? target : m_nowTick;
+			return fired;
+		}
+
+		// ms until advance may have something to run, -1 when there are no timers.
+		// it is exact for timers within one turn of the lowest wheel, farther ones are
+		// reported as the next turn, where they are cascaded
+		int64_t msUntilNext() const
+		{
+			if (m_size == 0) {
+				return -1;
+			}
+			const uint64_t turn = s_slots - (m_nowTick & (s_slots - 1));
+			for (uint64_t t = 1; t < turn; ++t) {
+				if (m_heads[(m_nowTick + t) & (s_slots - 1)] != s_nil) {
+					return static_cast<int64_t>(t * m_tickMs);
+				}
+			}
+			return static_cast<int64_t>(turn * m_tickMs);
+		}
+
+	private:
+		static const uint32_t s_nil = 0xffffffffu;
+
+		struct Node {
+			uint64_t m_expiry = 0;
+			Callback m_cb;
+			uint32_t m_prev = s_nil;
+			uint32_t m_next = s_nil;
+			uint32_t m_gen = 0;
+			uint16_t m_slot = 0;
+			bool m_active = false;
+		};
+
+		// slot of node by distance from now: nearest level whose turn covers it
+		int _slotOf(uint64_t expiry) const
+		{
+			const uint64_t delta = expiry > m_nowTick ? expiry - m_nowTick : 0u;
+			for (int level = 0; level < s_levels; ++level) {
+				if (delta < (1ull << (s_slotBits * (level + 1)))) {
+					return level * s_slots + static_cast<int>((expiry >> (s_slotBits * level)) & (s_slots - 1));
+				}
+			}
+			// beyond range, parked in the top level slot which turns last
+			const int top = s_levels - 1;
+			const uint64_t park = m_nowTick + (1ull << (s_slotBits * s_levels)) - 1;
+			return top * s_slots + static_cast<int>((park >> (s_slotBits * top)) & (s_slots - 1));
+		}
+
+		void _link(uint32_t idx)
+		{
+			Node& n = m_nodes[idx];
+			const int slot = _slotOf(n.m_expiry);
+			n.m_slot = static_cast<uint16_t>(slot);
+			n.m_prev = s_nil;
+			n.m_next = m_heads[slot];
+			if (n.m_next != s_nil) {
+				m_nodes[n.m_next].m_prev = idx;
+			}
+			m_heads[slot] = idx;
+		}
+
+		void _unlink(uint32_t idx)
+		{
+			Node& n = m_nodes[idx];
+			if (n.m_prev != s_nil) {
+				m_nodes[n.m_prev].m_next = n.m_next;
+			}
+			else {
+				m_heads[n.m_slot] = n.m_next;
+			}
+			if (n.m_next != s_nil) {
+				m_nodes[n.m_next].m_prev = n.m_prev;
+			}
+		}
+
+		void _release(uint32_t idx)
+		{
+			Node& n = m_nodes[idx];
+			n.m_active = false;
+			n.m_gen++;
+			n.m_cb = nullptr;
+			n.m_next = m_free;
+			m_free = idx;
+			m_size--;
+		}
+
+		void _cascade(int level, int slot)
+		{
+			uint32_t idx = m_heads[level * s_slots + slot];
+			m_heads[level * s_slots + slot] = s_nil;
+			while (idx != s_nil) {
+				const uint32_t next = m_nodes[idx].m_next;
+				_link(idx);
+				idx = next;
+			}
+		}
+
+		// slot is taken apart node by node, so callbacks may cancel timers still in it.
+		// new timers never land in it, they are at least one tick ahead
+		int _expire(int slot)
+		{
+			int fired = 0;
+			while (m_heads[slot] != s_nil) {
+				const uint32_t idx = m_heads[slot];
+				_unlink(idx);
+				Callback cb = std::move(m_nodes[idx].m_cb);
+				_release(idx);
+				cb();
+				fired++;
+			}
+			return fired;
+		}
+
+	private:
+		uint64_t m_tickMs;
+		uint64_t m_nowTick;
+		uint32_t m_heads[s_levels * s_slots];
+		// m_next links free nodes
+		uint32_t m_free;
+		std::vector<Node> m_nodes;
+		size_t m_size;
+	};
+}